@@ -48,6 +48,44 @@
  * of its current chunks are free */
 #define ZONE_ALLOC_RETIRE 32
 
+/* When BUFFERED_RANDOM is enabled each refill of the per
+ * thread random buffer runs this many ChaCha20 blocks. The
+ * first 32 bytes become the next key and the rest are
+ * handed out by rand_uint64(). The key is mixed with new
+ * entropy from the kernel every RAND_RESEED_INTERVAL
+ * refills, roughly every 30kb of output by default */
+#define RAND_CHACHA_BLOCKS 8
+#define RAND_RESEED_INTERVAL 64
+
+/* Free big zones are kept for reuse until the total size
+ * of their user pages is above BIG_ZONE_RETAIN_SZ. The
+ * least recently freed are unmapped until it fits again.
+ * A free big zone that is larger than the allocation it
+ * serves is split when the remainder, after 2 new guard
+ * pages, is at least BIG_ZONE_SPLIT_MIN_SZ bytes */
+#define BIG_ZONE_RETAIN_SZ 268435456
+#define BIG_ZONE_SPLIT_MIN_SZ 262144
+
+/* With PAGE_PURGING a zone looks for free pages to give
+ * back to the kernel every time this many bytes have been
+ * free'd from it */
+#define ZONE_PURGE_THRESHOLD 1048576
+
+/* When BACKGROUND_THREAD is enabled a thread wakes up
+ * every BACKGROUND_TICK_MS to do deferred work. Free pages
+ * in zones, and free big zones, are given back to the kernel
+ * once they have been free for BACKGROUND_DECAY_MS. The next
+ * zone of a size class is created ahead of time once all of
+ * its zones are at least ZONE_PRECREATE_PERCENT full */
+#define BACKGROUND_TICK_MS 100
+#define BACKGROUND_DECAY_MS 10000
+#define ZONE_PRECREATE_PERCENT 90
+
+/* iso_alloc_trim() gives back all the pages of empty
+ * zones but keeps this many zones of each size class
+ * ready to use */
+#define ZONE_TRIM_KEEP 1
+
 /* The size of our bit slot freelist */
 #define BIT_SLOT_CACHE_SZ 255
 
@@ -70,12 +108,16 @@
 #define CHUNK_QUARANTINE_SZ 64
 
 /* This is the maximum number of zones iso_alloc can
- * create. This is a completely arbitrary number but
- * it does correspond to the size of the _root.zones
- * array. Currently the iso_alloc_zone_t structure is
- * roughly 2112 bytes so this results in 17301504 bytes
- * (~17 MB) for zone meta data */
-#define MAX_ZONES 8192
+ * create. Address space for this many iso_alloc_zone_t
+ * structures is reserved at startup, 32 MB with the
+ * default 128 byte zone, but the _root.zones table is
+ * only committed ZONE_TABLE_COMMIT_SZ bytes at a time
+ * as zones are created */
+#define MAX_ZONES 262144
+
+/* The zone table grows by this many bytes at a time.
+ * Must be a multiple of the page size */
+#define ZONE_TABLE_COMMIT_SZ 65536
 
 /* We allocate zones at startup for common sizes.
  * Each of these default zones is 4mb (ZONE_USER_SIZE)
@@ -99,6 +141,23 @@
  * wasting memory by doing so */
 #define MAX_DEFAULT_ZONE_SZ ZONE_8192
 
+/* When THREAD_ZONES is enabled each thread creates its
+ * own zones for chunk sizes up to and including this
+ * value. Each of these zones is ZONE_USER_SIZE so the
+ * virtual memory cost is (threads * size classes * 4mb).
+ * Larger requests are served from the shared zones */
+#define THREAD_ZONE_MAX_SZ ZONE_8192
+
+/* When THREAD_ZONES is enabled a chunk freed by a thread
+ * that doesn't own its zone is queued in that zone without
+ * taking the zone lock. The owner frees queued chunks in
+ * batches of REMOTE_FREE_BATCH on its next allocation.
+ * If the queue is full the freeing thread falls back to
+ * taking the zone lock. REMOTE_FREE_SZ must be a power
+ * of 2 and costs 8 bytes per entry in each zone */
+#define REMOTE_FREE_SZ 64
+#define REMOTE_FREE_BATCH 16
+
 /* If you have specific allocation pattern requirements
  * then you may want a custom set of default zones. These
  * example are provided to get you started. Zone creation
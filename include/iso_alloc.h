@@ -18,6 +18,7 @@
 #define CALLOC_SIZE __attribute__((alloc_size(1, 2)))
 #define REALLOC_SIZE __attribute__((alloc_size(2)))
 #define ZONE_ALLOC_SIZE __attribute__((alloc_size(2)))
+#define ALIGNED_ALLOC_SIZE __attribute__((alloc_size(2), alloc_align(1)))
 #define ASSUME_ALIGNED __attribute__((assume_aligned(8)))
 
 #define UNMASK_ZONE_HANDLE(zone) \
@@ -33,7 +34,10 @@ extern "C" {
 EXTERNAL_API NO_DISCARD MALLOC_ATTR ALLOC_SIZE ASSUME_ALIGNED void *iso_alloc(size_t size);
 EXTERNAL_API NO_DISCARD MALLOC_ATTR CALLOC_SIZE ASSUME_ALIGNED void *iso_calloc(size_t nmemb, size_t size);
 EXTERNAL_API NO_DISCARD MALLOC_ATTR REALLOC_SIZE ASSUME_ALIGNED void *iso_realloc(void *p, size_t size);
+EXTERNAL_API NO_DISCARD MALLOC_ATTR ALIGNED_ALLOC_SIZE void *iso_alloc_aligned(size_t alignment, size_t size);
+EXTERNAL_API NO_DISCARD size_t iso_alloc_batch(size_t size, size_t n, void **out);
 EXTERNAL_API void iso_free(void *p);
+EXTERNAL_API void iso_free_batch(void **ptrs, size_t n);
 EXTERNAL_API void iso_free_size(void *p, size_t size);
 EXTERNAL_API void iso_free_permanently(void *p);
 EXTERNAL_API void iso_free_from_zone(void *p, iso_alloc_zone_handle *zone);
@@ -60,6 +64,7 @@ EXTERNAL_API void iso_verify_zones();
 EXTERNAL_API void iso_verify_zone(iso_alloc_zone_handle *zone);
 EXTERNAL_API int32_t iso_alloc_name_zone(iso_alloc_zone_handle *zone, char *name);
 EXTERNAL_API void iso_flush_caches();
+EXTERNAL_API size_t iso_alloc_trim(size_t target_bytes);
 
 #if HEAP_PROFILER
 #define BACKTRACE_DEPTH 8
@@ -44,6 +44,7 @@
 #include <inttypes.h>
 #include <limits.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -74,6 +75,11 @@ using namespace std;
 #include <sys/prctl.h>
 #endif
 
+#if BACKGROUND_THREAD
+#include <fcntl.h>
+#include <time.h>
+#endif
+
 #if defined(CPU_PIN) && defined(_GNU_SOURCE) && defined(__linux__)
 #include <sched.h>
 #endif
@@ -93,20 +99,20 @@ using namespace std;
 #if ENABLE_ASAN
 #include <sanitizer/asan_interface.h>
 
-#define POISON_ZONE(zone)                                                     \
-    if(IS_POISONED_RANGE(zone->user_pages_start, ZONE_USER_SIZE) == 0) {      \
-        ASAN_POISON_MEMORY_REGION(zone->user_pages_start, ZONE_USER_SIZE);    \
-    }                                                                         \
-    if(IS_POISONED_RANGE(zone->bitmap_start, zone->bitmap_size) == 0) {       \
-        ASAN_POISON_MEMORY_REGION(zone->user_pages_start, zone->bitmap_size); \
+#define POISON_ZONE(zone)                                                      \
+    if(IS_POISONED_RANGE(zone->user_pages_start, ZONE_USER_SZ(zone)) == 0) {   \
+        ASAN_POISON_MEMORY_REGION(zone->user_pages_start, ZONE_USER_SZ(zone)); \
+    }                                                                          \
+    if(IS_POISONED_RANGE(zone->bitmap_start, zone->bitmap_size) == 0) {        \
+        ASAN_POISON_MEMORY_REGION(zone->user_pages_start, zone->bitmap_size);  \
     }
 
-#define UNPOISON_ZONE(zone)                                                  \
-    if(IS_POISONED_RANGE(zone->user_pages_start, ZONE_USER_SIZE) != 0) {     \
-        ASAN_UNPOISON_MEMORY_REGION(zone->user_pages_start, ZONE_USER_SIZE); \
-    }                                                                        \
-    if(IS_POISONED_RANGE(zone->bitmap_start, zone->bitmap_size) != 0) {      \
-        ASAN_UNPOISON_MEMORY_REGION(zone->bitmap_start, zone->bitmap_size);  \
+#define UNPOISON_ZONE(zone)                                                      \
+    if(IS_POISONED_RANGE(zone->user_pages_start, ZONE_USER_SZ(zone)) != 0) {     \
+        ASAN_UNPOISON_MEMORY_REGION(zone->user_pages_start, ZONE_USER_SZ(zone)); \
+    }                                                                            \
+    if(IS_POISONED_RANGE(zone->bitmap_start, zone->bitmap_size) != 0) {          \
+        ASAN_UNPOISON_MEMORY_REGION(zone->bitmap_start, zone->bitmap_size);      \
     }
 
 #define POISON_ZONE_CHUNK(zone, ptr)                      \
@@ -201,6 +207,10 @@ using namespace std;
 /* All chunks are 8 byte aligned */
 #define ALIGNMENT 8
 
+/* Zone metadata is aligned to a cache line so the
+ * fields used by the hot paths share a single line */
+#define CACHE_LINE_SZ 64
+
 #if !NAMED_MAPPINGS
 #define SAMPLED_ALLOC_NAME ""
 #define BIG_ZONE_UD_NAME ""
@@ -245,6 +255,78 @@ using namespace std;
 #define GET_MAX_BITMASK_INDEX(zone) \
     (zone->bitmap_size >> 3)
 
+/* Each zone bitmap is followed by a summary bitmap with
+ * one bit per bitmap qword that has at least one free
+ * chunk. Both share a mapping. The summary is rounded
+ * up to a whole qword */
+#define GET_SUMMARY_SIZE(zone) \
+    (((GET_MAX_BITMASK_INDEX(zone) + BITS_PER_QWORD - 1) >> BITS_PER_QWORD_SHIFT) * sizeof(bitmap_index_t))
+
+#define GET_SUMMARY_PTR(zone, bm) \
+    ((bitmap_index_t *) (bm) + GET_MAX_BITMASK_INDEX(zone))
+
+/* The free bit slot cache follows the summary bitmap. It
+ * holds chunk numbers instead of bit slots so it is half
+ * the size, a zone never has more than 2^32 chunks */
+#define GET_FREE_SLOT_CACHE_SIZE \
+    (((BIT_SLOT_CACHE_SZ * sizeof(free_slot_t)) + (sizeof(uint64_t) - 1)) & ~(sizeof(uint64_t) - 1))
+
+#define GET_FREE_SLOT_CACHE_PTR(zone, bm) \
+    ((free_slot_t *) ((uint8_t *) GET_SUMMARY_PTR(zone, bm) + GET_SUMMARY_SIZE(zone)))
+
+/* The purge map follows the free bit slot cache. It has
+ * one bit per user page, set while that page has no
+ * canaries because it was never used or it was purged,
+ * and is sized for 4kb pages which is the smallest page
+ * size we support */
+#define PURGE_MAP_PAGE_SHIFT 12
+
+#define GET_PURGE_MAP_SIZE(zone) \
+    ((((ZONE_USER_SZ(zone) >> PURGE_MAP_PAGE_SHIFT) + BITS_PER_QWORD - 1) >> BITS_PER_QWORD_SHIFT) * sizeof(uint64_t))
+
+#define GET_PURGE_MAP_PTR(zone, bm) \
+    ((uint64_t *) ((uint8_t *) GET_FREE_SLOT_CACHE_PTR(zone, bm) + GET_FREE_SLOT_CACHE_SIZE))
+
+#define PURGE_MAP_GET(purged, page) \
+    (((purged)[(page) >> BITS_PER_QWORD_SHIFT] >> ((page) & (BITS_PER_QWORD - 1))) & 1)
+
+#define PURGE_MAP_SET(purged, page) \
+    ((purged)[(page) >> BITS_PER_QWORD_SHIFT] |= (1ULL << ((page) & (BITS_PER_QWORD - 1))))
+
+#define PURGE_MAP_UNSET(purged, page) \
+    ((purged)[(page) >> BITS_PER_QWORD_SHIFT] &= ~(1ULL << ((page) & (BITS_PER_QWORD - 1))))
+
+/* True if the canary at p is on a page that has no
+ * canaries, it must read as 0. Requires the pointers
+ * of the zone are unmasked */
+#define CANARY_PAGE_MARKED(zone, p)                                                             \
+    ((zone)->purged_pages != 0 && PURGE_MAP_GET(GET_PURGE_MAP_PTR(zone, (zone)->bitmap_start), \
+                                                ((uintptr_t) (p) - (uintptr_t) (zone)->user_pages_start) / _root->system_page_size) == 1)
+
+#define GET_BITMAP_MAPPING_SIZE(zone) \
+    (zone->bitmap_size + GET_SUMMARY_SIZE(zone) + GET_FREE_SLOT_CACHE_SIZE + GET_PURGE_MAP_SIZE(zone))
+
+/* Chunk states the bitmap kernels search for and count.
+ * FREE is 00 or 01, IN_USE is 10 or 11, USED is 01 or 11
+ * which is every chunk with a canary, and FREED is 01 */
+#define BITMAP_STATE_FREE 0
+#define BITMAP_STATE_IN_USE 1
+#define BITMAP_STATE_USED 2
+#define BITMAP_STATE_FREED 3
+#define BITMAP_STATE_COUNT 4
+
+/* Bitmap kernels. The widest one the CPU supports is
+ * selected when the root is created */
+#define BITMAP_KERNEL_PORTABLE 0
+#define BITMAP_KERNEL_AVX2 1
+#define BITMAP_KERNEL_AVX512 2
+#define BITMAP_KERNEL_NEON 3
+#define BITMAP_KERNEL_COUNT 4
+
+/* The in-use bits of a bitmap qword that are 0 */
+#define GET_FREE_BITSLOTS(b) \
+    (~(b) & ALLOCATED_BITSLOTS)
+
 #define MASK_ZONE_PTRS(zone) \
     MASK_BITMAP_PTRS(zone);  \
     MASK_USER_PTRS(zone);
@@ -270,12 +352,34 @@ using namespace std;
 #define UNMASK_BIG_ZONE_NEXT(bnp) \
     ((iso_alloc_big_zone_t *) ((uintptr_t) _root->big_zone_next_mask ^ (uintptr_t) bnp))
 
+#define MASK_BIG_ZONE_KEY(p) \
+    ((uintptr_t) _root->big_zone_next_mask ^ (uintptr_t) (p))
+
+#define CHUNKS_PER_QWORD (BITS_PER_QWORD / BITS_PER_CHUNK)
+
+/* Zones only hold whole qwords of bitmap so the chunk
+ * count is rounded down to a multiple of CHUNKS_PER_QWORD.
+ * Any user pages past the last chunk are never touched */
 #define GET_CHUNK_COUNT(zone) \
-    (ZONE_USER_SIZE / zone->chunk_size)
+    ((ZONE_USER_SZ(zone) / zone->chunk_size) & ~(CHUNKS_PER_QWORD - 1))
+
+/* Chunk sizes are not always a power of 2 so chunk
+ * offsets are divided with a multiply and a shift by
+ * a reciprocal computed when the zone is created. The
+ * result is exact for any offset below 2^CHUNK_DIV_BITS */
+#define CHUNK_DIV_BITS 26
+
+#define GET_CHUNK_NUMBER(zone, offset) \
+    (((uint64_t) (offset) * (zone)->chunk_size_magic) >> (zone)->chunk_size_shift)
+
+/* Zones for chunks larger than SMALL_SZ_MAX are medium
+ * zones and have a larger user region */
+#define ZONE_USER_SZ(zone) \
+    ((zone)->chunk_size > SMALL_SZ_MAX ? MEDIUM_ZONE_USER_SIZE : ZONE_USER_SIZE)
 
 /* Each user allocation zone we make is 4mb in size.
- * With MAX_ZONES at 8192 this means we top out at
- * about 32~ gb of heap. If you adjust this then
+ * With MAX_ZONES at 262144 this means we top out at
+ * about 1~ tb of heap. If you adjust this then
  * you need to make sure that SMALL_SZ_MAX is correctly
  * adjusted or you will calculate chunks outside of
  * the zone user memory! */
@@ -287,6 +391,29 @@ using namespace std;
  * mapping code path */
 #define SMALL_SZ_MAX 131072
 
+/* Medium zones serve chunks above SMALL_SZ_MAX up to
+ * MEDIUM_SZ_MAX when MEDIUM_ZONES is enabled. Their
+ * user region is larger so the biggest size class
+ * still gets a full bitmap qword of chunks. Anything
+ * above ZONE_SZ_MAX goes through the big zone path */
+#define MEDIUM_ZONE_USER_SIZE 67108864
+#define MEDIUM_SZ_MAX 2097152
+
+#if MEDIUM_ZONE_USER_SIZE > (1 << CHUNK_DIV_BITS) || ZONE_USER_SIZE > (1 << CHUNK_DIV_BITS)
+#error "CHUNK_DIV_BITS must cover the largest zone user size"
+#endif
+
+/* With SIZE_CLASSES each power of 2 is split into four
+ * size classes. Classes up to ZONE_64 are multiples of
+ * SIZE_CLASS_MIN_STEP */
+#define SIZE_CLASS_MIN_STEP 16
+
+#if MEDIUM_ZONES
+#define ZONE_SZ_MAX MEDIUM_SZ_MAX
+#else
+#define ZONE_SZ_MAX SMALL_SZ_MAX
+#endif
+
 /* Cap our big zones at 4GB of memory */
 #define BIG_SZ_MAX 4294967296
 
@@ -297,13 +424,74 @@ using namespace std;
 #define BIG_ZONE_USER_PAGE_COUNT 2
 #define BIG_ZONE_USER_PAGE_COUNT_SHIFT 1
 
+/* Big zones are indexed by the address of their user
+ * pages in an open addressing hash table that doubles
+ * in size when it is half full. Free big zones are
+ * kept in lists binned by size. Each power of 2 from
+ * BIG_ZONE_FREE_BIN_MIN_SHIFT up is split into 4 bins */
+#define BIG_ZONE_INDEX_MIN_SHIFT 8
+#define BIG_ZONE_FREE_BINS 64
+#define BIG_ZONE_FREE_BIN_MIN_SHIFT 17
+
+#define BIG_ZONE_INDEX_HASH(key, shift) \
+    (((key) * 0x9e3779b97f4a7c15ULL) >> (64 - (shift)))
+
 #define TAGGED_PTR_MASK 0x00ffffffffffffff
 #define IS_TAGGED_PTR_MASK 0xff00000000000000
 #define UNTAGGED_BITS 56
 
-#define ZONE_LOOKUP_TABLE_SZ ((SMALL_SZ_MAX + 1) * sizeof(uint16_t))
-#define CHUNK_TO_ZONE_TABLE_SZ (65535 * sizeof(uint16_t))
-#define ADDR_TO_CHUNK_TABLE(p) (((uintptr_t) p >> 32) & 0xffff)
+#define ZONE_LOOKUP_TABLE_SZ ((SMALL_SZ_MAX + 1) * sizeof(zone_lookup_table_t))
+
+/* The zone map is a radix tree that resolves any address
+ * in the user pages or bitmap of a zone to that zone with
+ * three loads. It covers a 48 bit address space in 4kb
+ * units. The root and each node resolve 13 bits and each
+ * leaf covers one ZONE_USER_SIZE region of 1024 units.
+ * Entries hold the zone index + 1 so 0 means no zone */
+#define ZONE_MAP_VA_BITS 48
+#define ZONE_MAP_UNIT_SHIFT 12
+#define ZONE_MAP_LEAF_BITS 10
+#define ZONE_MAP_NODE_BITS 13
+#define ZONE_MAP_ROOT_BITS 13
+
+#define ZONE_MAP_LEAF_SZ ((1 << ZONE_MAP_LEAF_BITS) * sizeof(zone_map_entry_t))
+#define ZONE_MAP_NODE_SZ ((1 << ZONE_MAP_NODE_BITS) * sizeof(zone_map_entry_t *))
+#define ZONE_MAP_ROOT_SZ ((1 << ZONE_MAP_ROOT_BITS) * sizeof(zone_map_entry_t **))
+
+#define ZONE_MAP_UNIT(p) \
+    (((uintptr_t) (p) & ((1ULL << ZONE_MAP_VA_BITS) - 1)) >> ZONE_MAP_UNIT_SHIFT)
+
+#define ZONE_MAP_ROOT_INDEX(u) \
+    ((u) >> (ZONE_MAP_LEAF_BITS + ZONE_MAP_NODE_BITS))
+
+#define ZONE_MAP_NODE_INDEX(u) \
+    (((u) >> ZONE_MAP_LEAF_BITS) & ((1 << ZONE_MAP_NODE_BITS) - 1))
+
+#define ZONE_MAP_LEAF_INDEX(u) \
+    ((u) & ((1 << ZONE_MAP_LEAF_BITS) - 1))
+
+#if (ZONE_MAP_UNIT_SHIFT + ZONE_MAP_LEAF_BITS + ZONE_MAP_NODE_BITS + ZONE_MAP_ROOT_BITS) != ZONE_MAP_VA_BITS
+#error "The zone map levels must cover ZONE_MAP_VA_BITS"
+#endif
+
+/* When CONTIGUOUS_ZONES is enabled every zone is placed
+ * in a ZONE_SLOT_SZ slot of one large reservation. The
+ * bitmap and its guard pages are at the start of a slot
+ * and the user pages start at ZONE_SLOT_USER_OFFSET, so
+ * they are aligned for huge pages, with any memory tags
+ * just below them. The rest of the slot stays PROT_NONE */
+#define ZONE_SLOT_SHIFT 23
+#define ZONE_SLOT_SZ (1ULL << ZONE_SLOT_SHIFT)
+#define ZONE_SLOT_USER_OFFSET (ZONE_USER_SIZE / 2)
+#define ZONE_SLOTS_SZ ((size_t) MAX_ZONES * ZONE_SLOT_SZ)
+
+#if CONTIGUOUS_ZONES && (MAX_ZONES & (MAX_ZONES - 1)) != 0
+#error "CONTIGUOUS_ZONES requires MAX_ZONES is a power of 2"
+#endif
+
+#if CONTIGUOUS_ZONES && MEDIUM_ZONES
+#error "Medium zones don't fit in a zone slot, CONTIGUOUS_ZONES requires MEDIUM_ZONES=0"
+#endif
 
 /* A uint64_t of bitslots below this value will
  * have at least 1 single free bit slot */
@@ -318,6 +506,7 @@ using namespace std;
 #define CANARY_VALIDATE_MASK 0xffffffffffffff00
 
 #define BAD_BIT_SLOT -1
+#define BAD_FREE_SLOT UINT32_MAX
 
 /* Calculate the user pointer given a zone and a bit slot */
 #define POINTER_FROM_BITSLOT(zone, bit_slot) \
@@ -341,36 +530,120 @@ extern uint32_t g_page_size;
 #error "Smallest chunk size is 8 bytes, 16 is recommended!"
 #endif
 
+#if THREAD_ZONES && !THREAD_SUPPORT
+#error "THREAD_ZONES requires THREAD_SUPPORT"
+#endif
+
+#if BACKGROUND_THREAD && !THREAD_SUPPORT
+#error "BACKGROUND_THREAD requires THREAD_SUPPORT"
+#endif
+
+/* Number of background thread ticks in BACKGROUND_DECAY_MS */
+#define BACKGROUND_DECAY_TICKS (BACKGROUND_DECAY_MS / BACKGROUND_TICK_MS)
+
+/* The most retire or pre-create candidates the
+ * background thread collects in a single tick */
+#define BACKGROUND_BATCH_SZ 64
+
+/* log2 of a power of 2 below 2^32 as a constant expression */
+#define CONST_LOG2_4(x) ((x) >= 8 ? 3 : (x) >= 4 ? 2 : (x) >= 2 ? 1 : 0)
+#define CONST_LOG2_8(x) ((x) >= 16 ? 4 + CONST_LOG2_4((x) >> 4) : CONST_LOG2_4(x))
+#define CONST_LOG2_16(x) ((x) >= 256 ? 8 + CONST_LOG2_8((x) >> 8) : CONST_LOG2_8(x))
+#define CONST_LOG2(x) ((x) >= 65536 ? 16 + CONST_LOG2_16((x) >> 16) : CONST_LOG2_16(x))
+
+#if (THREAD_ZONE_MAX_SZ & (THREAD_ZONE_MAX_SZ - 1)) != 0 || THREAD_ZONE_MAX_SZ > SMALL_SZ_MAX
+#error "THREAD_ZONE_MAX_SZ must be a power of 2 no larger than SMALL_SZ_MAX"
+#endif
+
+/* Thread zones are indexed by size_class_index() so we
+ * need one slot for every size class up to and including
+ * THREAD_ZONE_MAX_SZ, which is its index plus one. Without
+ * SIZE_CLASSES that is one slot per bit position */
+#if SIZE_CLASSES
+#if THREAD_ZONE_MAX_SZ <= ZONE_64
+#define THREAD_ZONE_SLOTS ((THREAD_ZONE_MAX_SZ / SIZE_CLASS_MIN_STEP) + 1)
+#else
+#define THREAD_ZONE_SLOTS ((CONST_LOG2(THREAD_ZONE_MAX_SZ) << 2) - 19)
+#endif
+#else
+#define THREAD_ZONE_SLOTS (CONST_LOG2(THREAD_ZONE_MAX_SZ) + 1)
+#endif
+
+#if (REMOTE_FREE_SZ & (REMOTE_FREE_SZ - 1)) != 0
+#error "REMOTE_FREE_SZ must be a power of 2"
+#endif
+
 typedef int64_t bit_slot_t;
 typedef int64_t bitmap_index_t;
-typedef uint16_t zone_lookup_table_t;
-typedef uint16_t chunk_lookup_table_t;
-
+typedef uint32_t free_slot_t;
+typedef uint32_t zone_lookup_table_t;
+typedef uint32_t zone_map_entry_t;
+
+/* The zone metadata is split in two. Everything the alloc
+ * and free hot paths touch is packed into the first cache
+ * line and the rest follows it. The free bit slot cache is
+ * kept out of line after the summary bitmap */
 typedef struct {
-    void *user_pages_start;     /* Start of the pages backing this zone */
-    void *bitmap_start;         /* Start of the bitmap */
-    int64_t next_free_bit_slot; /* The last bit slot returned by get_next_free_bit_slot */
+    void *user_pages_start;             /* Start of the pages backing this zone */
+    void *bitmap_start;                 /* Start of the bitmap */
+    uint64_t pointer_mask;              /* Each zone has its own pointer protection secret */
+    int64_t next_free_bit_slot;         /* The last bit slot returned by get_next_free_bit_slot */
+    uint32_t chunk_size;                /* Size of chunks managed by this zone */
+    uint32_t chunk_size_magic;          /* Reciprocal of chunk_size used by GET_CHUNK_NUMBER */
+    uint32_t bitmap_size;               /* Size of the bitmap in bytes */
+    uint32_t alloc_count;               /* Total number of lifetime allocations */
+    uint32_t af_count;                  /* Increment/Decrement with each alloc/free operation */
+    uint32_t index;                     /* Zone index */
     /* These indexes must be bumped to uint16_t if BIT_SLOT_CACHE_SZ >= MAX_UINT8 */
-    uint8_t free_bit_slot_cache_index;                 /* Tracks how many entries in the cache are filled */
-    uint8_t free_bit_slot_cache_usable;                /* The oldest members of the free cache are served first */
-    bit_slot_t free_bit_slot_cache[BIT_SLOT_CACHE_SZ]; /* A cache of bit slots that point to freed chunks */
-    uint64_t canary_secret;                            /* Each zone has its own canary secret */
-    uint64_t pointer_mask;                             /* Each zone has its own pointer protection secret */
-    uint32_t chunk_size;                               /* Size of chunks managed by this zone */
-    uint32_t bitmap_size;                              /* Size of the bitmap in bytes */
-    bool internal;                                     /* Zones can be managed by iso_alloc or private */
-    bool is_full;                                      /* Flags whether this zone is full to avoid bit slot searches */
-    uint16_t index;                                    /* Zone index */
-    uint16_t next_sz_index;                            /* What is the index of the next zone of this size */
-    uint32_t alloc_count;                              /* Total number of lifetime allocations */
-    uint32_t af_count;                                 /* Increment/Decrement with each alloc/free operation */
+    uint8_t free_bit_slot_cache_index;  /* Tracks how many entries in the cache are filled */
+    uint8_t free_bit_slot_cache_usable; /* The oldest members of the free cache are served first */
+    uint8_t chunk_size_shift;           /* Shift applied after multiplying by chunk_size_magic */
+    bool is_full;                       /* Flags whether this zone is full to avoid bit slot searches */
+    bool internal;                      /* Zones can be managed by iso_alloc or private */
 #if MEMORY_TAGGING
     bool tagged; /* Zone supports memory tagging */
 #endif
 #if CPU_PIN
     uint8_t cpu_core; /* What CPU core this zone is pinned to */
 #endif
-} __attribute__((aligned(sizeof(int64_t)))) iso_alloc_zone_t;
+    /* Cold fields start here */
+    uint64_t canary_secret; /* Each zone has its own canary secret */
+    uint32_t next_sz_index; /* What is the index of the next zone of this size */
+    bool released;          /* Pages were given back by iso_alloc_trim() and its canaries are gone */
+    uint32_t purged_pages;  /* Number of user pages marked in the purge map */
+#if PAGE_PURGING
+    uint32_t purge_freed; /* Bytes free'd since the last purge */
+#endif
+#if BACKGROUND_THREAD
+    uint32_t background_alloc_count; /* alloc_count when the background thread last saw this zone */
+    uint32_t purge_epoch;            /* Background epoch of the first free since the last purge */
+#endif
+#if THREAD_ZONES
+    uint64_t owner;                    /* Thread that owns this zone, 0 if shared */
+    void *remote_pages_start;          /* Masked copy of user_pages_start that is never unmasked in place */
+    void *remote_bitmap_start;         /* Masked copy of bitmap_start that is never unmasked in place */
+    uint32_t remote_free_hint;         /* Where the next remote free starts looking for an empty slot */
+    uint32_t remote_free_count;        /* Number of chunks waiting in remote_free */
+    void *remote_free[REMOTE_FREE_SZ]; /* Chunks freed by threads that don't own this zone */
+#endif
+    /* The zone lock must remain the last member. It is
+     * not wiped when a zone is replaced in place */
+#if THREAD_SUPPORT
+#if USE_SPINLOCK
+    atomic_flag lock; /* Guards the bitmap, cache and counters */
+#else
+    pthread_mutex_t lock; /* Guards the bitmap, cache and counters */
+#endif
+#endif
+} __attribute__((aligned(CACHE_LINE_SZ))) iso_alloc_zone_t;
+
+/* The number of bytes of a zone that are wiped when
+ * it is created or replaced. This excludes the lock */
+#if THREAD_SUPPORT
+#define ZONE_RESET_SZ offsetof(iso_alloc_zone_t, lock)
+#else
+#define ZONE_RESET_SZ sizeof(iso_alloc_zone_t)
+#endif
 
 /* Each thread gets a local cache of the most recently
  * used zones. This can greatly speed up allocations
@@ -423,6 +696,40 @@ extern pthread_mutex_t big_zone_busy_mutex;
 #define UNLOCK_BIG_ZONE()
 #endif
 
+/* Every zone carries its own lock which guards its
+ * bitmap, free bit slot cache and counters. The root
+ * lock only guards zone creation and destruction and
+ * the lookup tables. Threads allocating from different
+ * zones never contend with each other. The lock order
+ * is always root->zone and no thread ever holds more
+ * than one zone lock at a time */
+#if THREAD_SUPPORT
+#if USE_SPINLOCK
+#define INIT_ZONE_LOCK(zone) \
+    atomic_flag_clear(&zone->lock);
+
+#define LOCK_ZONE(zone) \
+    do {                \
+    } while(atomic_flag_test_and_set(&zone->lock));
+
+#define UNLOCK_ZONE(zone) \
+    atomic_flag_clear(&zone->lock);
+#else
+#define INIT_ZONE_LOCK(zone) \
+    pthread_mutex_init(&zone->lock, NULL);
+
+#define LOCK_ZONE(zone) \
+    pthread_mutex_lock(&zone->lock);
+
+#define UNLOCK_ZONE(zone) \
+    pthread_mutex_unlock(&zone->lock);
+#endif
+#else
+#define INIT_ZONE_LOCK(zone)
+#define LOCK_ZONE(zone)
+#define UNLOCK_ZONE(zone)
+#endif
+
 /* Meta data for big allocations are allocated near the
  * user pages themselves but separated via guard pages.
  * This meta data is stored at a random offset from the
@@ -430,36 +737,65 @@ extern pthread_mutex_t big_zone_busy_mutex;
 typedef struct iso_alloc_big_zone_t {
     uint64_t canary_a;
     bool free;
+#if BACKGROUND_THREAD
+    bool dirty; /* Free but its pages have not been given back yet */
+#endif
     uint64_t size;
     void *user_pages_start;
-    struct iso_alloc_big_zone_t *next;
+    struct iso_alloc_big_zone_t *next;      /* Masked, all big zones */
+    struct iso_alloc_big_zone_t *prev;      /* Masked, all big zones */
+    struct iso_alloc_big_zone_t *free_next; /* Masked, free bin */
+    struct iso_alloc_big_zone_t *free_prev; /* Masked, free bin */
+    struct iso_alloc_big_zone_t *lru_next;  /* Masked, free big zones by age */
+    struct iso_alloc_big_zone_t *lru_prev;  /* Masked, free big zones by age */
+#if BACKGROUND_THREAD
+    uint32_t free_epoch; /* Background epoch when this big zone was free'd */
+#endif
     uint64_t canary_b;
 } __attribute__((aligned(sizeof(int64_t)))) iso_alloc_big_zone_t;
 
+/* An entry in the big zone index. Both values are
+ * masked with big_zone_next_mask, a key of 0 is an
+ * empty entry */
+typedef struct {
+    uintptr_t key;
+    iso_alloc_big_zone_t *big;
+} big_zone_index_entry_t;
+
 /* There is only one iso_alloc root per-process.
  * It contains an array of zone structures. Each
  * Zone represents a number of contiguous pages
  * that hold chunks containing caller data */
 typedef struct {
-    uint16_t zones_used;
+    uint32_t zones_used;
     uint16_t system_page_size;
+    uint8_t bitmap_kernel; /* Bitmap kernel picked by bitmap_kernel_select() */
     void *guard_below;
     void *guard_above;
     uint64_t zone_handle_mask;
     uint64_t big_zone_next_mask;
     uint64_t big_zone_canary_secret;
     iso_alloc_big_zone_t *big_zone_head;
+    big_zone_index_entry_t *big_zone_index;
+    uint64_t big_zone_index_shift;
+    uint64_t big_zone_count;
+    uint64_t big_zone_free_bitmap;
+    iso_alloc_big_zone_t *big_zone_free_bins[BIG_ZONE_FREE_BINS];
+    iso_alloc_big_zone_t *big_zone_lru_head; /* Most recently freed big zone */
+    iso_alloc_big_zone_t *big_zone_lru_tail; /* Least recently freed big zone */
+    uint64_t big_zone_free_bytes;            /* User bytes held by free big zones */
     iso_alloc_zone_t *zones;
     size_t zones_size;
+    size_t zones_committed; /* Bytes of the zone table that are committed */
+#if LAZY_ZONES
+    uint64_t default_zones_pending; /* Bit i is set until default_zones[i] is created */
+#endif
+#if MEM_USAGE
+    uint64_t zone_map_hits;   /* Zone map lookups that found a zone */
+    uint64_t zone_map_misses; /* Zone map lookups that found nothing */
+#endif
 } __attribute__((aligned(sizeof(int64_t)))) iso_alloc_root;
 
-typedef struct {
-    void *user_pages_start;
-    void *bitmap_start;
-    uint32_t bitmap_size;
-    uint8_t ttl;
-} __attribute__((aligned(sizeof(int64_t)))) zone_quarantine_t;
-
 #if NO_ZERO_ALLOCATIONS
 extern void *_zero_alloc_page;
 #endif
@@ -488,7 +824,7 @@ typedef struct {
     uint64_t count;
 } zone_profiler_map_t;
 
-zone_profiler_map_t _zone_profiler_map[SMALL_SZ_MAX];
+zone_profiler_map_t _zone_profiler_map[SMALL_SZ_MAX + 1];
 
 /* iso_alloc_traces_t is a public structure, and
  * is defined in the public header iso_alloc.h */
@@ -501,6 +837,23 @@ iso_free_traces_t _free_bts[BACKTRACE_DEPTH_SZ];
 size_t _free_bts_count;
 #endif
 
+#if BUFFERED_RANDOM
+/* Each thread runs its own ChaCha20 keystream and serves
+ * rand_uint64() from a buffer of its output. The first
+ * 32 bytes of every refill become the next key so past
+ * output can't be recovered from the current state. The
+ * key is mixed with fresh entropy from the kernel every
+ * RAND_RESEED_INTERVAL refills */
+#define RAND_BUFFER_WORDS (((RAND_CHACHA_BLOCKS * 64) - 32) / sizeof(uint64_t))
+
+typedef struct {
+    uint32_t key[8];                    /* ChaCha20 key, replaced on every refill */
+    uint64_t buffer[RAND_BUFFER_WORDS]; /* Keystream output not yet handed out */
+    uint32_t available;                 /* Number of unused words in buffer */
+    uint32_t refills_until_reseed;      /* Zero means the key must be reseeded */
+} rand_state_t;
+#endif
+
 /* The global root */
 extern iso_alloc_root *_root;
 
@@ -508,19 +861,71 @@ INTERNAL_HIDDEN INLINE void check_big_canary(iso_alloc_big_zone_t *big);
 INTERNAL_HIDDEN INLINE void check_canary(iso_alloc_zone_t *zone, const void *p);
 INTERNAL_HIDDEN INLINE void iso_clear_user_chunk(uint8_t *p, size_t size);
 INTERNAL_HIDDEN INLINE void fill_free_bit_slot_cache(iso_alloc_zone_t *zone);
-INTERNAL_HIDDEN INLINE void insert_free_bit_slot(iso_alloc_zone_t *zone, int64_t bit_slot);
+INTERNAL_HIDDEN INLINE void insert_free_bit_slot(iso_alloc_zone_t *zone, bitmap_index_t *bm, int64_t bit_slot);
 INTERNAL_HIDDEN INLINE void write_canary(iso_alloc_zone_t *zone, const void *p);
 INTERNAL_HIDDEN INLINE void populate_zone_cache(iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN INLINE void _flush_chunk_quarantine(void);
 INTERNAL_HIDDEN INLINE void clear_chunk_quarantine(void);
 INTERNAL_HIDDEN INLINE void clear_zone_cache(void);
+INTERNAL_HIDDEN INLINE bool iso_zone_holds_chunk(iso_alloc_zone_t *zone, const void *p);
 INTERNAL_HIDDEN iso_alloc_zone_t *is_zone_usable(iso_alloc_zone_t *zone, size_t size);
-INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_fit(size_t size);
+INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_fit(size_t size, size_t alignment);
+INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_for_alloc(size_t size, size_t alignment);
 INTERNAL_HIDDEN iso_alloc_zone_t *iso_new_zone(size_t size, bool internal);
 INTERNAL_HIDDEN iso_alloc_zone_t *_iso_new_zone(size_t size, bool internal);
 INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_bitmap_range(const void *p);
 INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_range(const void *p);
-INTERNAL_HIDDEN bit_slot_t iso_scan_zone_free_slot_slow(iso_alloc_zone_t *zone);
+INTERNAL_HIDDEN iso_alloc_zone_t *iso_lock_zone_range(const void *p);
+INTERNAL_HIDDEN iso_alloc_zone_t *zone_map_get(const void *p);
+INTERNAL_HIDDEN void zone_map_set(const void *p, size_t size, iso_alloc_zone_t *zone);
+INTERNAL_HIDDEN void *zone_slot_claim(void);
+INTERNAL_HIDDEN void zone_slot_release(void *p);
+INTERNAL_HIDDEN void init_zone_summary(iso_alloc_zone_t *zone);
+INTERNAL_HIDDEN void zone_table_grow(void);
+#if LAZY_ZONES
+INTERNAL_HIDDEN iso_alloc_zone_t *iso_new_default_zone(size_t size);
+#endif
+INTERNAL_HIDDEN bool chunk_is_purged(iso_alloc_zone_t *zone, const bitmap_index_t *bm, uint64_t chunk);
+INTERNAL_HIDDEN void unpurge_chunk(iso_alloc_zone_t *zone, const bitmap_index_t *bm, uint64_t chunk);
+INTERNAL_HIDDEN void unpurge_page(iso_alloc_zone_t *zone, const bitmap_index_t *bm, uint64_t *purged, uint64_t page);
+INTERNAL_HIDDEN void reset_purge_map(iso_alloc_zone_t *zone);
+INTERNAL_HIDDEN void clear_unpurged(iso_alloc_zone_t *zone, const bitmap_index_t *bm, void *p, size_t size);
+#if PAGE_PURGING
+INTERNAL_HIDDEN size_t purge_zone_pages(iso_alloc_zone_t *zone);
+INTERNAL_HIDDEN size_t purge_all_zones(void);
+INTERNAL_HIDDEN bool purge_page_is_free(iso_alloc_zone_t *zone, const bitmap_index_t *bm, uint64_t page);
+#endif
+#if BACKGROUND_THREAD
+INTERNAL_HIDDEN void background_thread_start(void);
+INTERNAL_HIDDEN void background_thread_stop(void);
+INTERNAL_HIDDEN void *background_thread_main(void *unused);
+INTERNAL_HIDDEN void background_tick(void);
+INTERNAL_HIDDEN bool background_last_thread(void);
+INTERNAL_HIDDEN void background_purge_big_zones(uint32_t epoch);
+INTERNAL_HIDDEN void background_fork_prepare(void);
+INTERNAL_HIDDEN void background_fork_parent(void);
+INTERNAL_HIDDEN void background_fork_child(void);
+INTERNAL_HIDDEN bool zone_nearly_full(iso_alloc_zone_t *zone);
+INTERNAL_HIDDEN void zone_precreate(uint32_t size);
+#endif
+INTERNAL_HIDDEN uint8_t bitmap_kernel_select(void);
+INTERNAL_HIDDEN bool bitmap_kernel_supported(int32_t kernel);
+INTERNAL_HIDDEN uint64_t bitmap_state_mask(uint64_t b, int32_t state);
+INTERNAL_HIDDEN int64_t bitmap_find(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state);
+INTERNAL_HIDDEN uint64_t bitmap_count(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state);
+INTERNAL_HIDDEN int64_t bitmap_find_with(int32_t kernel, const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state);
+INTERNAL_HIDDEN uint64_t bitmap_count_with(int32_t kernel, const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state);
+INTERNAL_HIDDEN int64_t bitmap_find_portable(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state);
+INTERNAL_HIDDEN uint64_t bitmap_count_portable(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state);
+#if __x86_64__
+INTERNAL_HIDDEN int64_t bitmap_find_avx2(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state);
+INTERNAL_HIDDEN uint64_t bitmap_count_avx2(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state);
+INTERNAL_HIDDEN int64_t bitmap_find_avx512(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state);
+INTERNAL_HIDDEN uint64_t bitmap_count_avx512(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state);
+#elif __aarch64__
+INTERNAL_HIDDEN int64_t bitmap_find_neon(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state);
+INTERNAL_HIDDEN uint64_t bitmap_count_neon(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state);
+#endif
 INTERNAL_HIDDEN bit_slot_t iso_scan_zone_free_slot(iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN bit_slot_t get_next_free_bit_slot(iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN iso_alloc_root *iso_alloc_new_root(void);
@@ -528,13 +933,21 @@ INTERNAL_HIDDEN bool is_pow2(uint64_t sz);
 INTERNAL_HIDDEN bool iso_does_zone_fit(iso_alloc_zone_t *zone, size_t size);
 INTERNAL_HIDDEN bool _is_zone_retired(iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN bool _refresh_zone_mem_tags(iso_alloc_zone_t *zone);
+INTERNAL_HIDDEN bool _iso_free_chunk_locked(iso_alloc_zone_t *zone, void *p, bool permanent);
 INTERNAL_HIDDEN void _iso_free_internal_unlocked(void *p, bool permanent, iso_alloc_zone_t *zone);
+INTERNAL_HIDDEN void _iso_free_from_locked_zone(iso_alloc_zone_t *zone, void *p, bool permanent);
 INTERNAL_HIDDEN void flush_caches(void);
+INTERNAL_HIDDEN void flush_thread_caches(void);
+INTERNAL_HIDDEN size_t _iso_alloc_trim(size_t target);
+INTERNAL_HIDDEN size_t release_empty_zones(size_t target);
+INTERNAL_HIDDEN size_t release_zone(iso_alloc_zone_t *zone);
+INTERNAL_HIDDEN void restore_released_zone(iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN void iso_free_chunk_from_zone(iso_alloc_zone_t *zone, void *p, bool permanent);
 INTERNAL_HIDDEN void create_canary_chunks(iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN void iso_alloc_initialize_global_root(void);
 INTERNAL_HIDDEN void mprotect_pages(void *p, size_t size, int32_t protection);
-INTERNAL_HIDDEN void _iso_alloc_destroy_zone_unlocked(iso_alloc_zone_t *zone, bool flush_caches, bool replace);
+INTERNAL_HIDDEN void _iso_alloc_destroy_zone_unlocked(iso_alloc_zone_t *zone, bool replace);
+INTERNAL_HIDDEN void recycle_zone(iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN void _iso_alloc_destroy_zone(iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN void _verify_zone(iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN void _verify_all_zones(void);
@@ -542,9 +955,25 @@ INTERNAL_HIDDEN void verify_zone(iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN void verify_all_zones(void);
 INTERNAL_HIDDEN void _iso_free(void *p, bool permanent);
 INTERNAL_HIDDEN void _iso_free_internal(void *p, bool permanent);
+INTERNAL_HIDDEN void _iso_free_chunks(void **ptrs, size_t n);
+INTERNAL_HIDDEN void _iso_free_batch(void **ptrs, size_t n);
 INTERNAL_HIDDEN void _iso_free_size(void *p, size_t size);
 INTERNAL_HIDDEN void _iso_free_from_zone(void *p, iso_alloc_zone_t *zone, bool permanent);
 INTERNAL_HIDDEN void iso_free_big_zone(iso_alloc_big_zone_t *big_zone, bool permanent);
+INTERNAL_HIDDEN iso_alloc_big_zone_t *iso_find_big_zone(void *p);
+INTERNAL_HIDDEN iso_alloc_big_zone_t *big_zone_index_find(const void *p);
+INTERNAL_HIDDEN void big_zone_index_insert(iso_alloc_big_zone_t *big);
+INTERNAL_HIDDEN void big_zone_index_remove(iso_alloc_big_zone_t *big);
+INTERNAL_HIDDEN void big_zone_index_grow(void);
+INTERNAL_HIDDEN iso_alloc_big_zone_t *big_zone_free_find(size_t size);
+INTERNAL_HIDDEN void big_zone_free_insert(iso_alloc_big_zone_t *big);
+INTERNAL_HIDDEN void big_zone_free_remove(iso_alloc_big_zone_t *big);
+INTERNAL_HIDDEN void big_zone_list_remove(iso_alloc_big_zone_t *big);
+INTERNAL_HIDDEN iso_alloc_big_zone_t *big_zone_new(void *user_pages, size_t size);
+INTERNAL_HIDDEN void big_zone_split(iso_alloc_big_zone_t *big, size_t size);
+INTERNAL_HIDDEN void big_zone_unmap(iso_alloc_big_zone_t *big);
+INTERNAL_HIDDEN void big_zone_trim(uint64_t retain);
+INTERNAL_HIDDEN INLINE uint64_t big_zone_free_bin(size_t size);
 INTERNAL_HIDDEN void _iso_alloc_protect_root(void);
 INTERNAL_HIDDEN void _iso_alloc_unprotect_root(void);
 INTERNAL_HIDDEN void _unmap_zone(iso_alloc_zone_t *zone);
@@ -553,10 +982,19 @@ INTERNAL_HIDDEN void *_untag_ptr(void *p, iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN void *create_guard_page(void *p);
 INTERNAL_HIDDEN void *mmap_rw_pages(size_t size, bool populate, const char *name);
 INTERNAL_HIDDEN void *mmap_pages(size_t size, bool populate, const char *name, int32_t prot);
-INTERNAL_HIDDEN void *_iso_big_alloc(size_t size);
+INTERNAL_HIDDEN void *_iso_big_alloc(size_t size, size_t alignment, bool zero);
+INTERNAL_HIDDEN iso_alloc_zone_t *iso_lock_thread_zone(size_t size);
+INTERNAL_HIDDEN void *_iso_thread_zone_alloc(size_t size, bool zero);
+INTERNAL_HIDDEN void _release_thread_zones(void *unused);
+INTERNAL_HIDDEN bool _iso_remote_free(void *p, size_t size);
+INTERNAL_HIDDEN uint32_t _iso_drain_remote_frees(iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc(iso_alloc_zone_t *zone, size_t size);
-INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc_bitslot_from_zone(bit_slot_t bitslot, iso_alloc_zone_t *zone);
+INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc_internal(iso_alloc_zone_t *zone, size_t size, size_t alignment, bool zero);
+INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc_bitslot_from_zone(bit_slot_t bitslot, iso_alloc_zone_t *zone, size_t zero_sz);
+INTERNAL_HIDDEN size_t _iso_alloc_bitslots_from_zone(iso_alloc_zone_t *zone, void **out, size_t n);
+INTERNAL_HIDDEN size_t _iso_alloc_batch(size_t size, size_t n, void **out);
 INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_calloc(size_t nmemb, size_t size);
+INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_aligned_alloc(size_t alignment, size_t size);
 INTERNAL_HIDDEN void *_iso_alloc_ptr_search(void *n, bool poison);
 INTERNAL_HIDDEN uint64_t _iso_alloc_zone_leak_detector(iso_alloc_zone_t *zone, bool profile);
 INTERNAL_HIDDEN uint64_t _iso_alloc_detect_leaks_in_zone(iso_alloc_zone_t *zone);
@@ -568,10 +1006,23 @@ INTERNAL_HIDDEN uint64_t __iso_alloc_big_zone_mem_usage();
 INTERNAL_HIDDEN uint64_t _iso_alloc_mem_usage(void);
 INTERNAL_HIDDEN uint64_t __iso_alloc_mem_usage(void);
 INTERNAL_HIDDEN uint64_t rand_uint64(void);
+INTERNAL_HIDDEN void rand_entropy(void *buf, size_t size);
+#if BUFFERED_RANDOM
+INTERNAL_HIDDEN void rand_refill(rand_state_t *rs);
+INTERNAL_HIDDEN void rand_atfork_child(void);
+INTERNAL_HIDDEN void rand_register_atfork(void);
+INTERNAL_HIDDEN void chacha20_block(const uint32_t key[8], uint32_t counter, uint32_t out[16]);
+#endif
 INTERNAL_HIDDEN uint8_t _iso_alloc_get_mem_tag(void *p, iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN size_t next_pow2(size_t sz);
+INTERNAL_HIDDEN size_t size_class(size_t sz);
+INTERNAL_HIDDEN int32_t size_class_index(size_t sz);
 INTERNAL_HIDDEN size_t _iso_alloc_print_stats();
 INTERNAL_HIDDEN size_t _iso_chunk_size(void *p);
+INTERNAL_HIDDEN bool _iso_realloc_in_place(void *p, size_t size);
+#if __linux__
+INTERNAL_HIDDEN void *_iso_big_realloc(void *p, size_t size);
+#endif
 INTERNAL_HIDDEN int64_t check_canary_no_abort(iso_alloc_zone_t *zone, const void *p);
 INTERNAL_HIDDEN int32_t name_zone(iso_alloc_zone_t *zone, char *name);
 INTERNAL_HIDDEN int32_t name_mapping(void *p, size_t sz, const char *name);
@@ -597,4 +1048,10 @@ INTERNAL_HIDDEN void _iso_alloc_search_stack(uint8_t *stack_start);
 
 #if UNIT_TESTING
 EXTERNAL_API iso_alloc_root *_get_root(void);
+#if THREAD_ZONES
+EXTERNAL_API void _set_remote_free_hook(void (*hook)(iso_alloc_zone_t *zone));
+#endif
+EXTERNAL_API bool _bitmap_kernel_supported(int32_t kernel);
+EXTERNAL_API int64_t _bitmap_find_with(int32_t kernel, const uint64_t *bm, int64_t start, int64_t end, int32_t state);
+EXTERNAL_API uint64_t _bitmap_count_with(int32_t kernel, const uint64_t *bm, int64_t start, int64_t end, int32_t state);
 #endif
@@ -3,6 +3,10 @@
 
 #include "iso_alloc_internal.h"
 
+/* Everything before canary_secret is read by the alloc
+ * and free hot paths and must fit in one cache line */
+_Static_assert(offsetof(iso_alloc_zone_t, canary_secret) <= CACHE_LINE_SZ, "Zone hot fields exceed a cache line");
+
 #if THREAD_SUPPORT
 
 #if USE_SPINLOCK
@@ -22,6 +26,19 @@ static __thread size_t zone_cache_count;
 
 static __thread uintptr_t chunk_quarantine[CHUNK_QUARANTINE_SZ];
 static __thread size_t chunk_quarantine_count;
+
+#if THREAD_ZONES
+/* Zones owned by this thread indexed by the log2 of
+ * their chunk size. Only the owning thread allocates
+ * from these zones so it never needs the root lock */
+static __thread iso_alloc_zone_t *thread_zones[THREAD_ZONE_SLOTS];
+static __thread uint64_t thread_zone_owner;
+static uint64_t thread_zone_owner_count;
+
+/* The destructor for this key hands a threads zones
+ * back to the shared pool when the thread exits */
+static pthread_key_t thread_zone_key;
+#endif
 #else
 /* When not using thread local storage we can mmap
  * these pages somewhere safer than global memory
@@ -43,12 +60,32 @@ iso_alloc_root *_root;
  * that holds a specific size in O(1) time */
 static zone_lookup_table_t *zone_lookup_table;
 
-/* The chunk to zone lookup table provides a high hit
- * rate cache for finding which zone owns a user chunk.
- * It works by mapping the MSB of the chunk addressq
- * to a zone index. Misses are gracefully handled and
- * more common with a higher RSS and more mappings. */
-static chunk_lookup_table_t *chunk_lookup_table;
+#if BACKGROUND_THREAD
+/* The background thread sleeps on background_cond between
+ * ticks and holds background_mutex while it works, so a
+ * fork never happens in the middle of a tick. The epoch
+ * counts ticks and is used to timestamp frees */
+static pthread_t background_thread;
+static pthread_mutex_t background_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t background_cond;
+static bool background_stopping;
+static uint32_t background_epoch;
+#endif
+
+#if CONTIGUOUS_ZONES
+/* Every zone lives in a ZONE_SLOT_SZ slot of a single
+ * reservation made at startup. The slot map holds the
+ * index + 1 of the zone in each slot and the used bitmap
+ * tracks which slots are taken, including slots of zones
+ * that can never be reused */
+static void *zone_slots;
+static zone_map_entry_t *zone_slot_map;
+static uint64_t *zone_slots_used;
+#else
+/* The zone map resolves a pointer into the user pages
+ * or bitmap of any zone to that zone in O(1) time */
+static zone_map_entry_t ***zone_map;
+#endif
 
 #if NO_ZERO_ALLOCATIONS
 void *_zero_alloc_page;
@@ -56,8 +93,14 @@ void *_zero_alloc_page;
 
 /* Select a random number of chunks to be canaries. These
  * can be verified anytime by calling check_canary()
- * or check_canary_no_abort() */
+ * or check_canary_no_abort(). Only the bitmap is written
+ * here. Every user page is marked in the purge map so the
+ * canaries on a page are written the first time one of
+ * its chunks is allocated, and a zone that is never used
+ * doesn't fault in its user pages */
 INTERNAL_HIDDEN void create_canary_chunks(iso_alloc_zone_t *zone) {
+    reset_purge_map(zone);
+
 #if ENABLE_ASAN || DISABLE_CANARY
     return;
 #else
@@ -69,8 +112,6 @@ INTERNAL_HIDDEN void create_canary_chunks(iso_alloc_zone_t *zone) {
     }
 
     bitmap_index_t *bm = (bitmap_index_t *) zone->bitmap_start;
-    bit_slot_t bit_slot;
-
     const bitmap_index_t max_bitmap_idx = GET_MAX_BITMASK_INDEX(zone) - 1;
     const uint64_t chunk_count = GET_CHUNK_COUNT(zone);
 
@@ -99,10 +140,16 @@ INTERNAL_HIDDEN void create_canary_chunks(iso_alloc_zone_t *zone) {
         /* Set the 1st and 2nd bits as 1 */
         SET_BIT(bm[bm_idx], 0);
         SET_BIT(bm[bm_idx], 1);
-        bit_slot = (bm_idx << BITS_PER_QWORD_SHIFT);
-        void *p = POINTER_FROM_BITSLOT(zone, bit_slot);
-        write_canary(zone, p);
     }
+
+    uint64_t *purged = GET_PURGE_MAP_PTR(zone, bm);
+    const uint64_t pages = ZONE_USER_SZ(zone) / _root->system_page_size;
+
+    for(uint64_t page = 0; page < pages; page++) {
+        PURGE_MAP_SET(purged, page);
+    }
+
+    zone->purged_pages = pages;
 #endif
 }
 
@@ -135,19 +182,24 @@ INTERNAL_HIDDEN void verify_all_zones(void) {
 
 INTERNAL_HIDDEN void verify_zone(iso_alloc_zone_t *zone) {
     LOCK_ROOT();
+    LOCK_ZONE(zone);
     _verify_zone(zone);
+    UNLOCK_ZONE(zone);
     UNLOCK_ROOT();
 }
 
 INTERNAL_HIDDEN void _verify_all_zones(void) {
     for(int32_t i = 0; i < _root->zones_used; i++) {
         iso_alloc_zone_t *zone = &_root->zones[i];
+        LOCK_ZONE(zone);
 
         if(zone->bitmap_start == NULL || zone->user_pages_start == NULL) {
+            UNLOCK_ZONE(zone);
             break;
         }
 
         _verify_zone(zone);
+        UNLOCK_ZONE(zone);
     }
 
     LOCK_BIG_ZONE();
@@ -188,16 +240,19 @@ INTERNAL_HIDDEN void _verify_zone(iso_alloc_zone_t *zone) {
         }
     }
 
-    for(bitmap_index_t i = 0; i < max_bm_idx; i++) {
-        for(int64_t j = 1; j < BITS_PER_QWORD; j += BITS_PER_CHUNK) {
-            /* If this bit is set it is either a free chunk or
-             * a canary chunk. Either way it should have a set
-             * of canaries we can verify */
-            if((GET_BIT(bm[i], j)) == 1) {
-                bit_slot = (i << BITS_PER_QWORD_SHIFT) + j;
-                const void *p = POINTER_FROM_BITSLOT(zone, bit_slot);
-                check_canary(zone, p);
-            }
+    /* Every chunk with its second bit set is either a free
+     * chunk or a canary chunk. Either way it should have a
+     * set of canaries we can verify */
+    for(int64_t i = bitmap_find(bm, 0, max_bm_idx, BITMAP_STATE_USED); i < max_bm_idx;
+        i = bitmap_find(bm, i + 1, max_bm_idx, BITMAP_STATE_USED)) {
+        uint64_t m = bitmap_state_mask(bm[i], BITMAP_STATE_USED);
+
+        while(m != 0) {
+            bit_slot = (i << BITS_PER_QWORD_SHIFT) + __builtin_ctzll(m);
+            m &= m - 1;
+
+            const void *p = POINTER_FROM_BITSLOT(zone, bit_slot);
+            check_canary(zone, p);
         }
     }
 
@@ -229,29 +284,33 @@ INTERNAL_HIDDEN INLINE void fill_free_bit_slot_cache(iso_alloc_zone_t *zone) {
         bm_idx = 0;
     }
 
-    memset(zone->free_bit_slot_cache, BAD_BIT_SLOT, sizeof(zone->free_bit_slot_cache));
+    free_slot_t *cache = GET_FREE_SLOT_CACHE_PTR(zone, bm);
+    memset(cache, 0xff, GET_FREE_SLOT_CACHE_SIZE);
     zone->free_bit_slot_cache_usable = 0;
-    uint8_t free_bit_slot_cache_index;
+    uint8_t free_bit_slot_cache_index = 0;
+    const bitmap_index_t *summary = GET_SUMMARY_PTR(zone, bm);
 
-    for(free_bit_slot_cache_index = 0; free_bit_slot_cache_index < BIT_SLOT_CACHE_SZ; bm_idx++) {
-        /* Don't index outside of the bitmap or
-         * we will return inaccurate bit slots */
-        if(UNLIKELY(bm_idx >= max_bitmap_idx)) {
-            zone->free_bit_slot_cache_index = free_bit_slot_cache_index;
-            return;
+    /* Only visit bitmap qwords the summary says have
+     * free chunks. Summary bits past max_bitmap_idx
+     * are never set */
+    while(free_bit_slot_cache_index < BIT_SLOT_CACHE_SZ && bm_idx < max_bitmap_idx) {
+        const uint64_t s = (uint64_t) summary[bm_idx >> BITS_PER_QWORD_SHIFT] >> (bm_idx & (BITS_PER_QWORD - 1));
+
+        if(s == 0) {
+            bm_idx = (bm_idx | (BITS_PER_QWORD - 1)) + 1;
+            continue;
         }
 
-        for(uint64_t j = 0; j < BITS_PER_QWORD; j += BITS_PER_CHUNK) {
-            if(free_bit_slot_cache_index >= BIT_SLOT_CACHE_SZ) {
-                zone->free_bit_slot_cache_index = free_bit_slot_cache_index;
-                return;
-            }
+        bm_idx += __builtin_ctzll(s);
+        bitmap_index_t free_slots = GET_FREE_BITSLOTS(bm[bm_idx]);
 
-            if((GET_BIT(bm[bm_idx], j)) == 0) {
-                zone->free_bit_slot_cache[free_bit_slot_cache_index] = (bm_idx << BITS_PER_QWORD_SHIFT) + j;
-                free_bit_slot_cache_index++;
-            }
+        while(free_slots != 0 && free_bit_slot_cache_index < BIT_SLOT_CACHE_SZ) {
+            cache[free_bit_slot_cache_index] = ((bm_idx << BITS_PER_QWORD_SHIFT) + __builtin_ctzll(free_slots)) >> BITS_PER_CHUNK_SHIFT;
+            free_bit_slot_cache_index++;
+            free_slots &= (free_slots - 1);
         }
+
+        bm_idx++;
     }
 
 #if SHUFFLE_BIT_SLOT_CACHE
@@ -259,9 +318,9 @@ INTERNAL_HIDDEN INLINE void fill_free_bit_slot_cache(iso_alloc_zone_t *zone) {
     if(free_bit_slot_cache_index > 1) {
         for(uint8_t i = free_bit_slot_cache_index - 1; i > 0; i--) {
             uint8_t j = (uint8_t) (rand_uint64() % (i + 1));
-            bit_slot_t t = zone->free_bit_slot_cache[j];
-            zone->free_bit_slot_cache[j] = zone->free_bit_slot_cache[i];
-            zone->free_bit_slot_cache[i] = t;
+            free_slot_t t = cache[j];
+            cache[j] = cache[i];
+            cache[i] = t;
         }
     }
 #endif
@@ -269,7 +328,12 @@ INTERNAL_HIDDEN INLINE void fill_free_bit_slot_cache(iso_alloc_zone_t *zone) {
     zone->free_bit_slot_cache_index = free_bit_slot_cache_index;
 }
 
-INTERNAL_HIDDEN INLINE void insert_free_bit_slot(iso_alloc_zone_t *zone, int64_t bit_slot) {
+/* Requires the bitmap pointer of the zone is unmasked
+ * by the caller and passed in as bm */
+INTERNAL_HIDDEN INLINE void insert_free_bit_slot(iso_alloc_zone_t *zone, bitmap_index_t *bm, int64_t bit_slot) {
+    free_slot_t *cache = GET_FREE_SLOT_CACHE_PTR(zone, bm);
+    const free_slot_t chunk = bit_slot >> BITS_PER_CHUNK_SHIFT;
+
 #if VERIFY_BIT_SLOT_CACHE
     /* The cache is sorted at creation time but once we start
      * free'ing chunks we add bit_slots to it in an unpredictable
@@ -285,7 +349,7 @@ INTERNAL_HIDDEN INLINE void insert_free_bit_slot(iso_alloc_zone_t *zone, int64_t
     const int32_t max_cache_slots = (BIT_SLOT_CACHE_SZ >> 3);
 
     for(int32_t i = zone->free_bit_slot_cache_usable; i < max_cache_slots; i++) {
-        if(zone->free_bit_slot_cache[i] == bit_slot) {
+        if(cache[i] == chunk) {
             LOG_AND_ABORT("Zone[%d] already contains bit slot %lu in cache", zone->index, bit_slot);
         }
     }
@@ -295,7 +359,7 @@ INTERNAL_HIDDEN INLINE void insert_free_bit_slot(iso_alloc_zone_t *zone, int64_t
         return;
     }
 
-    zone->free_bit_slot_cache[zone->free_bit_slot_cache_index] = bit_slot;
+    cache[zone->free_bit_slot_cache_index] = chunk;
     zone->free_bit_slot_cache_index++;
 }
 
@@ -305,8 +369,16 @@ INTERNAL_HIDDEN bit_slot_t get_next_free_bit_slot(iso_alloc_zone_t *zone) {
         return BAD_BIT_SLOT;
     }
 
-    zone->next_free_bit_slot = zone->free_bit_slot_cache[zone->free_bit_slot_cache_usable];
-    zone->free_bit_slot_cache[zone->free_bit_slot_cache_usable++] = BAD_BIT_SLOT;
+    free_slot_t *cache = GET_FREE_SLOT_CACHE_PTR(zone, zone->bitmap_start);
+    const free_slot_t chunk = cache[zone->free_bit_slot_cache_usable];
+    cache[zone->free_bit_slot_cache_usable++] = BAD_FREE_SLOT;
+
+    if(chunk == BAD_FREE_SLOT) {
+        zone->next_free_bit_slot = BAD_BIT_SLOT;
+    } else {
+        zone->next_free_bit_slot = (bit_slot_t) chunk << BITS_PER_CHUNK_SHIFT;
+    }
+
     return zone->next_free_bit_slot;
 }
 
@@ -328,6 +400,7 @@ INTERNAL_HIDDEN iso_alloc_root *iso_alloc_new_root(void) {
 
     r = (iso_alloc_root *) (p + g_page_size);
     r->system_page_size = g_page_size;
+    r->bitmap_kernel = bitmap_kernel_select();
     r->guard_below = p;
     create_guard_page(r->guard_below);
 
@@ -356,13 +429,14 @@ INTERNAL_HIDDEN void iso_alloc_initialize_global_root(void) {
     _root->zones_size += (g_page_size * 2);
     _root->zones_size = ROUND_UP_PAGE(_root->zones_size);
 
-    /* Allocate memory with guard pages to hold zone data */
-    void *p = mmap_rw_pages(_root->zones_size, false, NULL);
-    create_guard_page(p);
-    create_guard_page((void *) (uintptr_t) (p + _root->zones_size) - g_page_size);
-
+    /* Reserve room for MAX_ZONES zones. The reservation is
+     * PROT_NONE so the guard pages at either end come for
+     * free, and pages are committed as zones are created.
+     * The table never moves so zone pointers stay valid */
+    void *p = mmap_pages(_root->zones_size, false, NULL, PROT_NONE);
     _root->zones = (void *) (p + g_page_size);
     name_mapping(p, _root->zones_size, "isoalloc zone metadata");
+    zone_table_grow();
 
 #if !THREAD_SUPPORT
     size_t c = ROUND_UP_PAGE(CHUNK_QUARANTINE_SZ * sizeof(uintptr_t));
@@ -380,19 +454,61 @@ INTERNAL_HIDDEN void iso_alloc_initialize_global_root(void) {
     MLOCK(zone_cache, z);
 #endif
 
-    /* If we don't lock the these lookup tables we may incur
-     * a soft page fault with almost every alloc/free */
-    zone_lookup_table = mmap_rw_pages(ZONE_LOOKUP_TABLE_SZ, true, NULL);
-    MLOCK(&zone_lookup_table, ZONE_LOOKUP_TABLE_SZ);
+    /* The lookup table is indexed by chunk size so only
+     * a few of its pages are ever touched. They are left
+     * to be faulted in when the first zone of a size is
+     * created rather than populated at startup */
+    zone_lookup_table = mmap_rw_pages(ZONE_LOOKUP_TABLE_SZ, false, NULL);
 
-    chunk_lookup_table = mmap_rw_pages(CHUNK_TO_ZONE_TABLE_SZ, true, NULL);
-    MLOCK(&chunk_lookup_table, CHUNK_TO_ZONE_TABLE_SZ);
+#if CONTIGUOUS_ZONES
+    /* Reserve one extra slot so the first slot can be
+     * aligned to ZONE_SLOT_SZ and then trim the excess */
+    void *r = mmap_pages(ZONE_SLOTS_SZ + ZONE_SLOT_SZ, false, NULL, PROT_NONE);
+    zone_slots = (void *) (((uintptr_t) r + (ZONE_SLOT_SZ - 1)) & ~((uintptr_t) ZONE_SLOT_SZ - 1));
 
+    if(zone_slots != r) {
+        munmap(r, zone_slots - r);
+    }
+
+    munmap(zone_slots + ZONE_SLOTS_SZ, (r + ZONE_SLOT_SZ) - zone_slots);
+
+    /* Only the pages covering claimed slots are touched */
+    zone_slot_map = mmap_rw_pages(MAX_ZONES * sizeof(zone_map_entry_t), false, NULL);
+    zone_slots_used = mmap_rw_pages(MAX_ZONES / BITS_PER_QWORD * sizeof(uint64_t), false, NULL);
+#else
+    /* Nodes and leaves of the zone map are mapped as
+     * zones are created, only the root is allocated here */
+#if LAZY_ZONES
+    zone_map = mmap_rw_pages(ZONE_MAP_ROOT_SZ, false, NULL);
+#else
+    zone_map = mmap_rw_pages(ZONE_MAP_ROOT_SZ, true, NULL);
+    MLOCK(zone_map, ZONE_MAP_ROOT_SZ);
+#endif
+#endif
+
+#if THREAD_ZONES
+    if(pthread_key_create(&thread_zone_key, _release_thread_zones) != 0) {
+        LOG_AND_ABORT("Could not create the thread zone key");
+    }
+#endif
+
+#if LAZY_ZONES
+    /* Default zones are created by iso_new_default_zone()
+     * the first time an allocation needs one */
+    if(DEFAULT_ZONE_COUNT > BITS_PER_QWORD) {
+        LOG_AND_ABORT("LAZY_ZONES supports at most %d default zones", BITS_PER_QWORD);
+    }
+
+    for(int64_t i = 0; i < DEFAULT_ZONE_COUNT; i++) {
+        _root->default_zones_pending |= (1ULL << i);
+    }
+#else
     for(int64_t i = 0; i < DEFAULT_ZONE_COUNT; i++) {
         if((_iso_new_zone(default_zones[i], true)) == NULL) {
             LOG_AND_ABORT("Failed to create a new zone");
         }
     }
+#endif
 
     _root->zone_handle_mask = rand_uint64();
     _root->big_zone_next_mask = rand_uint64();
@@ -425,18 +541,157 @@ __attribute__((constructor(FIRST_CTOR))) void iso_alloc_ctor(void) {
 #if ALLOC_SANITY
     _sanity_canary = rand_uint64();
 #endif
+
+#if BACKGROUND_THREAD
+    pthread_atfork(background_fork_prepare, background_fork_parent, background_fork_child);
+    background_thread_start();
+#endif
 }
 
 INTERNAL_HIDDEN void flush_caches() {
+    flush_thread_caches();
+
+#if PAGE_PURGING
+    purge_all_zones();
+#endif
+}
+
+INTERNAL_HIDDEN void flush_thread_caches() {
     /* The thread zone cache can be invalidated
      * and does not require a lock */
     clear_zone_cache();
 
-    LOCK_ROOT();
-    _flush_chunk_quarantine();
-    UNLOCK_ROOT();
+    /* Each quarantined chunk is free'd while holding
+     * only the lock of the zone it belongs to */
+    _iso_free_chunks((void **) chunk_quarantine, chunk_quarantine_count);
+    clear_chunk_quarantine();
+}
+
+/* Gives memory back to the kernel until at least target
+ * bytes have been released, or everything that can be if
+ * target is 0. Free pages in zones are purged first, then
+ * empty zones beyond ZONE_TRIM_KEEP of each size class are
+ * released and last the free big zones are unmapped, least
+ * recently free'd first. Returns the bytes released */
+INTERNAL_HIDDEN size_t _iso_alloc_trim(size_t target) {
+    size_t released = 0;
+
+    flush_thread_caches();
+
+#if PAGE_PURGING
+    released += purge_all_zones();
+#endif
+
+    if(target == 0 || released < target) {
+        LOCK_ROOT();
+        released += release_empty_zones((target == 0) ? 0 : target - released);
+        UNLOCK_ROOT();
+    }
+
+    if(target == 0 || released < target) {
+        LOCK_BIG_ZONE();
+        const uint64_t free_bytes = _root->big_zone_free_bytes;
+        const uint64_t wanted = (target == 0) ? free_bytes : target - released;
+        big_zone_trim((wanted >= free_bytes) ? 0 : free_bytes - wanted);
+        released += free_bytes - _root->big_zone_free_bytes;
+        UNLOCK_BIG_ZONE();
+    }
+
+    return released;
+}
+
+/* Requires the root is locked. Walks the zones of each
+ * small size class and releases the empty ones after the
+ * first ZONE_TRIM_KEEP. Stops once target bytes have been
+ * released unless target is 0 */
+INTERNAL_HIDDEN size_t release_empty_zones(size_t target) {
+    size_t released = 0;
+
+    for(uint32_t i = 0; i < _root->zones_used; i++) {
+        iso_alloc_zone_t *head = &_root->zones[i];
+
+        /* Start from the first zone of each size class */
+        if(head->internal == false || head->chunk_size > SMALL_SZ_MAX || zone_lookup_table[head->chunk_size] != i) {
+            continue;
+        }
+
+        int32_t kept = 0;
+
+        for(uint32_t j = i; j < _root->zones_used;) {
+            iso_alloc_zone_t *zone = &_root->zones[j];
+            LOCK_ZONE(zone);
+
+            bool empty = (zone->af_count == 0 && zone->released == false);
+#if THREAD_ZONES
+            empty &= (zone->owner == 0 && zone->remote_free_count == 0);
+#endif
+
+            if(zone->released == false && kept < ZONE_TRIM_KEEP) {
+                kept++;
+            } else if(empty == true) {
+                released += release_zone(zone);
+            }
+
+            j = zone->next_sz_index;
+            UNLOCK_ZONE(zone);
+
+            if(j == 0 || (target != 0 && released >= target)) {
+                break;
+            }
+        }
+
+        if(target != 0 && released >= target) {
+            break;
+        }
+    }
+
+    return released;
+}
+
+/* Requires the zone is locked. Gives back all the pages
+ * of an empty zone but keeps its mappings so it can be
+ * used again without a syscall. Its canary chunks can't
+ * survive that, they are created again when the zone is
+ * next used. Returns the bytes released */
+INTERNAL_HIDDEN size_t release_zone(iso_alloc_zone_t *zone) {
+    UNMASK_ZONE_PTRS(zone);
+
+    size_t released = ZONE_USER_SZ(zone) + GET_BITMAP_MAPPING_SIZE(zone);
+
+    /* Purged pages and pages that were never used
+     * are not resident */
+    released -= (size_t) zone->purged_pages * _root->system_page_size;
+    zone->purged_pages = 0;
+#if PAGE_PURGING
+    zone->purge_freed = 0;
+#endif
+
+    madvise(zone->user_pages_start, ZONE_USER_SZ(zone), MADV_DONTNEED);
+    madvise(zone->bitmap_start, GET_BITMAP_MAPPING_SIZE(zone), MADV_DONTNEED);
+
+    /* The bitmap, summary and purge map now read as 0
+     * but an empty free bit slot cache is all 1's */
+    memset(GET_FREE_SLOT_CACHE_PTR(zone, zone->bitmap_start), 0xff, GET_FREE_SLOT_CACHE_SIZE);
+    zone->free_bit_slot_cache_index = 0;
+    zone->free_bit_slot_cache_usable = 0;
+    zone->next_free_bit_slot = BAD_BIT_SLOT;
+    zone->is_full = false;
+    zone->released = true;
+
+    MASK_ZONE_PTRS(zone);
+
+    return released;
+}
+
+/* Requires the zone is locked and its pointers are
+ * unmasked. Prepares a released zone for use again */
+INTERNAL_HIDDEN void restore_released_zone(iso_alloc_zone_t *zone) {
+    create_canary_chunks(zone);
+    init_zone_summary(zone);
+    zone->released = false;
 }
 
+/* Requires the root is locked */
 INTERNAL_HIDDEN INLINE void _flush_chunk_quarantine() {
     /* Free all the thread quarantined chunks */
     for(int64_t i = 0; i < chunk_quarantine_count; i++) {
@@ -446,38 +701,89 @@ INTERNAL_HIDDEN INLINE void _flush_chunk_quarantine() {
     clear_chunk_quarantine();
 }
 
+#if CONTIGUOUS_ZONES
+/* Requires the root is locked. Returns a random unused
+ * slot from the zone reservation and marks it used */
+INTERNAL_HIDDEN void *zone_slot_claim(void) {
+    const size_t start = rand_uint64() & (MAX_ZONES - 1);
+
+    for(size_t i = 0; i < MAX_ZONES; i++) {
+        const size_t slot = (start + i) & (MAX_ZONES - 1);
+        const uint64_t bit = 1ULL << (slot & (BITS_PER_QWORD - 1));
+
+        if((zone_slots_used[slot / BITS_PER_QWORD] & bit) == 0) {
+            zone_slots_used[slot / BITS_PER_QWORD] |= bit;
+            return zone_slots + (slot << ZONE_SLOT_SHIFT);
+        }
+    }
+
+    LOG_AND_ABORT("No free slots left in the zone reservation");
+    return NULL;
+}
+
+/* Requires the root is locked. Releases the pages of the
+ * slot holding p and returns it to the pool. Mapping the
+ * slot PROT_NONE again restores all of its guard pages */
+INTERNAL_HIDDEN void zone_slot_release(void *p) {
+    const size_t slot = ((uintptr_t) p - (uintptr_t) zone_slots) >> ZONE_SLOT_SHIFT;
+    void *slot_start = zone_slots + (slot << ZONE_SLOT_SHIFT);
+
+    if(mmap(slot_start, ZONE_SLOT_SZ, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0) == MAP_FAILED) {
+        LOG_AND_ABORT("Failed to release zone slot at 0x%p", slot_start);
+    }
+
+    zone_slots_used[slot / BITS_PER_QWORD] &= ~(1ULL << (slot & (BITS_PER_QWORD - 1)));
+}
+#endif
+
 INTERNAL_HIDDEN void _unmap_zone(iso_alloc_zone_t *zone) {
-    chunk_lookup_table[ADDR_TO_CHUNK_TABLE(zone->user_pages_start)] = 0;
+    zone_map_set(zone->user_pages_start, ZONE_USER_SZ(zone), NULL);
+    zone_map_set(zone->bitmap_start, zone->bitmap_size, NULL);
+
+#if CONTIGUOUS_ZONES
+    zone_slot_release(zone->user_pages_start);
+#else
 
-    munmap(zone->bitmap_start, zone->bitmap_size);
-    madvise(zone->bitmap_start, zone->bitmap_size, MADV_DONTNEED);
+    munmap(zone->bitmap_start, GET_BITMAP_MAPPING_SIZE(zone));
+    madvise(zone->bitmap_start, GET_BITMAP_MAPPING_SIZE(zone), MADV_DONTNEED);
     munmap(zone->bitmap_start - _root->system_page_size, _root->system_page_size);
     madvise(zone->bitmap_start - _root->system_page_size, _root->system_page_size, MADV_DONTNEED);
-    munmap(zone->bitmap_start + zone->bitmap_size, _root->system_page_size);
-    madvise(zone->bitmap_start + zone->bitmap_size, _root->system_page_size, MADV_DONTNEED);
+    munmap(zone->bitmap_start + GET_BITMAP_MAPPING_SIZE(zone), _root->system_page_size);
+    madvise(zone->bitmap_start + GET_BITMAP_MAPPING_SIZE(zone), _root->system_page_size, MADV_DONTNEED);
 
-    munmap(zone->user_pages_start, ZONE_USER_SIZE);
-    madvise(zone->user_pages_start, ZONE_USER_SIZE, MADV_DONTNEED);
+    munmap(zone->user_pages_start, ZONE_USER_SZ(zone));
+    madvise(zone->user_pages_start, ZONE_USER_SZ(zone), MADV_DONTNEED);
     munmap(zone->user_pages_start - _root->system_page_size, _root->system_page_size);
     madvise(zone->user_pages_start - _root->system_page_size, _root->system_page_size, MADV_DONTNEED);
-    munmap(zone->user_pages_start + ZONE_USER_SIZE, _root->system_page_size);
-    madvise(zone->user_pages_start + ZONE_USER_SIZE, _root->system_page_size, MADV_DONTNEED);
+    munmap(zone->user_pages_start + ZONE_USER_SZ(zone), _root->system_page_size);
+    madvise(zone->user_pages_start + ZONE_USER_SZ(zone), _root->system_page_size, MADV_DONTNEED);
+#endif
 }
 
 INTERNAL_HIDDEN void _iso_alloc_destroy_zone(iso_alloc_zone_t *zone) {
     LOCK_ROOT();
-    _iso_alloc_destroy_zone_unlocked(zone, true, false);
+
+    /* We don't need a lock to clear the zone cache
+     * but we do it here because we don't want another
+     * thread to stick the zone we are about to delete
+     * into the cache for later. The quarantine must be
+     * flushed before we take the zone lock because it
+     * may hold chunks that belong to this zone */
+    clear_zone_cache();
+    _flush_chunk_quarantine();
+
+    LOCK_ZONE(zone);
+    _iso_alloc_destroy_zone_unlocked(zone, false);
+    UNLOCK_ZONE(zone);
     UNLOCK_ROOT();
 }
 
-INTERNAL_HIDDEN void _iso_alloc_destroy_zone_unlocked(iso_alloc_zone_t *zone, bool flush_caches, bool replace) {
-    if(flush_caches == true) {
-        /* We don't need a lock to clear the zone cache
-         * but we do it here because we don't want another
-         * thread to stick the zone we are about to delete
-         * into the cache for later */
-        clear_zone_cache();
-        _flush_chunk_quarantine();
+/* Requires the root and the zone are locked */
+INTERNAL_HIDDEN void _iso_alloc_destroy_zone_unlocked(iso_alloc_zone_t *zone, bool replace) {
+    /* Retired zones are replaced by starting them over */
+    if(zone->internal == true && replace == true) {
+        recycle_zone(zone);
+        return;
     }
 
     UNMASK_ZONE_PTRS(zone);
@@ -487,7 +793,7 @@ INTERNAL_HIDDEN void _iso_alloc_destroy_zone_unlocked(iso_alloc_zone_t *zone, bo
         /* This zone can be used again, we just need to wipe
          * any sensitive data from it and prime it for use */
         memset(zone->bitmap_start, 0x0, zone->bitmap_size);
-        memset(zone->user_pages_start, 0x0, ZONE_USER_SIZE);
+        memset(zone->user_pages_start, 0x0, ZONE_USER_SZ(zone));
 
 #if MEMORY_TAGGING
         /* Clear the memory tags */
@@ -501,11 +807,14 @@ INTERNAL_HIDDEN void _iso_alloc_destroy_zone_unlocked(iso_alloc_zone_t *zone, bo
 #if NEVER_REUSE_ZONES || FUZZ_MODE
         /* This will waste memory because we will never
          * unmap these pages, even in the destructor */
-        mprotect_pages(zone->bitmap_start, zone->bitmap_size, PROT_NONE);
-        mprotect_pages(zone->user_pages_start, ZONE_USER_SIZE, PROT_NONE);
-
-        /* Make this zone unusable */
-        memset(zone, 0x0, sizeof(iso_alloc_zone_t));
+        mprotect_pages(zone->bitmap_start, GET_BITMAP_MAPPING_SIZE(zone), PROT_NONE);
+        mprotect_pages(zone->user_pages_start, ZONE_USER_SZ(zone), PROT_NONE);
+        zone_map_set(zone->user_pages_start, ZONE_USER_SZ(zone), NULL);
+        zone_map_set(zone->bitmap_start, zone->bitmap_size, NULL);
+
+        /* Make this zone unusable. The lock is held
+         * by our caller so it must not be wiped */
+        memset(zone, 0x0, ZONE_RESET_SZ);
         zone->is_full = true;
 #else
         zone->internal = true;
@@ -515,6 +824,7 @@ INTERNAL_HIDDEN void _iso_alloc_destroy_zone_unlocked(iso_alloc_zone_t *zone, bo
          * zone-use-after-free patterns. So we bootstrap the zone
          * from scratch here */
         create_canary_chunks(zone);
+        init_zone_summary(zone);
 
         fill_free_bit_slot_cache(zone);
 
@@ -527,30 +837,82 @@ INTERNAL_HIDDEN void _iso_alloc_destroy_zone_unlocked(iso_alloc_zone_t *zone, bo
          * back to the OS. It will still be available if we
          * try to use it */
         madvise(zone->bitmap_start, zone->bitmap_size, MADV_DONTNEED);
-        madvise(zone->user_pages_start, ZONE_USER_SIZE, MADV_DONTNEED);
+        madvise(zone->user_pages_start, ZONE_USER_SZ(zone), MADV_DONTNEED);
         POISON_ZONE(zone);
     } else {
-        if(replace == true) {
-            /* The only time we ever destroy a default non-private zone
-             * is from the destructor so its safe unmap pages */
-            int16_t zones_used = _root->zones_used;
-            size_t size = zone->chunk_size;
-
-            /* _iso_new_zone() will use _root->zones_used to place
-             * the new zone at the correct index in _root->zones.
-             * We will restore this value after the new zone has
-             * been created */
-            _root->zones_used = zone->index;
-            _unmap_zone(zone);
-            _iso_new_zone(size, true);
-            _root->zones_used = zones_used;
-        } else {
-            _unmap_zone(zone);
-        }
+        /* The only time we ever destroy a default non-private zone
+         * is from the destructor so its safe unmap pages */
+        _unmap_zone(zone);
     }
 }
 
+/* Requires the zone is locked. Retires a zone by starting
+ * it over in the mappings it already has. Its pages are
+ * given back, the bitmap reads as 0 again and it gets new
+ * secrets and canaries. It keeps its index, its place in
+ * the list of zones of its size, its zone map entries and
+ * with THREAD_ZONES its owner, so the root lock isn't needed */
+INTERNAL_HIDDEN void recycle_zone(iso_alloc_zone_t *zone) {
+    UNMASK_ZONE_PTRS(zone);
+    UNPOISON_ZONE(zone);
+
+    void *user_pages_start = zone->user_pages_start;
+    void *bitmap_start = zone->bitmap_start;
+    const uint32_t chunk_size = zone->chunk_size;
+    const uint32_t chunk_size_magic = zone->chunk_size_magic;
+    const uint8_t chunk_size_shift = zone->chunk_size_shift;
+    const uint32_t bitmap_size = zone->bitmap_size;
+    const uint32_t next_sz_index = zone->next_sz_index;
+    const uint32_t index = zone->index;
+#if THREAD_ZONES
+    const uint64_t owner = zone->owner;
+#endif
+
+    memset(zone, 0x0, ZONE_RESET_SZ);
+
+    zone->user_pages_start = user_pages_start;
+    zone->bitmap_start = bitmap_start;
+    zone->chunk_size = chunk_size;
+    zone->chunk_size_magic = chunk_size_magic;
+    zone->chunk_size_shift = chunk_size_shift;
+    zone->bitmap_size = bitmap_size;
+    zone->next_sz_index = next_sz_index;
+    zone->index = index;
+    zone->internal = true;
+
+    /* This wipes the bitmap, summary and purge map too */
+    madvise(zone->user_pages_start, ZONE_USER_SZ(zone), MADV_DONTNEED);
+    madvise(zone->bitmap_start, GET_BITMAP_MAPPING_SIZE(zone), MADV_DONTNEED);
+
+    zone->canary_secret = rand_uint64();
+    zone->pointer_mask = rand_uint64();
+
+    create_canary_chunks(zone);
+    init_zone_summary(zone);
+    fill_free_bit_slot_cache(zone);
+    get_next_free_bit_slot(zone);
+
+#if CPU_PIN
+    zone->cpu_core = sched_getcpu();
+#endif
+
+    POISON_ZONE(zone);
+    MASK_ZONE_PTRS(zone);
+
+#if THREAD_ZONES
+    /* Other threads check the range of a chunk against
+     * these copies before queuing it in an owned zone */
+    zone->remote_pages_start = zone->user_pages_start;
+    zone->remote_bitmap_start = zone->bitmap_start;
+    __atomic_store_n(&zone->owner, owner, __ATOMIC_RELEASE);
+#endif
+}
+
 __attribute__((destructor(LAST_DTOR))) void iso_alloc_dtor(void) {
+#if BACKGROUND_THREAD
+    background_thread_stop();
+#endif
+
     LOCK_ROOT();
 
     _flush_chunk_quarantine();
@@ -568,7 +930,9 @@ __attribute__((destructor(LAST_DTOR))) void iso_alloc_dtor(void) {
 
     for(uint32_t i = 0; i < _root->zones_used; i++) {
         iso_alloc_zone_t *zone = &_root->zones[i];
+        LOCK_ZONE(zone);
         _iso_alloc_zone_leak_detector(zone, false);
+        UNLOCK_ZONE(zone);
     }
 
     mb = __iso_alloc_mem_usage();
@@ -582,10 +946,12 @@ __attribute__((destructor(LAST_DTOR))) void iso_alloc_dtor(void) {
 
     for(uint32_t i = 0; i < _root->zones_used; i++) {
         iso_alloc_zone_t *zone = &_root->zones[i];
+        LOCK_ZONE(zone);
         _verify_zone(zone);
 #if ISO_DTOR_CLEANUP
-        _iso_alloc_destroy_zone_unlocked(zone, false, false);
+        _iso_alloc_destroy_zone_unlocked(zone, false);
 #endif
+        UNLOCK_ZONE(zone);
     }
 
 #if ISO_DTOR_CLEANUP
@@ -610,22 +976,42 @@ __attribute__((destructor(LAST_DTOR))) void iso_alloc_dtor(void) {
         }
 
 #if ISO_DTOR_CLEANUP
-        /* Free the user pages first */
-        void *up = big_zone->user_pages_start - _root->system_page_size;
-        munmap(up, (_root->system_page_size << 1) + big_zone->size);
-
-        /* Free the meta data */
-        munmap(big_zone - _root->system_page_size, (_root->system_page_size * BIG_ZONE_META_DATA_PAGE_COUNT));
+        big_zone_unmap(big_zone);
 #endif
         big_zone = big;
     }
 
 #if ISO_DTOR_CLEANUP
+    if(_root->big_zone_index != NULL) {
+        munmap(_root->big_zone_index, sizeof(big_zone_index_entry_t) << _root->big_zone_index_shift);
+    }
+
     munmap(_root->guard_below, _root->system_page_size);
     munmap(_root->guard_above, _root->system_page_size);
     munmap(_root, sizeof(iso_alloc_root));
     munmap(zone_lookup_table, ZONE_LOOKUP_TABLE_SZ);
-    munmap(chunk_lookup_table, CHUNK_TO_ZONE_TABLE_SZ);
+
+#if CONTIGUOUS_ZONES
+    munmap(zone_slots, ZONE_SLOTS_SZ);
+    munmap(zone_slot_map, MAX_ZONES * sizeof(zone_map_entry_t));
+    munmap(zone_slots_used, MAX_ZONES / BITS_PER_QWORD * sizeof(uint64_t));
+#else
+    for(int64_t i = 0; i < (1 << ZONE_MAP_ROOT_BITS); i++) {
+        if(zone_map[i] == NULL) {
+            continue;
+        }
+
+        for(int64_t j = 0; j < (1 << ZONE_MAP_NODE_BITS); j++) {
+            if(zone_map[i][j] != NULL) {
+                munmap(zone_map[i][j], ZONE_MAP_LEAF_SZ);
+            }
+        }
+
+        munmap(zone_map[i], ZONE_MAP_NODE_SZ);
+    }
+
+    munmap(zone_map, ZONE_MAP_ROOT_SZ);
+#endif
 
 #if !THREAD_SUPPORT
     munmap(chunk_quarantine - (g_page_size / sizeof(uintptr_t)), ROUND_UP_PAGE(CHUNK_QUARANTINE_SZ * sizeof(uintptr_t)) + (g_page_size * 2));
@@ -637,7 +1023,7 @@ __attribute__((destructor(LAST_DTOR))) void iso_alloc_dtor(void) {
 }
 
 INTERNAL_HIDDEN iso_alloc_zone_t *iso_new_zone(size_t size, bool internal) {
-    if(size > SMALL_SZ_MAX) {
+    if(size > ZONE_SZ_MAX) {
         return NULL;
     }
 
@@ -653,34 +1039,37 @@ INTERNAL_HIDDEN iso_alloc_zone_t *_iso_new_zone(size_t size, bool internal) {
         LOG_AND_ABORT("Cannot allocate additional zones. I have already allocated %d", _root->zones_used);
     }
 
-    /* In order for our bitmap to be a power of 2
-     * the size we allocate also needs to be. We
-     * want our bitmap to be a power of 2 because
-     * if its not then we either waste memory
-     * or have to perform inefficient searches
-     * whenever we need more bitslots */
-    if((is_pow2(size)) != true) {
-        size = next_pow2(size);
+    if(((_root->zones_used + 1) * sizeof(iso_alloc_zone_t)) > _root->zones_committed) {
+        zone_table_grow();
     }
 
-    if(size > SMALL_SZ_MAX) {
+    /* Round up to a size class. Classes are not always
+     * a power of 2 so GET_CHUNK_COUNT rounds the chunk
+     * count down to keep the bitmap a whole number of
+     * qwords. This also applies the minimum chunk size */
+    size = size_class(size);
+
+    if(size > ZONE_SZ_MAX) {
         LOG("Request for new zone with %ld byte chunks should be handled by big alloc path", size);
         return NULL;
     }
 
-    /* Minimum chunk size */
-    if(size < SMALLEST_CHUNK_SZ) {
-        size = SMALLEST_CHUNK_SZ;
-    }
-
-    iso_alloc_zone_t *new_zone = &_root->zones[_root->zones_used];
-
-    memset(new_zone, 0x0, sizeof(iso_alloc_zone_t));
+    const uint32_t index = _root->zones_used;
+    iso_alloc_zone_t *new_zone = &_root->zones[index];
+    memset(new_zone, 0x0, ZONE_RESET_SZ);
+    INIT_ZONE_LOCK(new_zone);
 
     new_zone->internal = internal;
     new_zone->is_full = false;
     new_zone->chunk_size = size;
 
+    /* Precompute the reciprocal of the chunk size. With a
+     * shift of CHUNK_DIV_BITS + ceil(log2(size)) the magic
+     * number fits in 32 bits and is exact for every chunk
+     * offset in the zone */
+    new_zone->chunk_size_shift = CHUNK_DIV_BITS + (64 - __builtin_clzll(size - 1));
+    new_zone->chunk_size_magic = ((1ULL << new_zone->chunk_size_shift) + size - 1) / size;
+
     size_t chunk_count = GET_CHUNK_COUNT(new_zone);
 
     /* If a caller requests an allocation that is >=(ZONE_USER_SIZE/2)
@@ -690,18 +1079,28 @@ INTERNAL_HIDDEN iso_alloc_zone_t *_iso_new_zone(size_t size, bool internal) {
 
     /* All of the following fields are immutable
      * and should not change once they are set */
-    void *p = mmap_rw_pages(new_zone->bitmap_size + (_root->system_page_size << 1), true, ZONE_BITMAP_NAME);
+#if CONTIGUOUS_ZONES
+    /* The slot is already PROT_NONE so the guard pages
+     * around the bitmap and user pages come for free */
+    void *slot = zone_slot_claim();
+    void *p = slot;
+    mprotect_pages(p + _root->system_page_size, GET_BITMAP_MAPPING_SIZE(new_zone), PROT_READ | PROT_WRITE);
+    new_zone->bitmap_start = (p + _root->system_page_size);
+    name_mapping(new_zone->bitmap_start, GET_BITMAP_MAPPING_SIZE(new_zone), ZONE_BITMAP_NAME);
+#else
+    void *p = mmap_rw_pages(GET_BITMAP_MAPPING_SIZE(new_zone) + (_root->system_page_size << 1), true, ZONE_BITMAP_NAME);
 
     void *bitmap_pages_guard_below = p;
     new_zone->bitmap_start = (p + _root->system_page_size);
 
-    void *bitmap_pages_guard_above = (void *) ROUND_UP_PAGE((uintptr_t) p + (new_zone->bitmap_size + _root->system_page_size));
+    void *bitmap_pages_guard_above = (void *) ROUND_UP_PAGE((uintptr_t) p + (GET_BITMAP_MAPPING_SIZE(new_zone) + _root->system_page_size));
 
     create_guard_page(bitmap_pages_guard_below);
     create_guard_page(bitmap_pages_guard_above);
+#endif
 
     /* Bitmap pages are accessed often and usually in sequential order */
-    madvise(new_zone->bitmap_start, new_zone->bitmap_size, MADV_WILLNEED);
+    madvise(new_zone->bitmap_start, GET_BITMAP_MAPPING_SIZE(new_zone), MADV_WILLNEED);
 
     char *name = NULL;
 
@@ -713,7 +1112,7 @@ INTERNAL_HIDDEN iso_alloc_zone_t *_iso_new_zone(size_t size, bool internal) {
     }
 #endif
 
-    size_t total_size = ZONE_USER_SIZE + (_root->system_page_size << 1);
+    size_t total_size = ZONE_USER_SZ(new_zone) + (_root->system_page_size << 1);
 
 #if MEMORY_TAGGING
     /* Each tag is 1 byte in size and the start address
@@ -730,7 +1129,16 @@ INTERNAL_HIDDEN iso_alloc_zone_t *_iso_new_zone(size_t size, bool internal) {
     /* All user pages use MAP_POPULATE. This might seem like we are asking
      * the kernel to commit a lot of memory for us that we may never use
      * but when we call create_canary_chunks() that will happen anyway */
+#if CONTIGUOUS_ZONES
+    /* Place the mapping so the user pages start at
+     * ZONE_SLOT_USER_OFFSET. Only the pages between
+     * the outer guard pages are made accessible */
+    p = slot + ZONE_SLOT_USER_OFFSET - (total_size - ZONE_USER_SIZE - _root->system_page_size);
+    mprotect_pages(p + _root->system_page_size, total_size - (_root->system_page_size << 1), PROT_READ | PROT_WRITE);
+    name_mapping(slot + ZONE_SLOT_USER_OFFSET, ZONE_USER_SIZE, name);
+#else
     p = mmap_rw_pages(total_size, false, name);
+#endif
 
 #if NAMED_MAPPINGS && __ANDROID__
     if(new_zone->tagged == false) {
@@ -738,8 +1146,10 @@ INTERNAL_HIDDEN iso_alloc_zone_t *_iso_new_zone(size_t size, bool internal) {
     }
 #endif
 
+#if !CONTIGUOUS_ZONES
     void *user_pages_guard_below = p;
     create_guard_page(user_pages_guard_below);
+#endif
 
 #if MEMORY_TAGGING
     if(new_zone->tagged == true) {
@@ -759,27 +1169,39 @@ INTERNAL_HIDDEN iso_alloc_zone_t *_iso_new_zone(size_t size, bool internal) {
     new_zone->user_pages_start = (p + _root->system_page_size);
 #endif
 
+#if !CONTIGUOUS_ZONES
     void *user_pages_guard_above;
 
 #if MEMORY_TAGGING
     if(new_zone->tagged == false) {
-        user_pages_guard_above = (void *) ROUND_UP_PAGE((uintptr_t) p + (ZONE_USER_SIZE + _root->system_page_size));
+        user_pages_guard_above = (void *) ROUND_UP_PAGE((uintptr_t) p + (ZONE_USER_SZ(new_zone) + _root->system_page_size));
     } else {
-        user_pages_guard_above = (void *) ROUND_UP_PAGE((uintptr_t) p + tag_mapping_size + (ZONE_USER_SIZE + _root->system_page_size * 2));
+        user_pages_guard_above = (void *) ROUND_UP_PAGE((uintptr_t) p + tag_mapping_size + (ZONE_USER_SZ(new_zone) + _root->system_page_size * 2));
     }
 #else
-    user_pages_guard_above = (void *) ROUND_UP_PAGE((uintptr_t) p + (ZONE_USER_SIZE + _root->system_page_size));
+    user_pages_guard_above = (void *) ROUND_UP_PAGE((uintptr_t) p + (ZONE_USER_SZ(new_zone) + _root->system_page_size));
 #endif
 
     create_guard_page(user_pages_guard_above);
+#endif
 
-    madvise(new_zone->user_pages_start, ZONE_USER_SIZE, MADV_WILLNEED);
+    madvise(new_zone->user_pages_start, ZONE_USER_SZ(new_zone), MADV_WILLNEED);
 
-    new_zone->index = _root->zones_used;
+    new_zone->index = index;
     new_zone->canary_secret = rand_uint64();
     new_zone->pointer_mask = rand_uint64();
 
     create_canary_chunks(new_zone);
+    init_zone_summary(new_zone);
+
+#if CONTIGUOUS_ZONES && __linux__ && HUGE_PAGES && MADV_HUGEPAGE
+    /* A huge page would fault in every page that is
+     * waiting for its canaries. Zones with canaries get
+     * the hint once they are all written */
+    if(new_zone->purged_pages == 0) {
+        madvise(new_zone->user_pages_start, ZONE_USER_SZ(new_zone), MADV_HUGEPAGE);
+    }
+#endif
 
     /* When we create a new zone its an opportunity to
      * populate our free list cache with random entries */
@@ -794,10 +1216,14 @@ INTERNAL_HIDDEN iso_alloc_zone_t *_iso_new_zone(size_t size, bool internal) {
 
     POISON_ZONE(new_zone);
 
-    /* The lookup table is never used for private zones */
-    if(LIKELY(internal == true)) {
-        chunk_lookup_table[ADDR_TO_CHUNK_TABLE(new_zone->user_pages_start)] = new_zone->index;
+    /* Every zone is in the zone map, including private
+     * zones, so a pointer never needs a linear search */
+    zone_map_set(new_zone->user_pages_start, ZONE_USER_SZ(new_zone), new_zone);
+    zone_map_set(new_zone->bitmap_start, new_zone->bitmap_size, new_zone);
 
+    /* The zone lookup table is never used for private
+     * zones and only covers small zones */
+    if(LIKELY(internal == true && size <= SMALL_SZ_MAX)) {
         /* If no other zones of this size exist then set the
          * index in the zone lookup table to its index */
         if(zone_lookup_table[size] == 0) {
@@ -828,53 +1254,69 @@ INTERNAL_HIDDEN iso_alloc_zone_t *_iso_new_zone(size_t size, bool internal) {
 
     MASK_ZONE_PTRS(new_zone);
 
-    _root->zones_used++;
+    /* Threads that free chunks without holding the root
+     * lock read zones_used to validate zone indexes */
+    __atomic_store_n(&_root->zones_used, _root->zones_used + 1, __ATOMIC_RELEASE);
 
     return new_zone;
 }
 
-/* Iterate through a zone bitmap a qword at a time
- * looking for empty holes (i.e. slot == 0) */
-INTERNAL_HIDDEN bit_slot_t iso_scan_zone_free_slot(iso_alloc_zone_t *zone) {
+/* Requires the root is locked. Commits the next
+ * ZONE_TABLE_COMMIT_SZ bytes of the zone table */
+INTERNAL_HIDDEN void zone_table_grow(void) {
+    const size_t max = _root->zones_size - (g_page_size * 2);
+
+    if(_root->zones_committed >= max) {
+        LOG_AND_ABORT("Zone table is already %lu bytes", _root->zones_committed);
+    }
+
+    size_t sz = ZONE_TABLE_COMMIT_SZ;
+
+    if(_root->zones_committed + sz > max) {
+        sz = max - _root->zones_committed;
+    }
+
+    mprotect_pages((void *) _root->zones + _root->zones_committed, sz, PROT_READ | PROT_WRITE);
+    _root->zones_committed += sz;
+}
+
+/* Sets a summary bit for every bitmap qword that has a
+ * free chunk. Requires the zone is locked and its
+ * pointers are unmasked */
+INTERNAL_HIDDEN void init_zone_summary(iso_alloc_zone_t *zone) {
     const bitmap_index_t *bm = (bitmap_index_t *) zone->bitmap_start;
+    bitmap_index_t *summary = GET_SUMMARY_PTR(zone, bm);
     const bitmap_index_t max_bm_idx = GET_MAX_BITMASK_INDEX(zone);
 
-    /* Iterate the entire bitmap a qword at a time */
+    memset(summary, 0x0, GET_SUMMARY_SIZE(zone));
+
     for(bitmap_index_t i = 0; i < max_bm_idx; i++) {
-        /* If the byte is 0 then there are some free
-         * slots we can use at this location */
-        if(bm[i] == 0x0) {
-            return (i << BITS_PER_QWORD_SHIFT);
+        if(GET_FREE_BITSLOTS(bm[i]) != 0) {
+            SET_BIT(summary[i >> BITS_PER_QWORD_SHIFT], (i & (BITS_PER_QWORD - 1)));
         }
     }
-
-    return BAD_BIT_SLOT;
 }
 
-/* This function scans an entire bitmap bit-by-bit
- * and returns the first free bit position. In a heavily
- * used zone this function will be slow to search. We
- * speed it up by looking for a constant ALLOCATED_BITSLOTS
- * that indicates there is at least 1 free bit slot  */
-INTERNAL_HIDDEN bit_slot_t iso_scan_zone_free_slot_slow(iso_alloc_zone_t *zone) {
+/* Finds the first free bit slot in a zone. The summary
+ * bitmap points at the first bitmap qword with a free
+ * chunk so this only walks one qword per 64 qwords of
+ * bitmap, no matter how full the zone is */
+INTERNAL_HIDDEN bit_slot_t iso_scan_zone_free_slot(iso_alloc_zone_t *zone) {
     const bitmap_index_t *bm = (bitmap_index_t *) zone->bitmap_start;
-    const bitmap_index_t max_bm_idx = GET_MAX_BITMASK_INDEX(zone);
+    const bitmap_index_t *summary = GET_SUMMARY_PTR(zone, bm);
+    const bitmap_index_t max_summary_idx = GET_SUMMARY_SIZE(zone) / sizeof(bitmap_index_t);
 
-    for(bitmap_index_t i = 0; i < max_bm_idx; i++) {
-        for(int64_t j = 0; j < BITS_PER_QWORD; j += BITS_PER_CHUNK) {
-            /* We can easily check if every bitslot represented by
-             * this qword is allocated with or without canaries */
-            if(bm[i] < ALLOCATED_BITSLOTS) {
-                if((GET_BIT(bm[i], j)) == 0) {
-                    return ((i << BITS_PER_QWORD_SHIFT) + j);
-                }
-            }
+    for(bitmap_index_t i = 0; i < max_summary_idx; i++) {
+        if(summary[i] != 0) {
+            const bitmap_index_t bm_idx = (i << BITS_PER_QWORD_SHIFT) + __builtin_ctzll(summary[i]);
+            return (bm_idx << BITS_PER_QWORD_SHIFT) + __builtin_ctzll(GET_FREE_BITSLOTS(bm[bm_idx]));
         }
     }
 
     return BAD_BIT_SLOT;
 }
 
+/* Requires the zone is locked */
 INTERNAL_HIDDEN iso_alloc_zone_t *is_zone_usable(iso_alloc_zone_t *zone, size_t size) {
     /* If the zone is full it is not usable */
     if(zone->is_full == true) {
@@ -898,6 +1340,10 @@ INTERNAL_HIDDEN iso_alloc_zone_t *is_zone_usable(iso_alloc_zone_t *zone, size_t
 
     UNMASK_ZONE_PTRS(zone);
 
+    if(UNLIKELY(zone->released == true)) {
+        restore_released_zone(zone);
+    }
+
     /* If the cache for this zone is empty we should
      * refill it to make future allocations faster
      * for all threads */
@@ -912,32 +1358,24 @@ INTERNAL_HIDDEN iso_alloc_zone_t *is_zone_usable(iso_alloc_zone_t *zone, size_t
         return zone;
     }
 
-    /* Free list failed, use a fast search */
+    /* Free list failed, search the summary bitmap */
     bit_slot = iso_scan_zone_free_slot(zone);
+    MASK_ZONE_PTRS(zone);
 
+    /* This zone is entirely full, try the next one
+     * but mark this zone full so future allocations
+     * can take a faster path */
     if(UNLIKELY(bit_slot == BAD_BIT_SLOT)) {
-        /* Fast search failed, search bit by bit */
-        bit_slot = iso_scan_zone_free_slot_slow(zone);
-        MASK_ZONE_PTRS(zone);
-
-        /* This zone may be entirely full, try the next one
-         * but mark this zone full so future allocations can
-         * take a faster path */
-        if(bit_slot == BAD_BIT_SLOT) {
-            zone->is_full = true;
-            return NULL;
-        } else {
-            zone->next_free_bit_slot = bit_slot;
-            return zone;
-        }
-    } else {
-        zone->next_free_bit_slot = bit_slot;
-        MASK_ZONE_PTRS(zone);
-        return zone;
+        zone->is_full = true;
+        return NULL;
     }
+
+    zone->next_free_bit_slot = bit_slot;
+    return zone;
 }
 
-/* Implements the check for iso_find_zone_fit */
+/* Implements the check for iso_find_zone_fit. Requires
+ * the zone is locked */
 INTERNAL_HIDDEN bool iso_does_zone_fit(iso_alloc_zone_t *zone, size_t size) {
 #if CPU_PIN
     if(zone->cpu_core != sched_getcpu()) {
@@ -953,10 +1391,22 @@ INTERNAL_HIDDEN bool iso_does_zone_fit(iso_alloc_zone_t *zone, size_t size) {
         return false;
     }
 
+    /* Small chunks never come from medium zones */
+    if(zone->chunk_size > SMALL_SZ_MAX && size <= SMALL_SZ_MAX) {
+        return false;
+    }
+
     if(zone->chunk_size < size || zone->internal == false || zone->is_full == true) {
         return false;
     }
 
+#if THREAD_ZONES
+    /* Zones owned by a thread are never shared */
+    if(zone->owner != 0) {
+        return false;
+    }
+#endif
+
     /* We found a zone, lets try to find a free slot in it */
     zone = is_zone_usable(zone, size);
 
@@ -967,8 +1417,45 @@ INTERNAL_HIDDEN bool iso_does_zone_fit(iso_alloc_zone_t *zone, size_t size) {
     }
 }
 
-/* Finds a zone that can fit this allocation request */
-INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_fit(size_t size) {
+#if LAZY_ZONES
+/* Requires the root is locked. Creates the first default
+ * zone that fits size if it hasn't been created yet and
+ * returns it unlocked. Returns NULL if that zone already
+ * exists, the regular search will find it if it's usable */
+INTERNAL_HIDDEN iso_alloc_zone_t *iso_new_default_zone(size_t size) {
+    if(_root->default_zones_pending == 0 || size > MAX_DEFAULT_ZONE_SZ) {
+        return NULL;
+    }
+
+    for(int64_t i = 0; i < DEFAULT_ZONE_COUNT; i++) {
+        if(default_zones[i] < size) {
+            continue;
+        }
+
+        if((_root->default_zones_pending & (1ULL << i)) == 0) {
+            return NULL;
+        }
+
+        iso_alloc_zone_t *zone = _iso_new_zone(default_zones[i], true);
+
+        if(UNLIKELY(zone == NULL)) {
+            LOG_AND_ABORT("Failed to create a new zone");
+        }
+
+        _root->default_zones_pending &= ~(1ULL << i);
+        return zone;
+    }
+
+    return NULL;
+}
+#endif
+
+/* Finds a zone that can fit this allocation request and
+ * whose chunk size is a multiple of alignment. Zone user
+ * pages are page aligned so its chunks are too. Requires
+ * the root is locked. Each candidate zone is locked while
+ * we check it and the zone returned is still locked */
+INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_fit(size_t size, size_t alignment) {
     iso_alloc_zone_t *zone = NULL;
     int32_t i = 0;
 
@@ -976,27 +1463,33 @@ INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_fit(size_t size) {
         size = ALIGN_SZ_UP(size);
     }
 
-    /* Fast path via lookup table */
-    if(zone_lookup_table[size] != 0) {
-        i = zone_lookup_table[size];
+    /* Fast path via lookup table. Zones are registered
+     * under their size class */
+    const size_t class = size_class(size);
+
+    if(class <= SMALL_SZ_MAX && zone_lookup_table[class] != 0) {
+        i = zone_lookup_table[class];
 
         for(; i < _root->zones_used;) {
             iso_alloc_zone_t *zone = &_root->zones[i];
 
-            if(zone->chunk_size != size) {
-                LOG_AND_ABORT("Zone lookup table failed to match sizes for zone[%d](%d) for chunk size (%d)", zone->index, zone->chunk_size, size);
+            if(zone->chunk_size != class) {
+                LOG_AND_ABORT("Zone lookup table failed to match sizes for zone[%d](%d) for chunk size (%d)", zone->index, zone->chunk_size, class);
             }
 
             if(zone->internal == false) {
                 LOG_AND_ABORT("Lookup table should never contain private zones");
             }
 
+            LOCK_ZONE(zone);
             bool fits = iso_does_zone_fit(zone, size);
 
             if(fits == true) {
                 return zone;
             }
 
+            UNLOCK_ZONE(zone);
+
             if(zone->next_sz_index != 0) {
                 i = zone->next_sz_index;
             } else {
@@ -1011,7 +1504,18 @@ INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_fit(size_t size) {
         }
     }
 
-#if SMALL_MEM_STARTUP
+#if LAZY_ZONES
+    /* The default zone that would have served this
+     * request at startup may not exist yet */
+    zone = iso_new_default_zone(size);
+
+    if(zone != NULL) {
+        LOCK_ZONE(zone);
+        return zone;
+    }
+#endif
+
+#if SMALL_MEM_STARTUP && !LAZY_ZONES
     /* A simple optimization to find which default zone
      * should fit this allocation. If we fail then a
      * slower iterative approach is used. The longer a
@@ -1029,11 +1533,21 @@ INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_fit(size_t size) {
     for(; i < _root->zones_used; i++) {
         zone = &_root->zones[i];
 
+        /* The chunk size of a zone only changes while the
+         * root is locked so we can skip zones that are too
+         * small without taking their lock */
+        if(zone->chunk_size < size || (zone->chunk_size & (alignment - 1)) != 0) {
+            continue;
+        }
+
+        LOCK_ZONE(zone);
         bool fits = iso_does_zone_fit(zone, size);
 
         if(fits == true) {
             return zone;
         }
+
+        UNLOCK_ZONE(zone);
     }
 
     return NULL;
@@ -1048,13 +1562,46 @@ INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_calloc(size_t nmemb, size_t size) {
         return NULL;
     }
 
-    void *p = _iso_alloc(NULL, sz);
+    /* The allocator only clears the parts of the chunk
+     * that aren't already known to be zero */
+    return _iso_alloc_internal(NULL, sz, ALIGNMENT, true);
+}
 
-    memset(p, 0x0, sz);
-    return p;
+/* Returns a chunk of at least size bytes aligned to
+ * alignment, which must be a power of 2. Chunks in a zone
+ * whose chunk size is a multiple of alignment are always
+ * aligned if alignment is no larger than a page. Anything
+ * else comes from a big zone */
+INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_aligned_alloc(size_t alignment, size_t size) {
+    if(UNLIKELY(is_pow2(alignment) == false)) {
+        return NULL;
+    }
+
+    if(alignment <= ALIGNMENT) {
+        return _iso_alloc(NULL, size);
+    }
+
+    /* A size that is a multiple of alignment has a size
+     * class that is too, including the zones registered
+     * for it in the lookup table and thread zones. A zero
+     * sized request still needs an aligned chunk */
+    const size_t aligned_size = (size == 0) ? alignment : (size + (alignment - 1)) & ~(alignment - 1);
+
+    if(UNLIKELY(aligned_size < size)) {
+        return NULL;
+    }
+
+    return _iso_alloc_internal(NULL, aligned_size, alignment, false);
 }
 
-INTERNAL_HIDDEN void *_iso_big_alloc(size_t size) {
+/* If zero is true the first size bytes of the big zone
+ * returned are zero. Pages that were just mapped, or that
+ * were given back with madvise(MADV_DONTNEED) when the big
+ * zone was free'd, already are. The user pages of a big
+ * zone are always page aligned, alignment is only used
+ * when it's larger than a page */
+INTERNAL_HIDDEN void *_iso_big_alloc(size_t size, size_t alignment, bool zero) {
+    const size_t zero_sz = size;
     const size_t new_size = ROUND_UP_PAGE(size);
 
     if(new_size < size || new_size > BIG_SZ_MAX) {
@@ -1067,105 +1614,260 @@ INTERNAL_HIDDEN void *_iso_big_alloc(size_t size) {
 
     /* Let's first see if theres an existing set of
      * pages that can satisfy this allocation request */
-    iso_alloc_big_zone_t *big = _root->big_zone_head;
+    iso_alloc_big_zone_t *big = big_zone_free_find(size);
 
-    if(big != NULL) {
-        big = UNMASK_BIG_ZONE_NEXT(_root->big_zone_head);
+    if(big != NULL && alignment > _root->system_page_size && ((uintptr_t) big->user_pages_start & (alignment - 1)) != 0) {
+        big = NULL;
     }
 
-    iso_alloc_big_zone_t *last_big = NULL;
-
-    while(big != NULL) {
-        check_big_canary(big);
+    if(big != NULL) {
+        big_zone_free_remove(big);
 
-        if(big->free == true && big->size >= size) {
-            break;
+        /* Give the pages we don't need back to the free bins */
+        if((big->size - size) >= ((_root->system_page_size << 1) + BIG_ZONE_SPLIT_MIN_SZ)) {
+            big_zone_split(big, size);
         }
 
-        last_big = big;
+        big->free = false;
+        UNPOISON_BIG_ZONE(big);
 
-        if(big->next != NULL) {
-            big = UNMASK_BIG_ZONE_NEXT(big->next);
-        } else {
-            big = NULL;
-            break;
+#if BACKGROUND_THREAD
+        /* The background thread hasn't given these pages back yet */
+        const bool dirty = big->dirty;
+#elif __linux__
+        const bool dirty = false;
+#else
+        /* Pages given back with MADV_DONTNEED may keep their contents */
+        const bool dirty = true;
+#endif
+
+        UNLOCK_BIG_ZONE();
+
+        if(zero == true && dirty == true) {
+            memset(big->user_pages_start, 0x0, zero_sz);
         }
+
+        return big->user_pages_start;
     }
 
-    /* We need to setup a new set of pages */
-    if(big == NULL) {
-        /* User data is allocated separately from big zone meta
-         * data to prevent an attacker from targeting it */
-        void *user_pages = mmap_rw_pages((_root->system_page_size << BIG_ZONE_USER_PAGE_COUNT_SHIFT) + size, false, BIG_ZONE_UD_NAME);
+    /* We need to setup a new set of pages. User data is
+     * allocated separately from big zone meta data to
+     * prevent an attacker from targeting it */
+    size_t map_size = (_root->system_page_size << BIG_ZONE_USER_PAGE_COUNT_SHIFT) + size;
 
-        if(user_pages == NULL) {
-            UNLOCK_BIG_ZONE();
+    if(alignment > _root->system_page_size) {
+        map_size += alignment - _root->system_page_size;
+    }
+
+    void *user_pages = mmap_rw_pages(map_size, false, BIG_ZONE_UD_NAME);
+
+    if(user_pages == NULL) {
+        UNLOCK_BIG_ZONE();
 #if ABORT_ON_NULL
-            LOG_AND_ABORT("isoalloc configured to abort on NULL");
+        LOG_AND_ABORT("isoalloc configured to abort on NULL");
 #endif
-            return NULL;
+        return NULL;
+    }
+
+    if(alignment > _root->system_page_size) {
+        /* Unmap the pages on either side of the aligned
+         * user pages and their guard pages */
+        void *aligned = (void *) ((((uintptr_t) user_pages + _root->system_page_size) + (alignment - 1)) & ~(alignment - 1));
+        const size_t head = (aligned - _root->system_page_size) - user_pages;
+        const size_t tail = map_size - head - (_root->system_page_size << BIG_ZONE_USER_PAGE_COUNT_SHIFT) - size;
+
+        if(head != 0) {
+            munmap(user_pages, head);
+        }
+
+        if(tail != 0) {
+            munmap(aligned + size + _root->system_page_size, tail);
         }
 
-        void *p = mmap_rw_pages((_root->system_page_size * BIG_ZONE_META_DATA_PAGE_COUNT), false, BIG_ZONE_MD_NAME);
+        user_pages = aligned - _root->system_page_size;
+    }
 
-        /* The first page before meta data is a guard page */
-        create_guard_page(p);
+    /* The first page is a guard page */
+    create_guard_page(user_pages);
 
-        /* The second page is for meta data and it is placed
-         * at a random offset from the start of the page */
-        big = (iso_alloc_big_zone_t *) (p + _root->system_page_size);
-        madvise(big, _root->system_page_size, MADV_WILLNEED);
-        uint32_t random_offset = ALIGN_SZ_DOWN(rand_uint64());
-        size_t s = _root->system_page_size - (sizeof(iso_alloc_big_zone_t) - 1);
+    /* Tell the kernel we want to access this big zone allocation */
+    user_pages += _root->system_page_size;
+    madvise(user_pages, size, MADV_WILLNEED);
 
-        big = (iso_alloc_big_zone_t *) ((p + _root->system_page_size) + ((random_offset * s) >> 32));
-        big->free = false;
-        big->size = size;
-        big->next = NULL;
+    /* The last page beyond user data is a guard page */
+    void *last_gp = (user_pages + size);
+    create_guard_page(last_gp);
 
-        if(last_big != NULL) {
-            last_big->next = MASK_BIG_ZONE_NEXT(big);
-        }
+    big = big_zone_new(user_pages, size);
 
-        if(_root->big_zone_head == NULL) {
-            _root->big_zone_head = MASK_BIG_ZONE_NEXT(big);
-        }
+    UNLOCK_BIG_ZONE();
+    return big->user_pages_start;
+}
+
+/* Creates the meta data for a big zone whose user pages,
+ * and the guard pages around them, are already mapped.
+ * Requires the big zone lock */
+INTERNAL_HIDDEN iso_alloc_big_zone_t *big_zone_new(void *user_pages, size_t size) {
+    void *p = mmap_rw_pages((_root->system_page_size * BIG_ZONE_META_DATA_PAGE_COUNT), false, BIG_ZONE_MD_NAME);
+
+    /* The first page before meta data is a guard page */
+    create_guard_page(p);
+
+    /* The second page is for meta data and it is placed
+     * at a random offset from the start of the page */
+    iso_alloc_big_zone_t *big = (iso_alloc_big_zone_t *) (p + _root->system_page_size);
+    madvise(big, _root->system_page_size, MADV_WILLNEED);
+    uint32_t random_offset = ALIGN_SZ_DOWN(rand_uint64());
+    size_t s = _root->system_page_size - (sizeof(iso_alloc_big_zone_t) - 1);
+
+    big = (iso_alloc_big_zone_t *) ((p + _root->system_page_size) + ((random_offset * s) >> 32));
+    big->free = false;
+    big->size = size;
+    big->prev = NULL;
+    big->free_next = NULL;
+    big->free_prev = NULL;
+    big->lru_next = NULL;
+    big->lru_prev = NULL;
+#if BACKGROUND_THREAD
+    big->dirty = false;
+#endif
+
+    /* New big zones are pushed onto the head of the list */
+    big->next = _root->big_zone_head;
+
+    if(_root->big_zone_head != NULL) {
+        iso_alloc_big_zone_t *head = UNMASK_BIG_ZONE_NEXT(_root->big_zone_head);
+        check_big_canary(head);
+        head->prev = MASK_BIG_ZONE_NEXT(big);
+    }
+
+    _root->big_zone_head = MASK_BIG_ZONE_NEXT(big);
+
+    /* Create the guard page after the meta data */
+    void *next_gp = (p + (_root->system_page_size << 1));
+    create_guard_page(next_gp);
+
+    /* Save a pointer to the user pages */
+    big->user_pages_start = user_pages;
+
+    /* The canaries prevents a linear overwrite of the big
+     * zone meta data structure from either direction */
+    big->canary_a = ((uint64_t) big ^ __builtin_bswap64((uint64_t) big->user_pages_start) ^ _root->big_zone_canary_secret);
+    big->canary_b = big->canary_a;
+
+    big_zone_index_insert(big);
+
+    return big;
+}
 
-        /* Create the guard page after the meta data */
-        void *next_gp = (p + (_root->system_page_size << 1));
-        create_guard_page(next_gp);
+/* Shrinks a big zone that was just taken from the free
+ * bins to size bytes. Two guard pages are placed after
+ * it, one for each side, so both halves can later be
+ * unmapped on their own. The rest becomes a new free
+ * big zone. Requires the big zone lock */
+INTERNAL_HIDDEN void big_zone_split(iso_alloc_big_zone_t *big, size_t size) {
+    const size_t remainder = big->size - size - (_root->system_page_size << 1);
+    void *guard = big->user_pages_start + size;
+
+    create_guard_page(guard);
+    create_guard_page(guard + _root->system_page_size);
+    big->size = size;
+
+    iso_alloc_big_zone_t *split = big_zone_new(guard + (_root->system_page_size << 1), remainder);
+    split->free = true;
+#if BACKGROUND_THREAD
+    split->dirty = big->dirty;
+#endif
+    big_zone_free_insert(split);
+}
 
-        /* The first page is a guard page */
-        create_guard_page(user_pages);
+#if __linux__
+/* Grows the big zone holding p to size bytes by moving
+ * its pages with mremap() instead of copying them. The
+ * pages are moved into a new PROT_NONE reservation whose
+ * first and last pages become its guard pages. Returns
+ * the new address of p or NULL if p isn't an in use big
+ * zone or the kernel couldn't move it */
+INTERNAL_HIDDEN void *_iso_big_realloc(void *p, size_t size) {
+    const size_t new_size = ROUND_UP_PAGE(size);
 
-        /* Tell the kernel we want to access this big zone allocation */
-        user_pages += _root->system_page_size;
-        madvise(user_pages, size, MADV_WILLNEED);
+    if(size <= ZONE_SZ_MAX || new_size < size || new_size > BIG_SZ_MAX) {
+        return NULL;
+    }
 
-        /* The last page beyond user data is a guard page */
-        void *last_gp = (user_pages + size);
-        create_guard_page(last_gp);
+    LOCK_BIG_ZONE();
+    iso_alloc_big_zone_t *big = big_zone_index_find(p);
 
-        /* Save a pointer to the user pages */
-        big->user_pages_start = user_pages;
+    if(big == NULL || big->free == true || new_size <= big->size) {
+        UNLOCK_BIG_ZONE();
+        return NULL;
+    }
 
-        /* The canaries prevents a linear overwrite of the big
-         * zone meta data structure from either direction */
-        big->canary_a = ((uint64_t) big ^ __builtin_bswap64((uint64_t) big->user_pages_start) ^ _root->big_zone_canary_secret);
-        big->canary_b = big->canary_a;
+    void *r = mmap_pages(new_size + (_root->system_page_size << BIG_ZONE_USER_PAGE_COUNT_SHIFT), false, BIG_ZONE_UD_NAME, PROT_NONE);
+    void *user_pages = r + _root->system_page_size;
 
+    if(mremap(p, big->size, new_size, MREMAP_MAYMOVE | MREMAP_FIXED, user_pages) == MAP_FAILED) {
+        munmap(r, new_size + (_root->system_page_size << BIG_ZONE_USER_PAGE_COUNT_SHIFT));
         UNLOCK_BIG_ZONE();
-        return big->user_pages_start;
-    } else {
+        return NULL;
+    }
+
+    /* The old guard pages are left behind */
+    munmap(p - _root->system_page_size, _root->system_page_size);
+    munmap(p + big->size, _root->system_page_size);
+
+    madvise(user_pages, new_size, MADV_WILLNEED);
+
+    /* The index is keyed by the address of the user pages
+     * and the canaries are derived from it */
+    big_zone_index_remove(big);
+    big->user_pages_start = user_pages;
+    big->size = new_size;
+    big->canary_a = ((uint64_t) big ^ __builtin_bswap64((uint64_t) big->user_pages_start) ^ _root->big_zone_canary_secret);
+    big->canary_b = big->canary_a;
+    big_zone_index_insert(big);
+
+    UNLOCK_BIG_ZONE();
+    return user_pages;
+}
+#endif
+
+/* Unmaps the user pages, guard pages and meta data of a
+ * big zone that is no longer on any list or in the index.
+ * Requires the big zone lock */
+INTERNAL_HIDDEN void big_zone_unmap(iso_alloc_big_zone_t *big) {
+    void *user_pages = big->user_pages_start - _root->system_page_size;
+    const size_t size = big->size + (_root->system_page_size << BIG_ZONE_USER_PAGE_COUNT_SHIFT);
+
+    /* Big zone meta data is at a random offset from its base page */
+    void *meta = (void *) ROUND_DOWN_PAGE((uintptr_t) big) - _root->system_page_size;
+
+    UNPOISON_BIG_ZONE(big);
+    memset(big, POISON_BYTE, sizeof(iso_alloc_big_zone_t));
+    munmap(user_pages, size);
+    munmap(meta, _root->system_page_size * BIG_ZONE_META_DATA_PAGE_COUNT);
+}
+
+/* Unmaps the least recently freed big zones until free
+ * big zones hold no more than retain bytes of user pages.
+ * Requires the big zone lock */
+INTERNAL_HIDDEN void big_zone_trim(uint64_t retain) {
+    while(_root->big_zone_free_bytes > retain) {
+        iso_alloc_big_zone_t *big = UNMASK_BIG_ZONE_NEXT(_root->big_zone_lru_tail);
         check_big_canary(big);
-        big->free = false;
-        UNPOISON_BIG_ZONE(big);
-        UNLOCK_BIG_ZONE();
-        return big->user_pages_start;
+
+        big_zone_free_remove(big);
+        big_zone_list_remove(big);
+        big_zone_index_remove(big);
+        big_zone_unmap(big);
     }
 }
 
-INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc_bitslot_from_zone(bit_slot_t bitslot, iso_alloc_zone_t *zone) {
+/* If zero_sz is not 0 the first zero_sz bytes of the chunk
+ * returned are zero. A chunk that was never used, or the
+ * pages of a free'd chunk that are marked in the purge map,
+ * already are so only the rest is cleared */
+INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc_bitslot_from_zone(bit_slot_t bitslot, iso_alloc_zone_t *zone, size_t zero_sz) {
     const bitmap_index_t dwords_to_bit_slot = (bitslot >> BITS_PER_QWORD_SHIFT);
     const int64_t which_bit = WHICH_BIT(bitslot);
 
@@ -1184,10 +1886,10 @@ INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc_bitslot_from_zone(bit_slot_t bit
      * which could result in a page fault */
     bitmap_index_t b = bm[dwords_to_bit_slot];
 
-    if(UNLIKELY(p > zone->user_pages_start + ZONE_USER_SIZE)) {
+    if(UNLIKELY(p > zone->user_pages_start + ZONE_USER_SZ(zone))) {
         LOG_AND_ABORT("Allocating an address 0x%p from zone[%d], bit slot %lu %ld bytes %ld pages outside zones user pages 0x%p 0x%p",
-                      p, zone->index, bitslot, p - (zone->user_pages_start + ZONE_USER_SIZE), (p - (zone->user_pages_start + ZONE_USER_SIZE)) / _root->system_page_size,
-                      zone->user_pages_start, zone->user_pages_start + ZONE_USER_SIZE);
+                      p, zone->index, bitslot, p - (zone->user_pages_start + ZONE_USER_SZ(zone)), (p - (zone->user_pages_start + ZONE_USER_SZ(zone))) / _root->system_page_size,
+                      zone->user_pages_start, zone->user_pages_start + ZONE_USER_SZ(zone));
     }
 
     if(UNLIKELY((GET_BIT(b, which_bit)) != 0)) {
@@ -1195,12 +1897,16 @@ INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc_bitslot_from_zone(bit_slot_t bit
                       zone->index, zone->chunk_size, p, &bm[dwords_to_bit_slot], bitslot, which_bit);
     }
 
+    /* A chunk in state 00 has never been used */
+    const bool used = ((GET_BIT(b, (which_bit + 1))) == 1);
+
     /* This chunk was either previously allocated and free'd
      * or it's a canary chunk. In either case this means it
-     * has a canary written in its first dword. Here we check
-     * that canary and abort if its been corrupted */
+     * has a canary written in its first dword, unless it's
+     * on a page marked in the purge map. Here we check that
+     * canary and abort if its been corrupted */
 #if !ENABLE_ASAN && !DISABLE_CANARY
-    if((GET_BIT(b, (which_bit + 1))) == 1) {
+    if(used == true) {
         check_canary(zone, p);
         *(uint64_t *) p = 0x0;
     }
@@ -1215,17 +1921,49 @@ INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc_bitslot_from_zone(bit_slot_t bit
      * as a canary chunk. This bit is set again upon free */
     UNSET_BIT(b, (which_bit + 1));
     bm[dwords_to_bit_slot] = b;
+
+    /* Clear what calloc needs before the purge map is
+     * updated, it's the record of which pages are zero */
+    if(zero_sz != 0 && used == true) {
+        if(zone->purged_pages != 0) {
+            clear_unpurged(zone, bm, p, zero_sz);
+        } else {
+            memset(p, 0x0, zero_sz);
+        }
+    }
+
+    /* Write the canaries of any page this chunk overlaps
+     * that has none yet. This chunk is now in use so none
+     * are written to it */
+    if(zone->purged_pages != 0) {
+        unpurge_chunk(zone, bm, bitslot >> BITS_PER_CHUNK_SHIFT);
+    }
+
+    /* The last free chunk in this qword is gone */
+    if(GET_FREE_BITSLOTS(b) == 0) {
+        bitmap_index_t *summary = GET_SUMMARY_PTR(zone, bm);
+        UNSET_BIT(summary[dwords_to_bit_slot >> BITS_PER_QWORD_SHIFT], (dwords_to_bit_slot & (BITS_PER_QWORD - 1)));
+    }
+
     zone->af_count++;
     zone->alloc_count++;
     return p;
 }
 
-/* Populates the thread cache, requires the root is locked and zone is unmasked */
+/* Populates the thread cache, requires the zone is locked */
 INTERNAL_HIDDEN INLINE void populate_zone_cache(iso_alloc_zone_t *zone) {
     if(UNLIKELY(zone->internal == false)) {
         return;
     }
 
+#if THREAD_ZONES
+    /* The owner finds these via thread_zones and
+     * no other thread can allocate from them */
+    if(zone->owner != 0) {
+        return;
+    }
+#endif
+
     /* Don't cache this zone if it was recently cached */
     if(zone_cache_count != 0 && zone_cache[zone_cache_count - 1].zone == zone) {
         return;
@@ -1249,12 +1987,14 @@ INTERNAL_HIDDEN uint8_t _iso_alloc_get_mem_tag(void *p, iso_alloc_zone_t *zone)
     uint8_t *_mtp = (user_pages_start - _root->system_page_size - ROUND_UP_PAGE((GET_CHUNK_COUNT(zone) * MEM_TAG_SIZE)));
     const uint64_t chunk_offset = (uint64_t) (p - user_pages_start);
 
+    const uint64_t chunk_number = GET_CHUNK_NUMBER(zone, chunk_offset);
+
     /* Ensure the pointer is a multiple of chunk size */
-    if(UNLIKELY((chunk_offset & (zone->chunk_size - 1)) != 0)) {
+    if(UNLIKELY((chunk_number * zone->chunk_size) != chunk_offset)) {
         LOG_AND_ABORT("Chunk offset %d not an alignment of %d", chunk_offset, zone->chunk_size);
     }
 
-    _mtp += (chunk_offset / zone->chunk_size);
+    _mtp += chunk_number;
     return *_mtp;
 #else
     return 0;
@@ -1280,377 +2020,1631 @@ INTERNAL_HIDDEN void *_untag_ptr(void *p, iso_alloc_zone_t *zone) {
     return (void *) ((tag << UNTAGGED_BITS) ^ (uintptr_t) p);
 }
 
-INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc(iso_alloc_zone_t *zone, size_t size) {
-#if NO_ZERO_ALLOCATIONS
-    if(UNLIKELY(size == 0 && _root != NULL)) {
-        return _zero_alloc_page;
-    }
-#endif
-
-    if(UNLIKELY(zone && size > zone->chunk_size)) {
-        LOG_AND_ABORT("Private zone %d cannot hold chunks of size %d", zone->index, zone->chunk_size);
-    }
+#if THREAD_ZONES
+/* Hands all zones owned by this thread back to the
+ * shared pool. They are already linked into the zone
+ * lookup table so clearing the owner is all it takes.
+ * Called via pthread key destructor on thread exit */
+INTERNAL_HIDDEN void _release_thread_zones(void *unused) {
+    flush_caches();
 
     LOCK_ROOT();
 
-    if(UNLIKELY(_root == NULL)) {
-        if(UNLIKELY(zone != NULL)) {
-            LOG_AND_ABORT("_root was NULL but zone %p was not", zone);
+    for(int32_t i = 0; i < THREAD_ZONE_SLOTS; i++) {
+        iso_alloc_zone_t *zone = thread_zones[i];
+
+        if(zone != NULL) {
+            LOCK_ZONE(zone);
+            __atomic_store_n(&zone->owner, 0, __ATOMIC_SEQ_CST);
+            _iso_drain_remote_frees(zone);
+            UNLOCK_ZONE(zone);
+            thread_zones[i] = NULL;
         }
+    }
 
-        g_page_size = sysconf(_SC_PAGESIZE);
-        iso_alloc_initialize_global_root();
+    UNLOCK_ROOT();
+}
 
-#if NO_ZERO_ALLOCATIONS
-        /* In the unlikely event size is 0 but we hadn't
-         * initialized the root yet return the zero page */
-        if(UNLIKELY(size == 0)) {
-            UNLOCK_ROOT();
-            return _zero_alloc_page;
-        }
-#endif
+/* Frees every chunk other threads have queued for this
+ * zone and returns how many there were. Requires the
+ * zone is locked. Slots are swapped out atomically as
+ * producers may still be writing to other slots */
+INTERNAL_HIDDEN uint32_t _iso_drain_remote_frees(iso_alloc_zone_t *zone) {
+    /* This load must not be reordered before the owner
+     * store in _release_thread_zones, see _iso_remote_free */
+    if(__atomic_load_n(&zone->remote_free_count, __ATOMIC_SEQ_CST) == 0) {
+        return 0;
     }
 
-#if ALLOC_SANITY
-    /* We don't sample if we are allocating from a private zone */
-    if(zone != NULL) {
-        /* We only sample allocations smaller than an individual
-         * page. We are unlikely to find uninitialized reads on
-         * larger size and it makes tracking them less complex */
-        const size_t sampled_size = ALIGN_SZ_UP(size);
+    uint32_t drained = 0;
 
-        if(sampled_size < _root->system_page_size && _sane_sampled < MAX_SANE_SAMPLES) {
-            /* If we chose to sample this allocation then
-             * _iso_alloc_sample will call UNLOCK_ROOT() */
-            void *ps = _iso_alloc_sample(sampled_size);
+    for(int32_t i = 0; i < REMOTE_FREE_SZ; i++) {
+        void *p = __atomic_exchange_n(&zone->remote_free[i], NULL, __ATOMIC_ACQUIRE);
 
-            if(ps != NULL) {
-                return ps;
-            }
+        if(p != NULL) {
+            iso_free_chunk_from_zone(zone, p, false);
+            drained++;
         }
     }
-#endif
 
-#if HEAP_PROFILER
-    _iso_alloc_profile(size);
-#endif
+    __atomic_sub_fetch(&zone->remote_free_count, drained, __ATOMIC_RELAXED);
+    return drained;
+}
 
-    /* Allocation requests of SMALL_SZ_MAX bytes or larger are
-     * handled by the 'big allocation' path. If a zone was
-     * passed in we abort because its a misuse of the API */
-    if(LIKELY(size <= SMALL_SZ_MAX)) {
-#if FUZZ_MODE
-        _verify_all_zones();
+#if UNIT_TESTING
+/* Called once a queue slot is reserved so a test can
+ * release the zone before the chunk lands in the queue */
+static void (*remote_free_hook)(iso_alloc_zone_t *zone);
 #endif
-        if(LIKELY(zone == NULL)) {
-            /* Hot Path: Check the zone cache for a zone this
-             * thread recently used for an alloc/free operation.
-             * It's likely we are allocating a similar size chunk
-             * and this will speed up that operation */
-            for(int64_t i = 0; i < zone_cache_count; i++) {
-                if(zone_cache[i].chunk_size >= size) {
-                    bool fit = iso_does_zone_fit(zone_cache[i].zone, size);
-
-                    if(fit == true) {
-                        zone = zone_cache[i].zone;
-                        break;
-                    }
-                }
-            }
-        }
 
-        bit_slot_t free_bit_slot = BAD_BIT_SLOT;
+/* Queues a chunk in the zone that holds it if that zone
+ * is owned by another thread. Returns false if the chunk
+ * is not in a thread owned zone or the queue is full, in
+ * which case the caller must free it the usual way */
+INTERNAL_HIDDEN bool _iso_remote_free(void *p, size_t size) {
+    iso_alloc_zone_t *zone = zone_map_get(p);
 
-        /* Slow Path: This will iterate through all zones
-         * looking for a suitable one, this includes the
-         * zones we cached above */
-        if(zone == NULL) {
-            zone = iso_find_zone_fit(size);
-        }
+    if(zone == NULL) {
+        return false;
+    }
 
-        /* We only need to check if the zone is usable
-         * if it's a private zone. If we chose this zone
-         * then its guaranteed to already be usable */
-        if(LIKELY(zone != NULL)) {
-            if(zone->internal == false) {
-                zone = is_zone_usable(zone, size);
+    const uint64_t owner = __atomic_load_n(&zone->owner, __ATOMIC_ACQUIRE);
 
-                if(zone == NULL) {
-                    UNLOCK_ROOT();
-#if ABORT_ON_NULL
-                    LOG_AND_ABORT("isoalloc configured to abort on NULL");
-#endif
-                    return NULL;
-                }
-            }
+    if(owner == 0 || owner == thread_zone_owner) {
+        return false;
+    }
 
-            free_bit_slot = zone->next_free_bit_slot;
+    /* The owner toggles user_pages_start in place while
+     * it holds the zone lock so we use the stable copy */
+    const void *user_pages_start = (void *) ((uintptr_t) zone->remote_pages_start ^ (uintptr_t) zone->pointer_mask);
 
-            if(UNLIKELY(free_bit_slot == BAD_BIT_SLOT)) {
-                UNLOCK_ROOT();
-#if ABORT_ON_NULL
-                LOG_AND_ABORT("isoalloc configured to abort on NULL");
-#endif
-                return NULL;
-            }
-        } else {
-            /* Extra Slow Path: We need a new zone in order
-             * to satisfy this allocation request */
-            zone = _iso_new_zone(size, true);
+    if(p < user_pages_start || p >= (user_pages_start + ZONE_USER_SZ(zone))) {
+        return false;
+    }
 
-            if(UNLIKELY(zone == NULL)) {
-                LOG_AND_ABORT("Failed to create a zone for allocation of %zu bytes", size);
-            }
+    if(UNLIKELY(zone->chunk_size < size)) {
+        LOG_AND_ABORT("Invalid size (expected %d, got %d) for chunk 0x%p", zone->chunk_size, size, p);
+    }
 
-            /* This is a brand new zone, so the fast path
-             * should always work. Abort if it doesn't */
-            free_bit_slot = zone->next_free_bit_slot;
+    const uint64_t chunk_offset = (uint64_t) (p - user_pages_start);
+    const size_t chunk_number = GET_CHUNK_NUMBER(zone, chunk_offset);
 
-            if(UNLIKELY(free_bit_slot == BAD_BIT_SLOT)) {
-                LOG_AND_ABORT("Allocated a new zone with no free bit slots");
-            }
-        }
+    /* A misaligned chunk is reported by the usual path */
+    if(UNLIKELY((chunk_number * zone->chunk_size) != chunk_offset)) {
+        return false;
+    }
 
-        UNMASK_ZONE_PTRS(zone);
+    /* The owner only checks the bitmap when it drains the
+     * queue, so catch a double free here while the caller
+     * is still on the stack. The owner may be writing to
+     * the bitmap so this is a plain read. A chunk queued
+     * twice before a drain is only caught by the owner */
+    const bit_slot_t bit_slot = (chunk_number << BITS_PER_CHUNK_SHIFT);
+    const bitmap_index_t *bm = (bitmap_index_t *) ((uintptr_t) zone->remote_bitmap_start ^ (uintptr_t) zone->pointer_mask);
+    const bitmap_index_t b = __atomic_load_n(&bm[bit_slot >> BITS_PER_QWORD_SHIFT], __ATOMIC_RELAXED);
 
-        zone->next_free_bit_slot = BAD_BIT_SLOT;
-        void *p = _iso_alloc_bitslot_from_zone(free_bit_slot, zone);
+    if(UNLIKELY((GET_BIT(b, WHICH_BIT(bit_slot))) == 0)) {
+        LOG_AND_ABORT("Double free of chunk 0x%p detected from zone[%d] bit_slot=%lu", p, zone->index, bit_slot);
+    }
 
-        MASK_ZONE_PTRS(zone);
-        UNLOCK_ROOT();
+    /* Reserve room for the chunk before it is visible in
+     * a slot so a drain never sees an empty count with a
+     * full slot. The count never drops below the number
+     * of full slots so a successful reservation means a
+     * slot is free and we don't probe a full queue */
+    if(__atomic_add_fetch(&zone->remote_free_count, 1, __ATOMIC_SEQ_CST) > REMOTE_FREE_SZ) {
+        __atomic_sub_fetch(&zone->remote_free_count, 1, __ATOMIC_RELAXED);
+        return false;
+    }
 
-        /* Zones internal status cannot be converted, it's
-         * safe to access this bool after unlocking and
-         * then populating the zone cache */
-        if(zone->internal == false) {
-            populate_zone_cache(zone);
-        }
+#if UNIT_TESTING
+    if(UNLIKELY(remote_free_hook != NULL)) {
+        remote_free_hook(zone);
+    }
+#endif
 
-        return p;
-    } else {
-        /* It's safe to unlock the root at this point because
-         * the big zone allocation path uses a different lock */
-        UNLOCK_ROOT();
+    const uint32_t hint = __atomic_fetch_add(&zone->remote_free_hint, 1, __ATOMIC_RELAXED);
+
+    for(int32_t i = 0; i < REMOTE_FREE_SZ; i++) {
+        void **slot = &zone->remote_free[(hint + i) & (REMOTE_FREE_SZ - 1)];
+        void *expected = NULL;
+
+        if(__atomic_compare_exchange_n(slot, &expected, p, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            /* The owner may have handed this zone back to the
+             * shared pool after we checked. Whoever clears the
+             * owner drains the queue afterwards, but if it did
+             * so before our chunk landed then nobody else will */
+            if(UNLIKELY(__atomic_load_n(&zone->owner, __ATOMIC_SEQ_CST) == 0)) {
+                LOCK_ZONE(zone);
+                _iso_drain_remote_frees(zone);
+                UNLOCK_ZONE(zone);
+            }
 
-        if(UNLIKELY(zone != NULL)) {
-            LOG_AND_ABORT("Allocation size of %d is > %d and cannot use a private zone", size, SMALL_SZ_MAX);
+            return true;
         }
-
-        return _iso_big_alloc(size);
     }
-}
 
-INTERNAL_HIDDEN iso_alloc_big_zone_t *iso_find_big_zone(void *p) {
-    LOCK_BIG_ZONE();
-
-    /* Its possible we are trying to unmap a big allocation */
-    iso_alloc_big_zone_t *big_zone = _root->big_zone_head;
+    __atomic_sub_fetch(&zone->remote_free_count, 1, __ATOMIC_RELAXED);
+    return false;
+}
 
-    if(big_zone != NULL) {
-        big_zone = UNMASK_BIG_ZONE_NEXT(_root->big_zone_head);
-    }
+/* Returns the zone this thread owns for chunks of size
+ * bytes, a size class, locked and with a free chunk. A
+ * full zone is handed back to the shared pool and replaced.
+ * The root lock is only taken when this thread needs a new
+ * zone for this size class */
+INTERNAL_HIDDEN iso_alloc_zone_t *iso_lock_thread_zone(size_t size) {
+    const int32_t slot = size_class_index(size);
+    iso_alloc_zone_t *zone = thread_zones[slot];
 
-    while(big_zone != NULL) {
-        check_big_canary(big_zone);
+    if(LIKELY(zone != NULL)) {
+        LOCK_ZONE(zone);
 
-        /* Only a free of the exact address is valid */
-        if(p == big_zone->user_pages_start) {
-            UNLOCK_BIG_ZONE();
-            return big_zone;
+        /* Chunks freed by other threads are picked up in
+         * batches, or right away if the zone is full */
+        if(UNLIKELY(__atomic_load_n(&zone->remote_free_count, __ATOMIC_RELAXED) >= REMOTE_FREE_BATCH)) {
+            _iso_drain_remote_frees(zone);
         }
 
-        if(UNLIKELY(p > big_zone->user_pages_start && p < (big_zone->user_pages_start + big_zone->size))) {
-            LOG_AND_ABORT("Invalid free of big zone allocation at 0x%p in mapping 0x%p", p, big_zone->user_pages_start);
+        if(LIKELY(is_zone_usable(zone, size) != NULL) ||
+           (_iso_drain_remote_frees(zone) != 0 && is_zone_usable(zone, size) != NULL)) {
+            return zone;
         }
 
-        if(big_zone->next != NULL) {
-            big_zone = UNMASK_BIG_ZONE_NEXT(big_zone->next);
-        } else {
-            big_zone = NULL;
-            break;
-        }
+        UNLOCK_ZONE(zone);
     }
 
-    UNLOCK_BIG_ZONE();
-    return NULL;
-}
-
-/* iso_find_zone_bitmap_range and iso_find_zone_range are
- * logically identical functions that both return a zone
- * for a pointer. The only difference is where the pointer
- * addresses, a bitmap or user pages */
-INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_bitmap_range(const void *restrict p) {
-    iso_alloc_zone_t *zone = NULL;
+    LOCK_ROOT();
 
-    /* The chunk lookup table is the fastest way to find a
-     * zone given a pointer to a chunk so we check it first */
-    uint16_t zone_index = chunk_lookup_table[ADDR_TO_CHUNK_TABLE(p)];
+    if(thread_zone_owner == 0) {
+        thread_zone_owner = __atomic_add_fetch(&thread_zone_owner_count, 1, __ATOMIC_RELAXED);
+        pthread_setspecific(thread_zone_key, thread_zones);
+    }
 
-    if(UNLIKELY(zone_index > _root->zones_used)) {
-        LOG_AND_ABORT("Pointer to zone lookup table corrupted at position %zu", ADDR_TO_CHUNK_TABLE(p));
+    /* The zone this thread owned for this size class is
+     * full. It goes back to the shared pool where other
+     * threads can use any chunks that are freed later */
+    if(zone != NULL) {
+        LOCK_ZONE(zone);
+        __atomic_store_n(&zone->owner, 0, __ATOMIC_SEQ_CST);
+        _iso_drain_remote_frees(zone);
+        UNLOCK_ZONE(zone);
     }
 
-    zone = &_root->zones[zone_index];
-    void *bitmap_start = UNMASK_BITMAP_PTR(zone);
+    zone = _iso_new_zone(size, true);
 
-    if(LIKELY(bitmap_start <= p && (bitmap_start + zone->bitmap_size) > p)) {
-        return zone;
+    if(UNLIKELY(zone == NULL)) {
+        LOG_AND_ABORT("Failed to create a thread zone for allocation of %zu bytes", size);
     }
 
-    iso_alloc_zone_t *tmp_zone = NULL;
+    /* Other threads read these without the zone lock
+     * so the owner is published last */
+    zone->remote_pages_start = zone->user_pages_start;
+    zone->remote_bitmap_start = zone->bitmap_start;
+    __atomic_store_n(&zone->owner, thread_zone_owner, __ATOMIC_RELEASE);
+    thread_zones[slot] = zone;
+    UNLOCK_ROOT();
 
-    /* Now we check the MRU thread zone cache */
-    for(int64_t i = 0; i < zone_cache_count; i++) {
-        tmp_zone = zone_cache[i].zone;
-        bitmap_start = UNMASK_BITMAP_PTR(tmp_zone);
+    LOCK_ZONE(zone);
 
-        if(bitmap_start <= p && (bitmap_start + tmp_zone->bitmap_size) > p) {
-            return tmp_zone;
-        }
+    /* This is a brand new zone, so the fast path
+     * should always work. Abort if it doesn't */
+    if(UNLIKELY(zone->next_free_bit_slot == BAD_BIT_SLOT)) {
+        LOG_AND_ABORT("Allocated a new zone with no free bit slots");
     }
 
-    /* Now we check all zones, this is the slowest path */
-    for(int64_t i = 0; i < _root->zones_used; i++) {
-        zone = &_root->zones[i];
+    return zone;
+}
 
-        bitmap_start = UNMASK_BITMAP_PTR(zone);
+/* Allocates a chunk from a zone owned by this thread */
+INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_thread_zone_alloc(size_t size, bool zero) {
+    const size_t zero_sz = (zero == true) ? size : 0;
+    size = size_class(size);
 
-        if(bitmap_start <= p && (bitmap_start + zone->bitmap_size) > p) {
-            return zone;
+#if FUZZ_MODE || HEAP_PROFILER
+    LOCK_ROOT();
+#if FUZZ_MODE
+    _verify_all_zones();
+#endif
+#if HEAP_PROFILER
+    _iso_alloc_profile(size);
+#endif
+    UNLOCK_ROOT();
+#endif
+
+    iso_alloc_zone_t *zone = iso_lock_thread_zone(size);
+    const bit_slot_t free_bit_slot = zone->next_free_bit_slot;
+
+    UNMASK_ZONE_PTRS(zone);
+    zone->next_free_bit_slot = BAD_BIT_SLOT;
+    void *p = _iso_alloc_bitslot_from_zone(free_bit_slot, zone, zero_sz);
+    MASK_ZONE_PTRS(zone);
+    UNLOCK_ZONE(zone);
+    return p;
+}
+#endif
+
+/* Returns a locked zone with a free chunk of size bytes
+ * whose chunk size is a multiple of alignment. A new zone
+ * is created if no existing zone fits */
+INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_for_alloc(size_t size, size_t alignment) {
+    iso_alloc_zone_t *zone = NULL;
+
+    /* Hot Path: Check the zone cache for a zone this
+     * thread recently used for an alloc/free operation.
+     * It's likely we are allocating a similar size chunk
+     * and this will speed up that operation. Only the
+     * lock of the zone we are checking is held */
+    for(int64_t i = 0; i < zone_cache_count; i++) {
+        if(zone_cache[i].chunk_size >= size && (zone_cache[i].chunk_size & (alignment - 1)) == 0) {
+            iso_alloc_zone_t *cached_zone = zone_cache[i].zone;
+            LOCK_ZONE(cached_zone);
+            bool fit = iso_does_zone_fit(cached_zone, size);
+
+            if(fit == true) {
+                return cached_zone;
+            }
+
+            UNLOCK_ZONE(cached_zone);
+        }
+    }
+
+    /* Slow Path: This will iterate through all zones
+     * looking for a suitable one, this includes the
+     * zones we cached above. The root lock keeps the
+     * set of zones stable while we search it */
+    LOCK_ROOT();
+    zone = iso_find_zone_fit(size, alignment);
+
+    if(zone == NULL) {
+        /* Extra Slow Path: We need a new zone in order
+         * to satisfy this allocation request */
+        zone = _iso_new_zone(size, true);
+
+        if(UNLIKELY(zone == NULL)) {
+            LOG_AND_ABORT("Failed to create a zone for allocation of %zu bytes", size);
+        }
+
+        LOCK_ZONE(zone);
+
+        /* This is a brand new zone, so the fast path
+         * should always work. Abort if it doesn't */
+        if(UNLIKELY(zone->next_free_bit_slot == BAD_BIT_SLOT)) {
+            LOG_AND_ABORT("Allocated a new zone with no free bit slots");
+        }
+    }
+
+    UNLOCK_ROOT();
+    return zone;
+}
+
+INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc(iso_alloc_zone_t *zone, size_t size) {
+    return _iso_alloc_internal(zone, size, ALIGNMENT, false);
+}
+
+/* If zero is true the chunk returned is zero'd like calloc.
+ * The chunk is aligned to alignment, a power of 2 that size
+ * must be a multiple of if it's larger than ALIGNMENT */
+INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc_internal(iso_alloc_zone_t *zone, size_t size, size_t alignment, bool zero) {
+#if NO_ZERO_ALLOCATIONS
+    if(UNLIKELY(size == 0 && _root != NULL)) {
+        return _zero_alloc_page;
+    }
+#endif
+
+    if(UNLIKELY(zone && size > zone->chunk_size)) {
+        LOG_AND_ABORT("Private zone %d cannot hold chunks of size %d", zone->index, zone->chunk_size);
+    }
+
+#if THREAD_ZONES
+    /* Hot Path: Allocate from a zone owned by this
+     * thread without touching the root lock */
+    if(LIKELY(zone == NULL && size <= THREAD_ZONE_MAX_SZ && _root != NULL && alignment <= _root->system_page_size)) {
+        return _iso_thread_zone_alloc(size, zero);
+    }
+#endif
+
+    if(UNLIKELY(_root == NULL)) {
+        if(UNLIKELY(zone != NULL)) {
+            LOG_AND_ABORT("_root was NULL but zone %p was not", zone);
+        }
+
+        LOCK_ROOT();
+
+        /* Another thread may have won the race to
+         * initialize the root while we waited */
+        if(_root == NULL) {
+            g_page_size = sysconf(_SC_PAGESIZE);
+            iso_alloc_initialize_global_root();
+        }
+
+        UNLOCK_ROOT();
+
+#if NO_ZERO_ALLOCATIONS
+        /* In the unlikely event size is 0 but we hadn't
+         * initialized the root yet return the zero page */
+        if(UNLIKELY(size == 0)) {
+            return _zero_alloc_page;
+        }
+#endif
+    }
+
+#if ALLOC_SANITY
+    /* We don't sample if we are allocating from a private zone */
+    if(zone != NULL) {
+        /* We only sample allocations smaller than an individual
+         * page. We are unlikely to find uninitialized reads on
+         * larger size and it makes tracking them less complex */
+        const size_t sampled_size = ALIGN_SZ_UP(size);
+
+        if(sampled_size < _root->system_page_size && _sane_sampled < MAX_SANE_SAMPLES) {
+            LOCK_ROOT();
+
+            /* If we chose to sample this allocation then
+             * _iso_alloc_sample will call UNLOCK_ROOT() */
+            void *ps = _iso_alloc_sample(sampled_size);
+
+            if(ps != NULL) {
+                return ps;
+            }
+
+            UNLOCK_ROOT();
+        }
+    }
+#endif
+
+#if HEAP_PROFILER || FUZZ_MODE
+    LOCK_ROOT();
+#if HEAP_PROFILER
+    _iso_alloc_profile(size);
+#endif
+#if FUZZ_MODE
+    if(size <= ZONE_SZ_MAX) {
+        _verify_all_zones();
+    }
+#endif
+    UNLOCK_ROOT();
+#endif
+
+    /* Allocation requests larger than ZONE_SZ_MAX bytes, or
+     * aligned to more than a page, are handled by the 'big
+     * allocation' path. If a zone was passed in we abort
+     * because its a misuse of the API */
+    if(LIKELY(size <= ZONE_SZ_MAX && alignment <= _root->system_page_size)) {
+        if(LIKELY(zone == NULL)) {
+            zone = iso_find_zone_for_alloc(size, alignment);
+        } else {
+            /* We only need to check if the zone is usable
+             * if it's a private zone. If we chose this zone
+             * then its guaranteed to already be usable */
+            LOCK_ZONE(zone);
+
+            if(is_zone_usable(zone, size) == NULL) {
+                UNLOCK_ZONE(zone);
+#if ABORT_ON_NULL
+                LOG_AND_ABORT("isoalloc configured to abort on NULL");
+#endif
+                return NULL;
+            }
+        }
+
+        const bit_slot_t free_bit_slot = zone->next_free_bit_slot;
+
+        if(UNLIKELY(free_bit_slot == BAD_BIT_SLOT)) {
+            UNLOCK_ZONE(zone);
+#if ABORT_ON_NULL
+            LOG_AND_ABORT("isoalloc configured to abort on NULL");
+#endif
+            return NULL;
+        }
+
+        UNMASK_ZONE_PTRS(zone);
+
+        zone->next_free_bit_slot = BAD_BIT_SLOT;
+        void *p = _iso_alloc_bitslot_from_zone(free_bit_slot, zone, (zero == true) ? size : 0);
+
+        MASK_ZONE_PTRS(zone);
+        UNLOCK_ZONE(zone);
+
+        /* Zones internal status cannot be converted, it's
+         * safe to access this bool after unlocking and
+         * then populating the zone cache */
+        if(zone->internal == false) {
+            populate_zone_cache(zone);
+        }
+
+        return p;
+    } else {
+        if(UNLIKELY(zone != NULL)) {
+            LOG_AND_ABORT("Allocation size of %d is > %d and cannot use a private zone", size, ZONE_SZ_MAX);
+        }
+
+        return _iso_big_alloc(size, alignment, zero);
+    }
+}
+
+/* Allocates up to n chunks from a zone whose next free
+ * bit slot is set. Bit slots are taken straight from the
+ * free bit slot cache, which is refilled when it empties.
+ * Returns how many chunks were written to out. Requires
+ * the zone is locked and its pointers are unmasked */
+INTERNAL_HIDDEN size_t _iso_alloc_bitslots_from_zone(iso_alloc_zone_t *zone, void **out, size_t n) {
+    bit_slot_t free_bit_slot = zone->next_free_bit_slot;
+    zone->next_free_bit_slot = BAD_BIT_SLOT;
+    size_t i = 0;
+
+    while(free_bit_slot != BAD_BIT_SLOT) {
+        out[i] = _iso_alloc_bitslot_from_zone(free_bit_slot, zone, 0);
+        i++;
+
+        if(i == n) {
+            break;
+        }
+
+        free_bit_slot = get_next_free_bit_slot(zone);
+
+        if(free_bit_slot == BAD_BIT_SLOT && zone->free_bit_slot_cache_usable >= zone->free_bit_slot_cache_index) {
+            fill_free_bit_slot_cache(zone);
+            free_bit_slot = get_next_free_bit_slot(zone);
+        }
+
+        zone->next_free_bit_slot = BAD_BIT_SLOT;
+    }
+
+    return i;
+}
+
+/* Allocates n chunks of size bytes into out. Each zone
+ * used is locked once for as many chunks as it can give
+ * us. Returns how many chunks were allocated, which is
+ * less than n only if an allocation failed */
+INTERNAL_HIDDEN size_t _iso_alloc_batch(size_t size, size_t n, void **out) {
+    size_t i = 0;
+
+#if HEAP_PROFILER || FUZZ_MODE
+    const bool single = true;
+#else
+    const bool single = (size == 0 || size > ZONE_SZ_MAX);
+#endif
+
+    /* The first allocation initializes the root. Sizes
+     * that don't come from a zone take the usual path */
+    while(i < n && (_root == NULL || single == true)) {
+        out[i] = _iso_alloc(NULL, size);
+
+        if(out[i] == NULL) {
+            return i;
+        }
+
+        i++;
+    }
+
+    while(i < n) {
+        iso_alloc_zone_t *zone = NULL;
+
+#if THREAD_ZONES
+        if(size <= THREAD_ZONE_MAX_SZ) {
+            zone = iso_lock_thread_zone(size_class(size));
+        }
+#endif
+
+        if(zone == NULL) {
+            zone = iso_find_zone_for_alloc(size, ALIGNMENT);
+        }
+
+        UNMASK_ZONE_PTRS(zone);
+        i += _iso_alloc_bitslots_from_zone(zone, &out[i], n - i);
+        MASK_ZONE_PTRS(zone);
+        UNLOCK_ZONE(zone);
+    }
+
+    return i;
+}
+
+INTERNAL_HIDDEN iso_alloc_big_zone_t *iso_find_big_zone(void *p) {
+    LOCK_BIG_ZONE();
+    /* Only a free of the exact address is valid */
+    iso_alloc_big_zone_t *big_zone = big_zone_index_find(p);
+    UNLOCK_BIG_ZONE();
+    return big_zone;
+}
+
+/* Returns the big zone whose user pages start at p
+ * or NULL. Only the matching big zone is touched and
+ * its canaries are verified. Requires the big zone lock */
+INTERNAL_HIDDEN iso_alloc_big_zone_t *big_zone_index_find(const void *p) {
+    if(_root->big_zone_index == NULL) {
+        return NULL;
+    }
+
+    const uintptr_t key = MASK_BIG_ZONE_KEY(p);
+    const uint64_t mask = (1ULL << _root->big_zone_index_shift) - 1;
+    uint64_t i = BIG_ZONE_INDEX_HASH(key, _root->big_zone_index_shift);
+
+    for(; _root->big_zone_index[i].key != 0; i = (i + 1) & mask) {
+        if(_root->big_zone_index[i].key == key) {
+            iso_alloc_big_zone_t *big = UNMASK_BIG_ZONE_NEXT(_root->big_zone_index[i].big);
+            check_big_canary(big);
+
+            if(UNLIKELY(big->user_pages_start != p)) {
+                LOG_AND_ABORT("Big zone index entry for 0x%p points to big zone 0x%p for 0x%p", p, big, big->user_pages_start);
+            }
+
+            return big;
         }
     }
 
     return NULL;
 }
 
-INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_range(const void *restrict p) {
-    iso_alloc_zone_t *zone = NULL;
+/* Requires the big zone lock */
+INTERNAL_HIDDEN void big_zone_index_insert(iso_alloc_big_zone_t *big) {
+    if(_root->big_zone_index == NULL || ((_root->big_zone_count + 1) << 1) > (1ULL << _root->big_zone_index_shift)) {
+        big_zone_index_grow();
+    }
 
-    /* The chunk lookup table is the fastest way to find a
-     * zone given a pointer to a chunk so we check it first */
-    uint16_t zone_index = chunk_lookup_table[ADDR_TO_CHUNK_TABLE(p)];
+    const uintptr_t key = MASK_BIG_ZONE_KEY(big->user_pages_start);
+    const uint64_t mask = (1ULL << _root->big_zone_index_shift) - 1;
+    uint64_t i = BIG_ZONE_INDEX_HASH(key, _root->big_zone_index_shift);
 
-    if(UNLIKELY(zone_index > _root->zones_used)) {
-        LOG_AND_ABORT("Pointer to zone lookup table corrupted at position %zu", ADDR_TO_CHUNK_TABLE(p));
+    while(_root->big_zone_index[i].key != 0) {
+        i = (i + 1) & mask;
     }
 
-    zone = &_root->zones[zone_index];
-    void *user_pages_start = UNMASK_USER_PTR(zone);
+    _root->big_zone_index[i].key = key;
+    _root->big_zone_index[i].big = MASK_BIG_ZONE_NEXT(big);
+    _root->big_zone_count++;
+}
 
-    if(LIKELY(user_pages_start <= p && (user_pages_start + ZONE_USER_SIZE) > p)) {
-        return zone;
+/* Removes a big zone from the index. Entries that follow
+ * it in the same probe run are shifted back so lookups
+ * never need tombstones. Requires the big zone lock */
+INTERNAL_HIDDEN void big_zone_index_remove(iso_alloc_big_zone_t *big) {
+    const uintptr_t key = MASK_BIG_ZONE_KEY(big->user_pages_start);
+    const uint64_t shift = _root->big_zone_index_shift;
+    const uint64_t mask = (1ULL << shift) - 1;
+    uint64_t i = BIG_ZONE_INDEX_HASH(key, shift);
+
+    while(_root->big_zone_index[i].key != key) {
+        if(UNLIKELY(_root->big_zone_index[i].key == 0)) {
+            LOG_AND_ABORT("The big zone index has been corrupted, unable to find big zone 0x%p", big);
+        }
+
+        i = (i + 1) & mask;
     }
 
-    iso_alloc_zone_t *tmp_zone = NULL;
+    for(uint64_t j = (i + 1) & mask; _root->big_zone_index[j].key != 0; j = (j + 1) & mask) {
+        const uint64_t h = BIG_ZONE_INDEX_HASH(_root->big_zone_index[j].key, shift);
 
-    /* Now we check the MRU thread zone cache */
-    for(int64_t i = 0; i < zone_cache_count; i++) {
-        tmp_zone = zone_cache[i].zone;
-        user_pages_start = UNMASK_USER_PTR(tmp_zone);
+        /* Move the entry at j into the hole at i unless its
+         * home slot lies cyclically between the two */
+        if(((j - h) & mask) >= ((j - i) & mask)) {
+            _root->big_zone_index[i] = _root->big_zone_index[j];
+            i = j;
+        }
+    }
+
+    _root->big_zone_index[i].key = 0;
+    _root->big_zone_index[i].big = NULL;
+    _root->big_zone_count--;
+}
+
+/* Requires the big zone lock */
+INTERNAL_HIDDEN void big_zone_index_grow(void) {
+    big_zone_index_entry_t *old_index = _root->big_zone_index;
+    const uint64_t old_shift = _root->big_zone_index_shift;
+    const uint64_t shift = (old_index == NULL) ? BIG_ZONE_INDEX_MIN_SHIFT : old_shift + 1;
+    const uint64_t mask = (1ULL << shift) - 1;
+
+    big_zone_index_entry_t *index = mmap_rw_pages(sizeof(big_zone_index_entry_t) << shift, true, BIG_ZONE_MD_NAME);
 
-        if(user_pages_start <= p && (user_pages_start + ZONE_USER_SIZE) > p) {
-            return tmp_zone;
+    if(index == NULL) {
+        LOG_AND_ABORT("Failed to grow the big zone index to %lu entries", 1ULL << shift);
+    }
+
+    if(old_index != NULL) {
+        for(uint64_t i = 0; i < (1ULL << old_shift); i++) {
+            if(old_index[i].key == 0) {
+                continue;
+            }
+
+            uint64_t j = BIG_ZONE_INDEX_HASH(old_index[i].key, shift);
+
+            while(index[j].key != 0) {
+                j = (j + 1) & mask;
+            }
+
+            index[j] = old_index[i];
         }
+
+        munmap(old_index, sizeof(big_zone_index_entry_t) << old_shift);
     }
 
-    /* Now we check all zones, this is the slowest path */
-    for(int64_t i = 0; i < _root->zones_used; i++) {
-        zone = &_root->zones[i];
+    _root->big_zone_index = index;
+    _root->big_zone_index_shift = shift;
+}
 
-        user_pages_start = UNMASK_USER_PTR(zone);
+INTERNAL_HIDDEN INLINE uint64_t big_zone_free_bin(size_t size) {
+    const uint64_t log2 = 63 - __builtin_clzll(size);
 
-        if(user_pages_start <= p && (user_pages_start + ZONE_USER_SIZE) > p) {
-            return zone;
+    if(log2 < BIG_ZONE_FREE_BIN_MIN_SHIFT) {
+        return 0;
+    }
+
+    /* The 2 bits below the top bit pick one of 4 bins */
+    const uint64_t bin = ((log2 - BIG_ZONE_FREE_BIN_MIN_SHIFT) << 2) + ((size >> (log2 - 2)) & 3);
+
+    return (bin < BIG_ZONE_FREE_BINS) ? bin : BIG_ZONE_FREE_BINS - 1;
+}
+
+/* Returns the smallest free big zone of at least size
+ * bytes or NULL. Big zones in the bin size falls into
+ * may be too small, those in any larger bin all fit so
+ * only the first non empty one is searched. Requires
+ * the big zone lock */
+INTERNAL_HIDDEN iso_alloc_big_zone_t *big_zone_free_find(size_t size) {
+    uint64_t bins = _root->big_zone_free_bitmap & ~((1ULL << big_zone_free_bin(size)) - 1);
+
+    while(bins != 0) {
+        iso_alloc_big_zone_t *big = UNMASK_BIG_ZONE_NEXT(_root->big_zone_free_bins[__builtin_ctzll(bins)]);
+        iso_alloc_big_zone_t *best = NULL;
+
+        while(big != NULL) {
+            check_big_canary(big);
+
+            if(big->size >= size && (best == NULL || big->size < best->size)) {
+                best = big;
+
+                if(big->size == size) {
+                    break;
+                }
+            }
+
+            if(big->free_next != NULL) {
+                big = UNMASK_BIG_ZONE_NEXT(big->free_next);
+            } else {
+                big = NULL;
+            }
+        }
+
+        if(best != NULL) {
+            return best;
         }
+
+        bins &= (bins - 1);
     }
 
     return NULL;
 }
 
-/* Checking canaries under ASAN mode is not trivial. ASAN
- * provides a strong guarantee that these chunks haven't
- * been modified in some way */
-#if ENABLE_ASAN || DISABLE_CANARY
-INTERNAL_HIDDEN INLINE void check_big_canary(iso_alloc_big_zone_t *big) {
-    return;
+/* Adds a big zone to its free bin and to the head of
+ * the LRU list. Requires the big zone lock */
+INTERNAL_HIDDEN void big_zone_free_insert(iso_alloc_big_zone_t *big) {
+    const uint64_t bin = big_zone_free_bin(big->size);
+
+    big->free_prev = NULL;
+    big->free_next = _root->big_zone_free_bins[bin];
+
+    if(_root->big_zone_free_bins[bin] != NULL) {
+        iso_alloc_big_zone_t *head = UNMASK_BIG_ZONE_NEXT(_root->big_zone_free_bins[bin]);
+        check_big_canary(head);
+        head->free_prev = MASK_BIG_ZONE_NEXT(big);
+    }
+
+    _root->big_zone_free_bins[bin] = MASK_BIG_ZONE_NEXT(big);
+    _root->big_zone_free_bitmap |= (1ULL << bin);
+
+    big->lru_prev = NULL;
+    big->lru_next = _root->big_zone_lru_head;
+
+    if(_root->big_zone_lru_head != NULL) {
+        iso_alloc_big_zone_t *head = UNMASK_BIG_ZONE_NEXT(_root->big_zone_lru_head);
+        check_big_canary(head);
+        head->lru_prev = MASK_BIG_ZONE_NEXT(big);
+    } else {
+        _root->big_zone_lru_tail = MASK_BIG_ZONE_NEXT(big);
+    }
+
+    _root->big_zone_lru_head = MASK_BIG_ZONE_NEXT(big);
+    _root->big_zone_free_bytes += big->size;
+
+#if BACKGROUND_THREAD
+    big->free_epoch = __atomic_load_n(&background_epoch, __ATOMIC_RELAXED);
+#endif
 }
 
-INTERNAL_HIDDEN INLINE void write_canary(iso_alloc_zone_t *zone, const void *p) {
-    return;
-}
+/* Requires the big zone lock */
+INTERNAL_HIDDEN void big_zone_free_remove(iso_alloc_big_zone_t *big) {
+    const uint64_t bin = big_zone_free_bin(big->size);
+
+    if(big->free_prev != NULL) {
+        iso_alloc_big_zone_t *prev = UNMASK_BIG_ZONE_NEXT(big->free_prev);
+        check_big_canary(prev);
+        prev->free_next = big->free_next;
+    } else {
+        _root->big_zone_free_bins[bin] = big->free_next;
+    }
+
+    if(big->free_next != NULL) {
+        iso_alloc_big_zone_t *next = UNMASK_BIG_ZONE_NEXT(big->free_next);
+        check_big_canary(next);
+        next->free_prev = big->free_prev;
+    }
+
+    if(_root->big_zone_free_bins[bin] == NULL) {
+        _root->big_zone_free_bitmap &= ~(1ULL << bin);
+    }
+
+    if(big->lru_prev != NULL) {
+        iso_alloc_big_zone_t *prev = UNMASK_BIG_ZONE_NEXT(big->lru_prev);
+        check_big_canary(prev);
+        prev->lru_next = big->lru_next;
+    } else {
+        _root->big_zone_lru_head = big->lru_next;
+    }
+
+    if(big->lru_next != NULL) {
+        iso_alloc_big_zone_t *next = UNMASK_BIG_ZONE_NEXT(big->lru_next);
+        check_big_canary(next);
+        next->lru_prev = big->lru_prev;
+    } else {
+        _root->big_zone_lru_tail = big->lru_prev;
+    }
+
+    big->free_next = NULL;
+    big->free_prev = NULL;
+    big->lru_next = NULL;
+    big->lru_prev = NULL;
+    _root->big_zone_free_bytes -= big->size;
+}
+
+/* Unlinks a big zone from the list of all big
+ * zones. Requires the big zone lock */
+INTERNAL_HIDDEN void big_zone_list_remove(iso_alloc_big_zone_t *big) {
+    if(big->prev != NULL) {
+        iso_alloc_big_zone_t *prev = UNMASK_BIG_ZONE_NEXT(big->prev);
+        check_big_canary(prev);
+        prev->next = big->next;
+    } else {
+        if(UNLIKELY(_root->big_zone_head != MASK_BIG_ZONE_NEXT(big))) {
+            LOG_AND_ABORT("The big zone list has been corrupted, unable to find big zone 0x%p", big);
+        }
+
+        _root->big_zone_head = big->next;
+    }
+
+    if(big->next != NULL) {
+        iso_alloc_big_zone_t *next = UNMASK_BIG_ZONE_NEXT(big->next);
+        check_big_canary(next);
+        next->prev = big->prev;
+    }
+
+    big->next = NULL;
+    big->prev = NULL;
+}
+
+/* Returns the zone whose user pages or bitmap hold p
+ * or NULL. This only reads the zone map and doesn't
+ * require the root lock. Callers must verify p is in
+ * the range they expect under the zone lock */
+INTERNAL_HIDDEN iso_alloc_zone_t *zone_map_get(const void *restrict p) {
+#if CONTIGUOUS_ZONES
+    /* Pointers below the reservation wrap around */
+    const uintptr_t offset = (uintptr_t) p - (uintptr_t) zone_slots;
+    zone_map_entry_t entry = 0;
+
+    if(LIKELY(offset < ZONE_SLOTS_SZ)) {
+        entry = __atomic_load_n(&zone_slot_map[offset >> ZONE_SLOT_SHIFT], __ATOMIC_ACQUIRE);
+    }
+#else
+    const uintptr_t unit = ZONE_MAP_UNIT(p);
+    zone_map_entry_t **node = __atomic_load_n(&zone_map[ZONE_MAP_ROOT_INDEX(unit)], __ATOMIC_ACQUIRE);
+    zone_map_entry_t entry = 0;
+
+    if(LIKELY(node != NULL)) {
+        zone_map_entry_t *leaf = __atomic_load_n(&node[ZONE_MAP_NODE_INDEX(unit)], __ATOMIC_ACQUIRE);
+
+        if(LIKELY(leaf != NULL)) {
+            entry = __atomic_load_n(&leaf[ZONE_MAP_LEAF_INDEX(unit)], __ATOMIC_ACQUIRE);
+        }
+    }
+#endif
+
+#if MEM_USAGE
+    if(entry != 0) {
+        __atomic_add_fetch(&_root->zone_map_hits, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&_root->zone_map_misses, 1, __ATOMIC_RELAXED);
+    }
+#endif
+
+    if(entry == 0) {
+        return NULL;
+    }
+
+    if(UNLIKELY(entry > __atomic_load_n(&_root->zones_used, __ATOMIC_ACQUIRE))) {
+        LOG_AND_ABORT("Zone map corrupted at 0x%p", p);
+    }
+
+    return &_root->zones[entry - 1];
+}
+
+/* Requires the root is locked. Points the zone map entry
+ * for every 4kb unit in [p, p + size) at zone, or clears
+ * them when zone is NULL. Nodes and leaves are created as
+ * needed and never freed so readers can walk the map
+ * without a lock */
+INTERNAL_HIDDEN void zone_map_set(const void *p, size_t size, iso_alloc_zone_t *zone) {
+    const zone_map_entry_t entry = (zone != NULL) ? (zone->index + 1) : 0;
+
+#if CONTIGUOUS_ZONES
+    /* Both the bitmap and user pages of a zone are in
+     * the same slot so there is one entry per zone */
+    const uintptr_t offset = (uintptr_t) p - (uintptr_t) zone_slots;
+
+    if(UNLIKELY(offset >= ZONE_SLOTS_SZ)) {
+        LOG_AND_ABORT("Zone pages at 0x%p are outside of the zone reservation", p);
+    }
+
+    __atomic_store_n(&zone_slot_map[offset >> ZONE_SLOT_SHIFT], entry, __ATOMIC_RELEASE);
+#else
+
+    if(UNLIKELY(((uintptr_t) p + size) > (1ULL << ZONE_MAP_VA_BITS))) {
+        LOG_AND_ABORT("Zone pages at 0x%p are outside of the zone map", p);
+    }
+
+    const uintptr_t last = ZONE_MAP_UNIT(p + size - 1);
+
+    for(uintptr_t unit = ZONE_MAP_UNIT(p); unit <= last; unit++) {
+        zone_map_entry_t **node = zone_map[ZONE_MAP_ROOT_INDEX(unit)];
+
+        if(node == NULL) {
+            node = mmap_rw_pages(ZONE_MAP_NODE_SZ, false, NULL);
+            __atomic_store_n(&zone_map[ZONE_MAP_ROOT_INDEX(unit)], node, __ATOMIC_RELEASE);
+        }
+
+        zone_map_entry_t *leaf = node[ZONE_MAP_NODE_INDEX(unit)];
+
+        if(leaf == NULL) {
+            leaf = mmap_rw_pages(ZONE_MAP_LEAF_SZ, true, NULL);
+            __atomic_store_n(&node[ZONE_MAP_NODE_INDEX(unit)], leaf, __ATOMIC_RELEASE);
+        }
+
+        __atomic_store_n(&leaf[ZONE_MAP_LEAF_INDEX(unit)], entry, __ATOMIC_RELEASE);
+    }
+#endif
+}
+
+/* iso_find_zone_bitmap_range and iso_find_zone_range are
+ * logically identical functions that both return a zone
+ * for a pointer. The only difference is where the pointer
+ * addresses, a bitmap or user pages */
+INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_bitmap_range(const void *restrict p) {
+    iso_alloc_zone_t *zone = zone_map_get(p);
+
+    if(UNLIKELY(zone == NULL)) {
+        return NULL;
+    }
+
+    void *bitmap_start = UNMASK_BITMAP_PTR(zone);
+
+    if(LIKELY(bitmap_start <= p && (bitmap_start + zone->bitmap_size) > p)) {
+        return zone;
+    }
+
+    return NULL;
+}
+
+/* Returns true if chunk p is within the user pages
+ * of zone. Requires the zone is locked because the
+ * zone pointers are unmasked in place by its owner */
+INTERNAL_HIDDEN INLINE bool iso_zone_holds_chunk(iso_alloc_zone_t *zone, const void *restrict p) {
+    void *user_pages_start = UNMASK_USER_PTR(zone);
+    return (user_pages_start <= p && (user_pages_start + ZONE_USER_SZ(zone)) > p);
+}
+
+/* Returns the zone that holds chunk p with its lock
+ * held or NULL. This doesn't require the root lock */
+INTERNAL_HIDDEN iso_alloc_zone_t *iso_lock_zone_range(const void *restrict p) {
+    iso_alloc_zone_t *zone = zone_map_get(p);
+
+    if(UNLIKELY(zone == NULL)) {
+        return NULL;
+    }
+
+    LOCK_ZONE(zone);
+
+    if(LIKELY(iso_zone_holds_chunk(zone, p))) {
+        return zone;
+    }
+
+    UNLOCK_ZONE(zone);
+    return NULL;
+}
+
+/* Requires the root is locked. The zone returned is
+ * not locked but it cannot be destroyed or replaced
+ * until the caller releases the root lock */
+INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_range(const void *restrict p) {
+    iso_alloc_zone_t *zone = iso_lock_zone_range(p);
+
+    if(LIKELY(zone != NULL)) {
+        UNLOCK_ZONE(zone);
+    }
+
+    return zone;
+}
+
+/* Checking canaries under ASAN mode is not trivial. ASAN
+ * provides a strong guarantee that these chunks haven't
+ * been modified in some way */
+#if ENABLE_ASAN || DISABLE_CANARY
+INTERNAL_HIDDEN INLINE void check_big_canary(iso_alloc_big_zone_t *big) {
+    return;
+}
+
+INTERNAL_HIDDEN INLINE void write_canary(iso_alloc_zone_t *zone, const void *p) {
+    return;
+}
+
+/* Verify the canary value in an allocation */
+INTERNAL_HIDDEN INLINE void check_canary(iso_alloc_zone_t *zone, const void *p) {
+    return;
+}
+
+INTERNAL_HIDDEN int64_t check_canary_no_abort(iso_alloc_zone_t *zone, const void *p) {
+    return OK;
+}
+#else
+/* Verifies both canaries in a big zone structure. This
+ * is a fast operation so we call it anytime we iterate
+ * through the linked list of big zones */
+INTERNAL_HIDDEN INLINE void check_big_canary(iso_alloc_big_zone_t *big) {
+    const uint64_t canary = ((uint64_t) big ^ __builtin_bswap64((uint64_t) big->user_pages_start) ^ _root->big_zone_canary_secret);
+
+    if(UNLIKELY(big->canary_a != canary)) {
+        LOG_AND_ABORT("Big zone 0x%p bottom canary has been corrupted! Value: 0x%x Expected: 0x%x", big, big->canary_a, canary);
+    }
+
+    if(UNLIKELY(big->canary_b != canary)) {
+        LOG_AND_ABORT("Big zone 0x%p top canary has been corrupted! Value: 0x%x Expected: 0x%x", big, big->canary_a, canary);
+    }
+}
+
+/* All free chunks get a canary written at both
+ * the start and end of their chunks. These canaries
+ * are verified when adjacent chunks are allocated,
+ * freed, or when the API requests validation. We
+ * sacrifice the high byte in entropy to prevent
+ * unbounded string reads from leaking it */
+INTERNAL_HIDDEN INLINE void write_canary(iso_alloc_zone_t *zone, const void *p) {
+    const uint64_t canary = (zone->canary_secret ^ (uint64_t) p) & CANARY_VALIDATE_MASK;
+    *(uint64_t *) p = canary;
+    p += (zone->chunk_size - sizeof(uint64_t));
+    *(uint64_t *) p = canary;
+}
+
+/* Verify the canary value in an allocation. A canary
+ * on a page marked in the purge map was never written
+ * or was purged so it must be 0 */
+INTERNAL_HIDDEN INLINE void check_canary(iso_alloc_zone_t *zone, const void *p) {
+    uint64_t v = *((uint64_t *) p);
+    const uint64_t canary = (zone->canary_secret ^ (uint64_t) p) & CANARY_VALIDATE_MASK;
+    uint64_t expected = CANARY_PAGE_MARKED(zone, p) ? 0 : canary;
+
+    if(UNLIKELY(v != expected)) {
+        LOG_AND_ABORT("Canary at beginning of chunk 0x%p in zone[%d][%d byte chunks] has been corrupted! Value: 0x%x Expected: 0x%x",
+                      p, zone->index, zone->chunk_size, v, expected);
+    }
+
+    const void *end = p + zone->chunk_size - sizeof(uint64_t);
+    v = *((uint64_t *) end);
+    expected = CANARY_PAGE_MARKED(zone, end) ? 0 : canary;
+
+    if(UNLIKELY(v != expected)) {
+        LOG_AND_ABORT("Canary at end of chunk 0x%p in zone[%d][%d byte chunks] has been corrupted! Value: 0x%x Expected: 0x%x",
+                      p, zone->index, zone->chunk_size, v, expected);
+    }
+}
+
+INTERNAL_HIDDEN int64_t check_canary_no_abort(iso_alloc_zone_t *zone, const void *p) {
+    uint64_t v = *((uint64_t *) p);
+    const uint64_t canary = (zone->canary_secret ^ (uint64_t) p) & CANARY_VALIDATE_MASK;
+    uint64_t expected = CANARY_PAGE_MARKED(zone, p) ? 0 : canary;
+
+    if(UNLIKELY(v != expected)) {
+        LOG("Canary at beginning of chunk 0x%p in zone[%d] has been corrupted! Value: 0x%x Expected: 0x%x", p, zone->index, v, expected);
+        return ERR;
+    }
+
+    const void *end = p + zone->chunk_size - sizeof(uint64_t);
+    v = *((uint64_t *) end);
+    expected = CANARY_PAGE_MARKED(zone, end) ? 0 : canary;
+
+    if(UNLIKELY(v != expected)) {
+        LOG("Canary at end of chunk 0x%p in zone[%d] has been corrupted! Value: 0x%x Expected: 0x%x", p, zone->index, v, expected);
+        return ERR;
+    }
+
+    return OK;
+}
+#endif
+
+/* The purge map of a zone marks the user pages that have
+ * no canaries on them. That is every page of a new zone,
+ * canaries are only written to a page right before one of
+ * its chunks is allocated, and with PAGE_PURGING every page
+ * given back to the kernel. Zone verification skips chunks
+ * that touch a marked page and the canaries are written
+ * again, and the page is unmarked, before any chunk on it
+ * is allocated */
+
+/* Chunks described by each bitmap qword */
+#define CHUNKS_PER_BITMAP_QWORD (BITS_PER_QWORD / BITS_PER_CHUNK)
+
+/* Requires the zone is locked. Clears the purge map of
+ * a zone whose user pages have all been wiped */
+INTERNAL_HIDDEN void reset_purge_map(iso_alloc_zone_t *zone) {
+    memset(GET_PURGE_MAP_PTR(zone, zone->bitmap_start), 0x0, GET_PURGE_MAP_SIZE(zone));
+    zone->purged_pages = 0;
+#if PAGE_PURGING
+    zone->purge_freed = 0;
+#endif
+}
+
+/* Returns true if any page chunk overlaps is purged */
+INTERNAL_HIDDEN bool chunk_is_purged(iso_alloc_zone_t *zone, const bitmap_index_t *bm, uint64_t chunk) {
+    const uint64_t *purged = GET_PURGE_MAP_PTR(zone, bm);
+    const uint64_t start = chunk * zone->chunk_size;
+    const uint64_t last = (start + zone->chunk_size - 1) / _root->system_page_size;
+
+    for(uint64_t page = start / _root->system_page_size; page <= last; page++) {
+        if(PURGE_MAP_GET(purged, page) == 1) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Requires the zone is locked and its pointers are
+ * unmasked. Writes the canaries of every free chunk
+ * and canary chunk that overlaps a marked page. They
+ * are checked first so a write to the page while it
+ * was marked is caught. A canary on another page that
+ * is still marked is left for when that page is */
+INTERNAL_HIDDEN void unpurge_page(iso_alloc_zone_t *zone, const bitmap_index_t *bm, uint64_t *purged, uint64_t page) {
+    const uint64_t chunk_count = GET_CHUNK_COUNT(zone);
+    const uint64_t first = (page * _root->system_page_size) / zone->chunk_size;
+    uint64_t last = (((page + 1) * _root->system_page_size) - 1) / zone->chunk_size;
+
+    if(last >= chunk_count) {
+        last = chunk_count - 1;
+    }
+
+    for(uint64_t c = first; c <= last; c++) {
+        const bit_slot_t bit_slot = c << BITS_PER_CHUNK_SHIFT;
+
+        if((GET_BIT(bm[bit_slot >> BITS_PER_QWORD_SHIFT], (WHICH_BIT(bit_slot) + 1))) == 1) {
+            check_canary(zone, zone->user_pages_start + (c * zone->chunk_size));
+        }
+    }
+
+    PURGE_MAP_UNSET(purged, page);
+    zone->purged_pages--;
+
+#if CONTIGUOUS_ZONES && __linux__ && HUGE_PAGES && MADV_HUGEPAGE
+    if(zone->purged_pages == 0) {
+        madvise(zone->user_pages_start, ZONE_USER_SZ(zone), MADV_HUGEPAGE);
+    }
+#endif
+
+#if !ENABLE_ASAN && !DISABLE_CANARY
+    for(uint64_t c = first; c <= last; c++) {
+        const bit_slot_t bit_slot = c << BITS_PER_CHUNK_SHIFT;
+
+        if((GET_BIT(bm[bit_slot >> BITS_PER_QWORD_SHIFT], (WHICH_BIT(bit_slot) + 1))) == 1) {
+            void *p = zone->user_pages_start + (c * zone->chunk_size);
+            void *end = p + zone->chunk_size - sizeof(uint64_t);
+            const uint64_t canary = (zone->canary_secret ^ (uint64_t) p) & CANARY_VALIDATE_MASK;
+
+            if(CANARY_PAGE_MARKED(zone, p) == false) {
+                *(uint64_t *) p = canary;
+            }
+
+            if(CANARY_PAGE_MARKED(zone, end) == false) {
+                *(uint64_t *) end = canary;
+            }
+        }
+    }
+#endif
+}
+
+/* Requires the zone is locked and its pointers are
+ * unmasked. Restores every purged page chunk overlaps */
+INTERNAL_HIDDEN void unpurge_chunk(iso_alloc_zone_t *zone, const bitmap_index_t *bm, uint64_t chunk) {
+    uint64_t *purged = GET_PURGE_MAP_PTR(zone, bm);
+    const uint64_t start = chunk * zone->chunk_size;
+    const uint64_t last = (start + zone->chunk_size - 1) / _root->system_page_size;
+
+    for(uint64_t page = start / _root->system_page_size; page <= last; page++) {
+        if(PURGE_MAP_GET(purged, page) == 1) {
+            unpurge_page(zone, bm, purged, page);
+        }
+    }
+}
+
+/* Requires the zone is locked and its pointers are
+ * unmasked. Clears size bytes at p except on pages that
+ * are marked in the purge map, those read back as zero */
+INTERNAL_HIDDEN void clear_unpurged(iso_alloc_zone_t *zone, const bitmap_index_t *bm, void *p, size_t size) {
+    const uint64_t *purged = GET_PURGE_MAP_PTR(zone, bm);
+    const uint64_t page_size = _root->system_page_size;
+    uint64_t start = p - zone->user_pages_start;
+    const uint64_t end = start + size;
+
+    while(start < end) {
+        const uint64_t page = start / page_size;
+        uint64_t next = (page + 1) * page_size;
+
+        if(next > end) {
+            next = end;
+        }
+
+        if(PURGE_MAP_GET(purged, page) == 0) {
+            memset(zone->user_pages_start + start, 0x0, next - start);
+        }
+
+        start = next;
+    }
+}
+
+#if PAGE_PURGING
+/* A user page of a zone can be given back to the kernel
+ * when none of the chunks that overlap it are in use. The
+ * page is then marked in the purge map of the zone. Purged
+ * pages read back as zero so every canary on them is gone */
+
+/* Requires the zone is locked and its pointers are
+ * unmasked. Returns true if none of the chunks that
+ * overlap page are in use. A chunk is in use if its
+ * bits are 10, or 11 without a valid canary because
+ * a canary chunk and a reused chunk look the same */
+INTERNAL_HIDDEN bool purge_page_is_free(iso_alloc_zone_t *zone, const bitmap_index_t *bm, uint64_t page) {
+    const uint64_t chunk_count = GET_CHUNK_COUNT(zone);
+    const uint64_t first = (page * _root->system_page_size) / zone->chunk_size;
+    uint64_t last = (((page + 1) * _root->system_page_size) - 1) / zone->chunk_size;
+
+    if(first >= chunk_count) {
+        return true;
+    }
+
+    if(last >= chunk_count) {
+        last = chunk_count - 1;
+    }
+
+    for(uint64_t c = first; c <= last;) {
+        const uint64_t i = c / CHUNKS_PER_BITMAP_QWORD;
+        const uint64_t qword_last = (i * CHUNKS_PER_BITMAP_QWORD) + CHUNKS_PER_BITMAP_QWORD - 1;
+        const uint64_t end = (last < qword_last) ? last : qword_last;
+        const uint64_t bits = (end - c + 1) << BITS_PER_CHUNK_SHIFT;
+        const uint64_t range = (bits == BITS_PER_QWORD) ? ~0ULL : (((1ULL << bits) - 1) << ((c % CHUNKS_PER_BITMAP_QWORD) << BITS_PER_CHUNK_SHIFT));
+        const uint64_t b = (uint64_t) bm[i];
+        uint64_t in_use = b & range & ALLOCATED_BITSLOTS;
+
+        /* Any chunk in state 10 is in use */
+        if((in_use & ~(b >> 1)) != 0) {
+            return false;
+        }
+
+        while(in_use != 0) {
+            const uint64_t chunk = (i * CHUNKS_PER_BITMAP_QWORD) + (__builtin_ctzll(in_use) >> BITS_PER_CHUNK_SHIFT);
+
+            /* A chunk can't be allocated while it touches a
+             * purged page so this one is a canary chunk */
+            if(chunk_is_purged(zone, bm, chunk) == false) {
+#if !ENABLE_ASAN && !DISABLE_CANARY
+                const void *p = zone->user_pages_start + (chunk * zone->chunk_size);
+                const uint64_t canary = (zone->canary_secret ^ (uint64_t) p) & CANARY_VALIDATE_MASK;
+
+                if(*(uint64_t *) p != canary || *(uint64_t *) (p + zone->chunk_size - sizeof(uint64_t)) != canary) {
+                    return false;
+                }
+#else
+                return false;
+#endif
+            }
+
+            in_use &= in_use - 1;
+        }
+
+        c = end + 1;
+    }
+
+    return true;
+}
+
+/* Requires the zone is locked and its pointers are
+ * unmasked. Purges every page with no chunks in use
+ * and returns the number of bytes given back */
+INTERNAL_HIDDEN size_t purge_zone_pages(iso_alloc_zone_t *zone) {
+    const bitmap_index_t *bm = (bitmap_index_t *) zone->bitmap_start;
+    uint64_t *purged = GET_PURGE_MAP_PTR(zone, bm);
+    const uint64_t page_size = _root->system_page_size;
+    const uint64_t pages = ZONE_USER_SZ(zone) / page_size;
+    size_t released = 0;
+    int64_t run = -1;
+
+    zone->purge_freed = 0;
+
+    /* Contiguous free pages are purged with a single
+     * madvise. The last iteration flushes any run */
+    for(uint64_t page = 0; page <= pages; page++) {
+        if(page < pages && PURGE_MAP_GET(purged, page) == 0 && purge_page_is_free(zone, bm, page) == true) {
+            if(run < 0) {
+                run = page;
+            }
+
+            continue;
+        }
+
+        if(run < 0) {
+            continue;
+        }
+
+        madvise(zone->user_pages_start + (run * page_size), (page - run) * page_size, MADV_DONTNEED);
+
+        for(uint64_t i = run; i < page; i++) {
+            PURGE_MAP_SET(purged, i);
+        }
+
+        zone->purged_pages += (page - run);
+        released += (page - run) * page_size;
+        run = -1;
+    }
+
+    return released;
+}
+
+/* Purges the free pages of every zone that has had
+ * chunks free'd since it was last purged. Returns the
+ * number of bytes given back */
+INTERNAL_HIDDEN size_t purge_all_zones(void) {
+    size_t released = 0;
+
+    LOCK_ROOT();
+
+    for(int32_t i = 0; i < _root->zones_used; i++) {
+        iso_alloc_zone_t *zone = &_root->zones[i];
+        LOCK_ZONE(zone);
+
+        if(zone->bitmap_start == NULL || zone->user_pages_start == NULL) {
+            UNLOCK_ZONE(zone);
+            break;
+        }
+
+        if(zone->purge_freed != 0) {
+            UNMASK_ZONE_PTRS(zone);
+            released += purge_zone_pages(zone);
+            MASK_ZONE_PTRS(zone);
+        }
+
+        UNLOCK_ZONE(zone);
+    }
+
+    UNLOCK_ROOT();
+
+    return released;
+}
+#endif
+
+#if BACKGROUND_THREAD
+INTERNAL_HIDDEN void background_thread_start(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&background_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    background_stopping = false;
+
+    if(pthread_create(&background_thread, NULL, background_thread_main, NULL) != 0) {
+        LOG_AND_ABORT("Could not create the background thread");
+    }
+}
+
+INTERNAL_HIDDEN void background_thread_stop(void) {
+    /* The background thread runs the destructors if it
+     * was the last thread left when it returned */
+    if(pthread_equal(pthread_self(), background_thread)) {
+        return;
+    }
+
+    pthread_mutex_lock(&background_mutex);
+    background_stopping = true;
+    pthread_cond_signal(&background_cond);
+    pthread_mutex_unlock(&background_mutex);
+
+    pthread_join(background_thread, NULL);
+}
+
+/* Forking while the background thread is in the middle
+ * of a tick could leave the child with a zone or big zone
+ * lock it can never take. The child doesn't inherit the
+ * thread so it starts its own */
+INTERNAL_HIDDEN void background_fork_prepare(void) {
+    pthread_mutex_lock(&background_mutex);
+}
+
+INTERNAL_HIDDEN void background_fork_parent(void) {
+    pthread_mutex_unlock(&background_mutex);
+}
+
+INTERNAL_HIDDEN void background_fork_child(void) {
+    pthread_mutex_init(&background_mutex, NULL);
+    background_thread_start();
+}
+
+/* A process whose main thread calls pthread_exit() only
+ * exits when all of its other threads have, so we stop
+ * once there are no other threads left */
+INTERNAL_HIDDEN bool background_last_thread(void) {
+#if __linux__
+    char buf[512];
+    int fd = open("/proc/self/stat", O_RDONLY | O_CLOEXEC);
+
+    if(fd < 0) {
+        return false;
+    }
+
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+
+    if(len <= 0) {
+        return false;
+    }
+
+    buf[len] = '\0';
+
+    /* The state of the main thread and the thread count
+     * are the 1st and 18th fields after the command name,
+     * which may itself contain spaces */
+    char *p = strrchr(buf, ')');
+
+    if(p == NULL || p[1] == '\0') {
+        return false;
+    }
+
+    const bool main_exited = (p[2] == 'Z');
+
+    for(int32_t field = 0; p != NULL && field < 18; field++) {
+        p = strchr(p + 1, ' ');
+    }
+
+    if(p == NULL) {
+        return false;
+    }
+
+    /* An exited main thread is counted until the process exits */
+    const long threads = strtol(p + 1, NULL, 10);
+    return threads == 1 || (threads == 2 && main_exited == true);
+#else
+    return false;
+#endif
+}
+
+INTERNAL_HIDDEN void *background_thread_main(void *unused) {
+    struct timespec next;
+
+    pthread_mutex_lock(&background_mutex);
+
+    while(background_stopping == false) {
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        next.tv_nsec += BACKGROUND_TICK_MS * 1000000L;
+        next.tv_sec += next.tv_nsec / 1000000000L;
+        next.tv_nsec %= 1000000000L;
+
+        /* Only background_thread_stop() wakes us up early */
+        while(background_stopping == false) {
+            if(pthread_cond_timedwait(&background_cond, &background_mutex, &next) == ETIMEDOUT) {
+                break;
+            }
+        }
+
+        if(background_stopping == true || background_last_thread() == true) {
+            break;
+        }
+
+        background_tick();
+    }
+
+    pthread_mutex_unlock(&background_mutex);
+    return NULL;
+}
+
+/* Requires the zone is locked. Returns true if the zone
+ * is at least ZONE_PRECREATE_PERCENT full */
+INTERNAL_HIDDEN bool zone_nearly_full(iso_alloc_zone_t *zone) {
+    return zone->is_full == true ||
+           ((uint64_t) zone->af_count * 100) >= ((uint64_t) GET_CHUNK_COUNT(zone) * ZONE_PRECREATE_PERCENT);
+}
+
+/* Requires the root is locked. Creates a new zone for
+ * size unless one of the zones that hold it still has
+ * room, so the next allocation doesn't have to */
+INTERNAL_HIDDEN void zone_precreate(uint32_t size) {
+    for(uint32_t i = zone_lookup_table[size]; i != 0 && i < _root->zones_used;) {
+        iso_alloc_zone_t *zone = &_root->zones[i];
+        LOCK_ZONE(zone);
+        bool full = zone_nearly_full(zone);
+#if THREAD_ZONES
+        /* Only the owner can allocate from thread zones */
+        full |= (zone->owner != 0);
+#endif
+        i = zone->next_sz_index;
+        UNLOCK_ZONE(zone);
+
+        if(full == false) {
+            return;
+        }
+    }
+
+    _iso_new_zone(size, true);
+}
+
+/* Requires the background mutex. Each zone is visited
+ * holding only its own lock so the request path is only
+ * ever blocked on the zone being worked on. Retiring and
+ * creating zones needs the root lock so candidates for
+ * both are collected and handled at the end */
+INTERNAL_HIDDEN void background_tick(void) {
+    const uint32_t epoch = __atomic_add_fetch(&background_epoch, 1, __ATOMIC_RELAXED);
+    uint32_t retire[BACKGROUND_BATCH_SZ];
+    uint32_t precreate[BACKGROUND_BATCH_SZ];
+    int32_t retire_count = 0;
+    int32_t precreate_count = 0;
+
+    /* Zones below zones_used are fully initialized and
+     * the zone table never moves as it grows */
+    LOCK_ROOT();
+    const uint32_t zones_used = _root->zones_used;
+    UNLOCK_ROOT();
+
+    for(uint32_t i = 0; i < zones_used; i++) {
+        iso_alloc_zone_t *zone = &_root->zones[i];
+        LOCK_ZONE(zone);
+
+        if(zone->bitmap_start == NULL || zone->user_pages_start == NULL) {
+            UNLOCK_ZONE(zone);
+            continue;
+        }
+
+#if THREAD_ZONES
+        /* The owner of a thread zone changes it in place
+         * without taking the zone lock */
+        if(zone->owner != 0) {
+            UNLOCK_ZONE(zone);
+            continue;
+        }
+#endif
+
+        const bool hot = (zone->alloc_count != zone->background_alloc_count);
+        zone->background_alloc_count = zone->alloc_count;
+
+#if PAGE_PURGING
+        if(zone->purge_freed != 0 && (uint32_t) (epoch - zone->purge_epoch) >= BACKGROUND_DECAY_TICKS) {
+            UNMASK_ZONE_PTRS(zone);
+            purge_zone_pages(zone);
+            MASK_ZONE_PTRS(zone);
+        }
+#endif
+
+        /* Refill the free bit slot cache of zones that are
+         * being allocated from before it runs dry. This is
+         * only safe when no bit slot has been taken out of
+         * the cache ahead of time */
+        if(hot == true && zone->is_full == false && zone->released == false && zone->next_free_bit_slot == BAD_BIT_SLOT &&
+           (zone->free_bit_slot_cache_index - zone->free_bit_slot_cache_usable) < (BIT_SLOT_CACHE_SZ >> 2)) {
+            UNMASK_ZONE_PTRS(zone);
+            fill_free_bit_slot_cache(zone);
+            MASK_ZONE_PTRS(zone);
+        }
+
+        if(_is_zone_retired(zone) == true && retire_count < BACKGROUND_BATCH_SZ) {
+            retire[retire_count++] = i;
+        }
+
+        if(hot == true && zone->internal == true && zone->chunk_size <= SMALL_SZ_MAX && zone_nearly_full(zone) == true) {
+            int32_t j = 0;
+
+            while(j < precreate_count && precreate[j] != zone->chunk_size) {
+                j++;
+            }
+
+            if(j == precreate_count && precreate_count < BACKGROUND_BATCH_SZ) {
+                precreate[precreate_count++] = zone->chunk_size;
+            }
+        }
+
+        UNLOCK_ZONE(zone);
+    }
+
+    if(retire_count != 0 || precreate_count != 0) {
+        LOCK_ROOT();
+
+        /* The zones may have been used since we looked */
+        for(int32_t i = 0; i < retire_count; i++) {
+            iso_alloc_zone_t *zone = &_root->zones[retire[i]];
+            LOCK_ZONE(zone);
+
+            if(_is_zone_retired(zone) == true) {
+                _iso_alloc_destroy_zone_unlocked(zone, true);
+            }
 
-/* Verify the canary value in an allocation */
-INTERNAL_HIDDEN INLINE void check_canary(iso_alloc_zone_t *zone, const void *p) {
-    return;
-}
+            UNLOCK_ZONE(zone);
+        }
 
-INTERNAL_HIDDEN int64_t check_canary_no_abort(iso_alloc_zone_t *zone, const void *p) {
-    return OK;
-}
-#else
-/* Verifies both canaries in a big zone structure. This
- * is a fast operation so we call it anytime we iterate
- * through the linked list of big zones */
-INTERNAL_HIDDEN INLINE void check_big_canary(iso_alloc_big_zone_t *big) {
-    const uint64_t canary = ((uint64_t) big ^ __builtin_bswap64((uint64_t) big->user_pages_start) ^ _root->big_zone_canary_secret);
+        for(int32_t i = 0; i < precreate_count; i++) {
+            zone_precreate(precreate[i]);
+        }
 
-    if(UNLIKELY(big->canary_a != canary)) {
-        LOG_AND_ABORT("Big zone 0x%p bottom canary has been corrupted! Value: 0x%x Expected: 0x%x", big, big->canary_a, canary);
+        UNLOCK_ROOT();
     }
 
-    if(UNLIKELY(big->canary_b != canary)) {
-        LOG_AND_ABORT("Big zone 0x%p top canary has been corrupted! Value: 0x%x Expected: 0x%x", big, big->canary_a, canary);
-    }
+    background_purge_big_zones(epoch);
 }
 
-/* All free chunks get a canary written at both
- * the start and end of their chunks. These canaries
- * are verified when adjacent chunks are allocated,
- * freed, or when the API requests validation. We
- * sacrifice the high byte in entropy to prevent
- * unbounded string reads from leaking it */
-INTERNAL_HIDDEN INLINE void write_canary(iso_alloc_zone_t *zone, const void *p) {
-    const uint64_t canary = (zone->canary_secret ^ (uint64_t) p) & CANARY_VALIDATE_MASK;
-    *(uint64_t *) p = canary;
-    p += (zone->chunk_size - sizeof(uint64_t));
-    *(uint64_t *) p = canary;
-}
+/* Gives back the pages of big zones that have been free
+ * for BACKGROUND_DECAY_MS and unmaps the least recently
+ * freed while free big zones retain more than
+ * BIG_ZONE_RETAIN_SZ. The big zone lock is dropped for
+ * the madvise calls, the big zones being purged are off
+ * the free lists until they are done */
+INTERNAL_HIDDEN void background_purge_big_zones(uint32_t epoch) {
+    iso_alloc_big_zone_t *purge[BACKGROUND_BATCH_SZ];
+    int32_t purge_count = 0;
 
-/* Verify the canary value in an allocation */
-INTERNAL_HIDDEN INLINE void check_canary(iso_alloc_zone_t *zone, const void *p) {
-    uint64_t v = *((uint64_t *) p);
-    const uint64_t canary = (zone->canary_secret ^ (uint64_t) p) & CANARY_VALIDATE_MASK;
+    LOCK_BIG_ZONE();
+    big_zone_trim(BIG_ZONE_RETAIN_SZ);
 
-    if(UNLIKELY(v != canary)) {
-        LOG_AND_ABORT("Canary at beginning of chunk 0x%p in zone[%d][%d byte chunks] has been corrupted! Value: 0x%x Expected: 0x%x",
-                      p, zone->index, zone->chunk_size, v, canary);
-    }
+    /* The oldest free big zones are at the tail */
+    iso_alloc_big_zone_t *big = (_root->big_zone_lru_tail != NULL) ? UNMASK_BIG_ZONE_NEXT(_root->big_zone_lru_tail) : NULL;
 
-    v = *((uint64_t *) (p + zone->chunk_size - sizeof(uint64_t)));
+    while(big != NULL && purge_count < BACKGROUND_BATCH_SZ) {
+        check_big_canary(big);
 
-    if(UNLIKELY(v != canary)) {
-        LOG_AND_ABORT("Canary at end of chunk 0x%p in zone[%d][%d byte chunks] has been corrupted! Value: 0x%x Expected: 0x%x",
-                      p, zone->index, zone->chunk_size, v, canary);
+        if((uint32_t) (epoch - big->free_epoch) < BACKGROUND_DECAY_TICKS) {
+            break;
+        }
+
+        iso_alloc_big_zone_t *newer = (big->lru_prev != NULL) ? UNMASK_BIG_ZONE_NEXT(big->lru_prev) : NULL;
+
+        if(big->dirty == true) {
+            big_zone_free_remove(big);
+            purge[purge_count++] = big;
+        }
+
+        big = newer;
     }
-}
 
-INTERNAL_HIDDEN int64_t check_canary_no_abort(iso_alloc_zone_t *zone, const void *p) {
-    uint64_t v = *((uint64_t *) p);
-    const uint64_t canary = (zone->canary_secret ^ (uint64_t) p) & CANARY_VALIDATE_MASK;
+    UNLOCK_BIG_ZONE();
 
-    if(UNLIKELY(v != canary)) {
-        LOG("Canary at beginning of chunk 0x%p in zone[%d] has been corrupted! Value: 0x%x Expected: 0x%x", p, zone->index, v, canary);
-        return ERR;
+    if(purge_count == 0) {
+        return;
+    }
+
+    for(int32_t i = 0; i < purge_count; i++) {
+        madvise(purge[i]->user_pages_start, purge[i]->size, MADV_DONTNEED);
     }
 
-    v = *((uint64_t *) (p + zone->chunk_size - sizeof(uint64_t)));
+    LOCK_BIG_ZONE();
 
-    if(UNLIKELY(v != canary)) {
-        LOG("Canary at end of chunk 0x%p in zone[%d] has been corrupted! Value: 0x%x Expected: 0x%x", p, zone->index, v, canary);
-        return ERR;
+    for(int32_t i = 0; i < purge_count; i++) {
+        purge[i]->dirty = false;
+        big_zone_free_insert(purge[i]);
     }
 
-    return OK;
+    UNLOCK_BIG_ZONE();
 }
 #endif
 
@@ -1664,44 +3658,38 @@ INTERNAL_HIDDEN void iso_free_big_zone(iso_alloc_big_zone_t *big_zone, bool perm
     memset(big_zone->user_pages_start, POISON_BYTE, big_zone->size);
 #endif
 
+#if BACKGROUND_THREAD
+    if(UNLIKELY(permanent == true)) {
+        madvise(big_zone->user_pages_start, big_zone->size, MADV_DONTNEED);
+    }
+#else
     madvise(big_zone->user_pages_start, big_zone->size, MADV_DONTNEED);
+#endif
 
     /* If this isn't a permanent free then all we need
      * to do is sanitize the mapping and mark it free.
-     * The pages backing the big zone can be reused. */
+     * The pages backing the big zone can be reused
+     * until free big zones retain too many bytes */
     if(LIKELY(permanent == false)) {
         POISON_BIG_ZONE(big_zone);
         big_zone->free = true;
-    } else {
-        iso_alloc_big_zone_t *big = _root->big_zone_head;
-
-        if(big != NULL) {
-            big = UNMASK_BIG_ZONE_NEXT(_root->big_zone_head);
-        }
-
-        if(big == big_zone) {
-            _root->big_zone_head = NULL;
-        } else {
-            /* We need to remove this entry from the list */
-            while(big != NULL) {
-                check_big_canary(big);
-
-                if(UNMASK_BIG_ZONE_NEXT(big->next) == big_zone) {
-                    big->next = UNMASK_BIG_ZONE_NEXT(big_zone->next);
-                    break;
-                }
-
-                if(big->next != NULL) {
-                    big = UNMASK_BIG_ZONE_NEXT(big->next);
-                } else {
-                    big = NULL;
-                }
-            }
-        }
-
-        if(UNLIKELY(big == NULL)) {
-            LOG_AND_ABORT("The big zone list has been corrupted, unable to find big zone 0x%p", big_zone);
+#if BACKGROUND_THREAD
+        /* The background thread gives the pages back and
+         * trims free big zones. We only trim here if it
+         * has fallen far behind */
+        big_zone->dirty = true;
+        big_zone_free_insert(big_zone);
+
+        if(UNLIKELY(_root->big_zone_free_bytes > (BIG_ZONE_RETAIN_SZ << 1))) {
+            big_zone_trim(BIG_ZONE_RETAIN_SZ);
         }
+#else
+        big_zone_free_insert(big_zone);
+        big_zone_trim(BIG_ZONE_RETAIN_SZ);
+#endif
+    } else {
+        big_zone_list_remove(big_zone);
+        big_zone_index_remove(big_zone);
 
         mprotect_pages(big_zone->user_pages_start, big_zone->size, PROT_NONE);
         memset(big_zone, POISON_BYTE, sizeof(iso_alloc_big_zone_t));
@@ -1721,17 +3709,18 @@ INTERNAL_HIDDEN void iso_free_chunk_from_zone(iso_alloc_zone_t *zone, void *rest
 
     const uint64_t chunk_offset = (uint64_t) (p - UNMASK_USER_PTR(zone));
 
+    const size_t chunk_number = GET_CHUNK_NUMBER(zone, chunk_offset);
+
     /* Ensure the pointer is a multiple of chunk size */
-    if(UNLIKELY((chunk_offset & (zone->chunk_size - 1)) != 0)) {
+    if(UNLIKELY((chunk_number * zone->chunk_size) != chunk_offset)) {
         LOG_AND_ABORT("Chunk at 0x%p is not a multiple of zone[%d] chunk size %d. Off by %lu bits",
-                      p, zone->index, zone->chunk_size, (chunk_offset & (zone->chunk_size - 1)));
+                      p, zone->index, zone->chunk_size, (chunk_offset - (chunk_number * zone->chunk_size)));
     }
 
-    const size_t chunk_number = (chunk_offset / zone->chunk_size);
     const bit_slot_t bit_slot = (chunk_number << BITS_PER_CHUNK_SHIFT);
     const bit_slot_t dwords_to_bit_slot = (bit_slot >> BITS_PER_QWORD_SHIFT);
 
-    if(UNLIKELY(dwords_to_bit_slot > (zone->bitmap_size >> 3))) {
+    if(UNLIKELY(dwords_to_bit_slot >= GET_MAX_BITMASK_INDEX(zone))) {
         LOG_AND_ABORT("Cannot calculate this chunks location in the bitmap 0x%p", p);
     }
 
@@ -1762,7 +3751,9 @@ INTERNAL_HIDDEN void iso_free_chunk_from_zone(iso_alloc_zone_t *zone, void *rest
      * means this chunk will be marked as if it is a canary */
     if(LIKELY(permanent == false)) {
         UNSET_BIT(b, which_bit);
-        insert_free_bit_slot(zone, bit_slot);
+        bitmap_index_t *summary = GET_SUMMARY_PTR(zone, bm);
+        SET_BIT(summary[dwords_to_bit_slot >> BITS_PER_QWORD_SHIFT], (dwords_to_bit_slot & (BITS_PER_QWORD - 1)));
+        insert_free_bit_slot(zone, bm, bit_slot);
         zone->is_full = false;
 #if !ENABLE_ASAN && SANITIZE_CHUNKS
         iso_clear_user_chunk(p, zone->chunk_size);
@@ -1782,6 +3773,10 @@ INTERNAL_HIDDEN void iso_free_chunk_from_zone(iso_alloc_zone_t *zone, void *rest
 #if !ENABLE_ASAN && !DISABLE_CANARY
     write_canary(zone, p);
 
+    /* A neighbor on a page with no canaries is checked
+     * against the purge map which needs the pointers */
+    UNMASK_ZONE_PTRS(zone);
+
     if((chunk_number + 1) != GET_CHUNK_COUNT(zone)) {
         const bit_slot_t bit_slot_over = ((chunk_number + 1) << BITS_PER_CHUNK_SHIFT);
         if((GET_BIT(bm[(bit_slot_over >> BITS_PER_QWORD_SHIFT)], (WHICH_BIT(bit_slot_over) + 1))) == 1) {
@@ -1795,6 +3790,26 @@ INTERNAL_HIDDEN void iso_free_chunk_from_zone(iso_alloc_zone_t *zone, void *rest
             check_canary(zone, p - zone->chunk_size);
         }
     }
+
+    MASK_ZONE_PTRS(zone);
+#endif
+
+#if PAGE_PURGING && BACKGROUND_THREAD
+    /* The background thread purges this zone once it has
+     * had free pages for BACKGROUND_DECAY_MS */
+    if(zone->purge_freed == 0) {
+        zone->purge_epoch = __atomic_load_n(&background_epoch, __ATOMIC_RELAXED);
+    }
+
+    zone->purge_freed += zone->chunk_size;
+#elif PAGE_PURGING
+    zone->purge_freed += zone->chunk_size;
+
+    if(UNLIKELY(zone->purge_freed >= ZONE_PURGE_THRESHOLD)) {
+        UNMASK_ZONE_PTRS(zone);
+        purge_zone_pages(zone);
+        MASK_ZONE_PTRS(zone);
+    }
 #endif
 
     POISON_ZONE_CHUNK(zone, p);
@@ -1873,10 +3888,7 @@ INTERNAL_HIDDEN void _iso_free(void *p, bool permanent) {
         chunk_quarantine_count++;
         return;
     } else {
-        for(int64_t i = 0; i < chunk_quarantine_count; i++) {
-            _iso_free_internal((void *) chunk_quarantine[i], false);
-        }
-
+        _iso_free_chunks((void **) chunk_quarantine, chunk_quarantine_count);
         clear_chunk_quarantine();
         chunk_quarantine[chunk_quarantine_count] = (uintptr_t) p;
         chunk_quarantine_count++;
@@ -1907,7 +3919,7 @@ INTERNAL_HIDDEN void _iso_free_size(void *p, size_t size) {
     }
 #endif
 
-    if(UNLIKELY(size > SMALL_SZ_MAX)) {
+    if(UNLIKELY(size > ZONE_SZ_MAX)) {
         iso_alloc_big_zone_t *big_zone = iso_find_big_zone(p);
 
         if(UNLIKELY(big_zone == NULL)) {
@@ -1918,12 +3930,43 @@ INTERNAL_HIDDEN void _iso_free_size(void *p, size_t size) {
         return;
     }
 
+#if THREAD_ZONES && !FUZZ_MODE && !UAF_PTR_PAGE
+    if(_iso_remote_free(p, size) == true) {
+        return;
+    }
+#endif
+
+#if !FUZZ_MODE && !UAF_PTR_PAGE
+    iso_alloc_zone_t *zone = iso_lock_zone_range(p);
+
+    if(LIKELY(zone != NULL)) {
+        if(UNLIKELY(zone->chunk_size < size)) {
+            LOG_AND_ABORT("Invalid size (expected %d, got %d) for chunk 0x%p", zone->chunk_size, size, p);
+        }
+
+        _iso_free_from_locked_zone(zone, p, false);
+        return;
+    }
+#else
+    iso_alloc_zone_t *zone = NULL;
+#endif
+
     LOCK_ROOT();
 
-    iso_alloc_zone_t *zone = iso_find_zone_range(p);
+    zone = iso_find_zone_range(p);
 
+    /* A chunk aligned to more than a page is held by
+     * a big zone even if its size is not that big */
     if(UNLIKELY(zone == NULL)) {
-        LOG_AND_ABORT("Could not find zone for %p", p);
+        UNLOCK_ROOT();
+        iso_alloc_big_zone_t *big_zone = iso_find_big_zone(p);
+
+        if(UNLIKELY(big_zone == NULL)) {
+            LOG_AND_ABORT("Could not find zone for %p", p);
+        }
+
+        iso_free_big_zone(big_zone, false);
+        return;
     }
 
     /* We can't check for an exact size match because
@@ -1939,16 +3982,121 @@ INTERNAL_HIDDEN void _iso_free_size(void *p, size_t size) {
 }
 
 INTERNAL_HIDDEN void _iso_free_internal(void *p, bool permanent) {
+#if THREAD_ZONES && !FUZZ_MODE && !UAF_PTR_PAGE
+    /* Chunks leaving the quarantine that belong to a zone
+     * owned by another thread are handed to that thread */
+    if(permanent == false && _iso_remote_free(p, 0) == true) {
+        return;
+    }
+#endif
+
+    /* FUZZ_MODE and UAF_PTR_PAGE both need to search all
+     * zones upon free which requires the root lock */
+#if !FUZZ_MODE && !UAF_PTR_PAGE
+    iso_alloc_zone_t *zone = iso_lock_zone_range(p);
+
+    if(LIKELY(zone != NULL)) {
+        _iso_free_from_locked_zone(zone, p, permanent);
+        return;
+    }
+#endif
+
     LOCK_ROOT();
     _iso_free_internal_unlocked(p, permanent, NULL);
     UNLOCK_ROOT();
 }
 
+/* Frees n chunks. They are sorted by address first so
+ * the chunks of each zone are free'd together, in bitmap
+ * order, while holding its lock once. Doesn't require
+ * the root lock. The order of ptrs is not preserved */
+INTERNAL_HIDDEN void _iso_free_chunks(void **ptrs, size_t n) {
+#if FUZZ_MODE || UAF_PTR_PAGE
+    for(size_t i = 0; i < n; i++) {
+        _iso_free_internal(ptrs[i], false);
+    }
+#else
+    size_t count = 0;
+
+    for(size_t i = 0; i < n; i++) {
+        void *p = ptrs[i];
+
+#if THREAD_ZONES
+        /* Chunks that belong to a zone owned by another
+         * thread are handed to that thread */
+        if(_iso_remote_free(p, 0) == true) {
+            continue;
+        }
+#endif
+
+        /* The rest are compacted to the front while an
+         * insertion sort, cheap for the small and mostly
+         * ordered sets of chunks we get here, runs */
+        size_t j = count;
+
+        for(; j > 0 && ptrs[j - 1] > p; j--) {
+            ptrs[j] = ptrs[j - 1];
+        }
+
+        ptrs[j] = p;
+        count++;
+    }
+
+    iso_alloc_zone_t *zone = NULL;
+
+    for(size_t i = 0; i < count; i++) {
+        void *p = ptrs[i];
+
+        if(zone != NULL && iso_zone_holds_chunk(zone, p) == false) {
+            UNLOCK_ZONE(zone);
+            zone = NULL;
+        }
+
+        if(zone == NULL) {
+            zone = iso_lock_zone_range(p);
+
+            if(zone == NULL) {
+                _iso_free_internal(p, false);
+                continue;
+            }
+        }
+
+        /* A zone to retire has no chunks left in use so
+         * none of the remaining pointers can be in it */
+        if(UNLIKELY(_iso_free_chunk_locked(zone, p, false))) {
+            recycle_zone(zone);
+            UNLOCK_ZONE(zone);
+            zone = NULL;
+        }
+    }
+
+    if(zone != NULL) {
+        UNLOCK_ZONE(zone);
+    }
+#endif
+}
+
+/* Frees n chunks the same way a loop calling _iso_free
+ * would, the quarantine is flushed in batches */
+INTERNAL_HIDDEN void _iso_free_batch(void **ptrs, size_t n) {
+    for(size_t i = 0; i < n; i++) {
+        _iso_free(ptrs[i], false);
+    }
+}
+
 INTERNAL_HIDDEN bool _is_zone_retired(iso_alloc_zone_t *zone) {
     /* If the zone has no active allocations, holds smaller chunks,
      * and has allocated and freed more than ZONE_ALLOC_RETIRE
      * chunks in its lifetime then we destroy and replace it with
      * a new zone */
+#if THREAD_ZONES
+    /* Thread owned zones are retired once they are
+     * handed back to the shared pool */
+    if(zone->owner != 0) {
+        return false;
+    }
+#endif
+
     if(UNLIKELY(zone->af_count == 0 && zone->alloc_count > (GET_CHUNK_COUNT(zone) * ZONE_ALLOC_RETIRE))) {
         if(zone->internal == true && zone->chunk_size < (MAX_DEFAULT_ZONE_SZ * 2)) {
             return true;
@@ -1974,6 +4122,62 @@ INTERNAL_HIDDEN bool _refresh_zone_mem_tags(iso_alloc_zone_t *zone) {
     return false;
 }
 
+/* Frees a chunk from a zone the caller has locked and
+ * then unlocks it. A zone that needs to be retired is
+ * recycled without taking the root lock */
+INTERNAL_HIDDEN void _iso_free_from_locked_zone(iso_alloc_zone_t *zone, void *p, bool permanent) {
+    if(UNLIKELY(_iso_free_chunk_locked(zone, p, permanent))) {
+        recycle_zone(zone);
+    }
+
+    UNLOCK_ZONE(zone);
+}
+
+/* Frees a chunk and returns true if the zone it
+ * belongs to should be retired. Requires the zone
+ * is locked */
+INTERNAL_HIDDEN bool _iso_free_chunk_locked(iso_alloc_zone_t *zone, void *p, bool permanent) {
+    iso_free_chunk_from_zone(zone, p, permanent);
+
+#if MEMORY_TAGGING
+    /* If there are no chunks allocated but this zone has seen
+     * %25 of ZONE_ALLOC_RETIRE in allocations we wipe the pointer
+     * tags and start fresh. If the whole zone doesn't need to
+     * be refreshed then just generate a new tag for this chunk */
+    if(zone->tagged == true) {
+        if(_refresh_zone_mem_tags(zone) == false) {
+            /* We only need to refresh this single tag */
+            if(zone->tagged == true) {
+                void *user_pages_start = UNMASK_USER_PTR(zone);
+                uint8_t *_mtp = (user_pages_start - _root->system_page_size - ROUND_UP_PAGE((GET_CHUNK_COUNT(zone) * MEM_TAG_SIZE)));
+                uint64_t chunk_offset = (uint64_t) (p - user_pages_start);
+                _mtp += GET_CHUNK_NUMBER(zone, chunk_offset);
+
+                /* Generate and write a new tag for this chunk */
+                uint8_t mem_tag = (uint8_t) rand_uint64();
+                *_mtp = mem_tag;
+            }
+        }
+    }
+#endif
+
+#if BACKGROUND_THREAD
+    /* The background thread retires zones off the request
+     * path. A zone that is never empty when it looks is
+     * still retired here once it is well past its limit */
+    if(LIKELY(zone->alloc_count < (GET_CHUNK_COUNT(zone) * ZONE_ALLOC_RETIRE * 2))) {
+        return false;
+    }
+#endif
+
+    /* If the zone has no active allocations, holds smaller chunks,
+     * and has allocated and freed more than ZONE_ALLOC_RETIRE
+     * chunks in its lifetime then we destroy and replace it with
+     * a new zone */
+    return _is_zone_retired(zone);
+}
+
+/* Requires the root is locked */
 INTERNAL_HIDDEN void _iso_free_internal_unlocked(void *p, bool permanent, iso_alloc_zone_t *zone) {
 #if FUZZ_MODE
     _verify_all_zones();
@@ -1984,37 +4188,13 @@ INTERNAL_HIDDEN void _iso_free_internal_unlocked(void *p, bool permanent, iso_al
     }
 
     if(LIKELY(zone != NULL)) {
-        iso_free_chunk_from_zone(zone, p, permanent);
+        LOCK_ZONE(zone);
 
-        /* If the zone has no active allocations, holds smaller chunks,
-         * and has allocated and freed more than ZONE_ALLOC_RETIRE
-         * chunks in its lifetime then we destroy and replace it with
-         * a new zone */
-        if(UNLIKELY(_is_zone_retired(zone))) {
-            _iso_alloc_destroy_zone_unlocked(zone, false, true);
+        if(UNLIKELY(_iso_free_chunk_locked(zone, p, permanent))) {
+            _iso_alloc_destroy_zone_unlocked(zone, true);
         }
 
-#if MEMORY_TAGGING
-        /* If there are no chunks allocated but this zone has seen
-         * %25 of ZONE_ALLOC_RETIRE in allocations we wipe the pointer
-         * tags and start fresh. If the whole zone doesn't need to
-         * be refreshed then just generate a new tag for this chunk */
-        if(zone->tagged == true) {
-            if(_refresh_zone_mem_tags(zone) == false) {
-                /* We only need to refresh this single tag */
-                if(zone->tagged == true) {
-                    void *user_pages_start = UNMASK_USER_PTR(zone);
-                    uint8_t *_mtp = (user_pages_start - _root->system_page_size - ROUND_UP_PAGE((GET_CHUNK_COUNT(zone) * MEM_TAG_SIZE)));
-                    uint64_t chunk_offset = (uint64_t) (p - user_pages_start);
-                    _mtp += (chunk_offset / zone->chunk_size);
-
-                    /* Generate and write a new tag for this chunk */
-                    uint8_t mem_tag = (uint8_t) rand_uint64();
-                    *_mtp = mem_tag;
-                }
-            }
-        }
-#endif
+        UNLOCK_ZONE(zone);
 
 #if UAF_PTR_PAGE
         if(UNLIKELY((rand_uint64() % UAF_PTR_PAGE_ODDS) == 1)) {
@@ -2068,10 +4248,21 @@ INTERNAL_HIDDEN size_t _iso_chunk_size(void *p) {
     UNLOCK_SANITY_CACHE();
 #endif
 
+    /* The chunk size of a zone only changes while the
+     * root is locked so its safe to read once we hold
+     * the zone lock */
+    iso_alloc_zone_t *zone = iso_lock_zone_range(p);
+
+    if(LIKELY(zone != NULL)) {
+        size_t chunk_size = zone->chunk_size;
+        UNLOCK_ZONE(zone);
+        return chunk_size;
+    }
+
     LOCK_ROOT();
 
     /* We cannot return NULL here, we abort instead */
-    iso_alloc_zone_t *zone = iso_find_zone_range(p);
+    zone = iso_find_zone_range(p);
 
     if(UNLIKELY(zone == NULL)) {
         UNLOCK_ROOT();
@@ -2088,9 +4279,101 @@ INTERNAL_HIDDEN size_t _iso_chunk_size(void *p) {
     return zone->chunk_size;
 }
 
+/* Returns true if the chunk at p can hold size bytes
+ * without being moved. A zone chunk is kept unless the
+ * size class of size is less than half its chunk size.
+ * A big zone is kept if it's large enough, and when it
+ * shrinks by enough of its pages they are split off and
+ * given to the free bins. If p isn't an in use chunk we
+ * return false and let the free that follows report it */
+INTERNAL_HIDDEN bool _iso_realloc_in_place(void *p, size_t size) {
+    if(p == NULL || size == 0) {
+        return false;
+    }
+
+#if NO_ZERO_ALLOCATIONS
+    if(UNLIKELY(p == _zero_alloc_page)) {
+        return false;
+    }
+#endif
+
+#if ALLOC_SANITY
+    LOCK_SANITY_CACHE();
+    _sane_allocation_t *sane_alloc = _get_sane_alloc(p);
+    UNLOCK_SANITY_CACHE();
+
+    if(sane_alloc != NULL) {
+        return false;
+    }
+#endif
+
+    iso_alloc_zone_t *zone = iso_lock_zone_range(p);
+
+    if(zone != NULL) {
+        const size_t class = size_class(size);
+        bool fits = (class <= zone->chunk_size && (class << 1) > zone->chunk_size);
+
+#if MEMORY_TAGGING
+        fits = fits && (zone->tagged == false);
+#endif
+
+        if(fits == true) {
+            const uint64_t chunk_offset = (uint64_t) (p - UNMASK_USER_PTR(zone));
+            const size_t chunk_number = GET_CHUNK_NUMBER(zone, chunk_offset);
+            const bit_slot_t bit_slot = (chunk_number << BITS_PER_CHUNK_SHIFT);
+            const bitmap_index_t *bm = (bitmap_index_t *) UNMASK_BITMAP_PTR(zone);
+
+            /* Only the start of a chunk in state 10 */
+            fits = ((chunk_number * zone->chunk_size) == chunk_offset &&
+                    (GET_BIT(bm[bit_slot >> BITS_PER_QWORD_SHIFT], WHICH_BIT(bit_slot))) == 1 &&
+                    (GET_BIT(bm[bit_slot >> BITS_PER_QWORD_SHIFT], (WHICH_BIT(bit_slot) + 1))) == 0);
+        }
+
+        UNLOCK_ZONE(zone);
+        return fits;
+    }
+
+    if(size <= ZONE_SZ_MAX) {
+        return false;
+    }
+
+    const size_t new_size = ROUND_UP_PAGE(size);
+
+    if(new_size < size) {
+        return false;
+    }
+
+    LOCK_BIG_ZONE();
+    iso_alloc_big_zone_t *big = big_zone_index_find(p);
+
+    if(big == NULL || big->free == true || new_size > big->size) {
+        UNLOCK_BIG_ZONE();
+        return false;
+    }
+
+    if((big->size - new_size) >= ((_root->system_page_size << 1) + BIG_ZONE_SPLIT_MIN_SZ)) {
+        /* Free big zones are expected to have given their
+         * pages back unless they are marked dirty */
+#if BACKGROUND_THREAD
+        big->dirty = true;
+#else
+        madvise(big->user_pages_start + new_size, big->size - new_size, MADV_DONTNEED);
+#endif
+        big_zone_split(big, new_size);
+#if !BACKGROUND_THREAD
+        big_zone_trim(BIG_ZONE_RETAIN_SZ);
+#endif
+    }
+
+    UNLOCK_BIG_ZONE();
+    return true;
+}
+
 INTERNAL_HIDDEN uint64_t _iso_alloc_detect_leaks_in_zone(iso_alloc_zone_t *zone) {
     LOCK_ROOT();
+    LOCK_ZONE(zone);
     uint64_t leaks = _iso_alloc_zone_leak_detector(zone, false);
+    UNLOCK_ZONE(zone);
     UNLOCK_ROOT();
     return leaks;
 }
@@ -2124,4 +4407,10 @@ INTERNAL_HIDDEN uint64_t _iso_alloc_zone_mem_usage(iso_alloc_zone_t *zone) {
 EXTERNAL_API iso_alloc_root *_get_root(void) {
     return _root;
 }
+
+#if THREAD_ZONES
+EXTERNAL_API void _set_remote_free_hook(void (*hook)(iso_alloc_zone_t *zone)) {
+    remote_free_hook = hook;
+}
+#endif
 #endif
@@ -52,5 +52,50 @@ EXTERNAL_API void operator delete[](void *ptr, const std::nothrow_t &) noexcept
     return iso_free(ptr);
 }
 
+#if __cpp_aligned_new
+// Chunks returned by the aligned overloads may come
+// from a big zone even when size is small, so they
+// are always free'd without a size
+EXTERNAL_API void *operator new(size_t size, std::align_val_t al) {
+    return iso_alloc_aligned(static_cast<size_t>(al), size);
+}
+
+EXTERNAL_API void *operator new[](size_t size, std::align_val_t al) {
+    return iso_alloc_aligned(static_cast<size_t>(al), size);
+}
+
+EXTERNAL_API void *operator new(size_t size, std::align_val_t al, const std::nothrow_t &) noexcept {
+    return iso_alloc_aligned(static_cast<size_t>(al), size);
+}
+
+EXTERNAL_API void *operator new[](size_t size, std::align_val_t al, const std::nothrow_t &) noexcept {
+    return iso_alloc_aligned(static_cast<size_t>(al), size);
+}
+
+EXTERNAL_API void operator delete(void *p, std::align_val_t al) noexcept {
+    iso_free(p);
+}
+
+EXTERNAL_API void operator delete[](void *p, std::align_val_t al) noexcept {
+    iso_free(p);
+}
+
+EXTERNAL_API void operator delete(void *p, size_t size, std::align_val_t al) noexcept {
+    iso_free(p);
+}
+
+EXTERNAL_API void operator delete[](void *p, size_t size, std::align_val_t al) noexcept {
+    iso_free(p);
+}
+
+EXTERNAL_API void operator delete(void *p, std::align_val_t al, const std::nothrow_t &) noexcept {
+    iso_free(p);
+}
+
+EXTERNAL_API void operator delete[](void *p, std::align_val_t al, const std::nothrow_t &) noexcept {
+    iso_free(p);
+}
+#endif
+
 #endif
 #endif
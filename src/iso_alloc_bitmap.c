@@ -0,0 +1,292 @@
+/* iso_alloc_bitmap.c - A secure memory allocator
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+
+#if __x86_64__
+#include <immintrin.h>
+#elif __aarch64__
+#include <arm_neon.h>
+#endif
+
+/* Every chunk state is selected from a bitmap qword b with
+ * ((b ^ flip) | any_used) & ((b >> 1) | any_in_use), which
+ * leaves at most one bit set per chunk, the in-use bit.
+ * The same expression works on vectors of qwords */
+static const uint64_t bitmap_state_masks[BITMAP_STATE_COUNT][3] = {
+    /* flip, any_used, any_in_use */
+    [BITMAP_STATE_FREE] = {~0ULL, 0, ~0ULL},
+    [BITMAP_STATE_IN_USE] = {0, 0, ~0ULL},
+    [BITMAP_STATE_USED] = {0, ~0ULL, 0},
+    [BITMAP_STATE_FREED] = {~0ULL, 0, 0},
+};
+
+INTERNAL_HIDDEN INLINE uint64_t bitmap_state_mask(uint64_t b, int32_t state) {
+    const uint64_t *m = bitmap_state_masks[state];
+    return ((b ^ m[0]) | m[1]) & ((b >> 1) | m[2]) & ALLOCATED_BITSLOTS;
+}
+
+/* The portable kernels test a qword at a time. They
+ * are used when no vector unit is available and to
+ * finish the qwords a vector kernel doesn't cover */
+INTERNAL_HIDDEN int64_t bitmap_find_portable(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state) {
+    for(int64_t i = start; i < end; i++) {
+        if(bitmap_state_mask(bm[i], state) != 0) {
+            return i;
+        }
+    }
+
+    return end;
+}
+
+INTERNAL_HIDDEN uint64_t bitmap_count_portable(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state) {
+    uint64_t count = 0;
+
+    for(int64_t i = start; i < end; i++) {
+        count += __builtin_popcountll(bitmap_state_mask(bm[i], state));
+    }
+
+    return count;
+}
+
+#if __x86_64__
+/* 4 qwords, 128 chunks, per iteration */
+__attribute__((target("avx2"))) INTERNAL_HIDDEN int64_t bitmap_find_avx2(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state) {
+    const uint64_t *m = bitmap_state_masks[state];
+    const __m256i flip = _mm256_set1_epi64x(m[0]);
+    const __m256i any_used = _mm256_set1_epi64x(m[1]);
+    const __m256i any_in_use = _mm256_set1_epi64x(m[2]);
+    const __m256i in_use_bits = _mm256_set1_epi64x(ALLOCATED_BITSLOTS);
+    int64_t i = start;
+
+    for(; i + 4 <= end; i += 4) {
+        const __m256i b = _mm256_loadu_si256((const __m256i *) &bm[i]);
+        const __m256i v = _mm256_and_si256(_mm256_or_si256(_mm256_xor_si256(b, flip), any_used),
+                                           _mm256_or_si256(_mm256_srli_epi64(b, 1), any_in_use));
+
+        if(_mm256_testz_si256(v, in_use_bits) == 0) {
+            break;
+        }
+    }
+
+    return bitmap_find_portable(bm, i, end, state);
+}
+
+__attribute__((target("avx2,popcnt"))) INTERNAL_HIDDEN uint64_t bitmap_count_avx2(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state) {
+    const uint64_t *m = bitmap_state_masks[state];
+    const __m256i flip = _mm256_set1_epi64x(m[0]);
+    const __m256i any_used = _mm256_set1_epi64x(m[1]);
+    const __m256i any_in_use = _mm256_set1_epi64x(m[2]);
+    const __m256i in_use_bits = _mm256_set1_epi64x(ALLOCATED_BITSLOTS);
+    uint64_t count = 0;
+    int64_t i = start;
+
+    for(; i + 4 <= end; i += 4) {
+        const __m256i b = _mm256_loadu_si256((const __m256i *) &bm[i]);
+        const __m256i v = _mm256_and_si256(_mm256_and_si256(_mm256_or_si256(_mm256_xor_si256(b, flip), any_used),
+                                                            _mm256_or_si256(_mm256_srli_epi64(b, 1), any_in_use)),
+                                           in_use_bits);
+
+        count += __builtin_popcountll(_mm256_extract_epi64(v, 0)) + __builtin_popcountll(_mm256_extract_epi64(v, 1)) +
+                 __builtin_popcountll(_mm256_extract_epi64(v, 2)) + __builtin_popcountll(_mm256_extract_epi64(v, 3));
+    }
+
+    return count + bitmap_count_portable(bm, i, end, state);
+}
+
+/* 8 qwords, 256 chunks, per iteration */
+__attribute__((target("avx512f"))) INTERNAL_HIDDEN int64_t bitmap_find_avx512(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state) {
+    const uint64_t *m = bitmap_state_masks[state];
+    const __m512i flip = _mm512_set1_epi64(m[0]);
+    const __m512i any_used = _mm512_set1_epi64(m[1]);
+    const __m512i any_in_use = _mm512_set1_epi64(m[2]);
+    const __m512i in_use_bits = _mm512_set1_epi64(ALLOCATED_BITSLOTS);
+    int64_t i = start;
+
+    for(; i + 8 <= end; i += 8) {
+        const __m512i b = _mm512_loadu_si512((const void *) &bm[i]);
+        const __m512i v = _mm512_and_si512(_mm512_or_si512(_mm512_xor_si512(b, flip), any_used),
+                                           _mm512_or_si512(_mm512_srli_epi64(b, 1), any_in_use));
+        const __mmask8 lanes = _mm512_test_epi64_mask(v, in_use_bits);
+
+        if(lanes != 0) {
+            return i + __builtin_ctz(lanes);
+        }
+    }
+
+    return bitmap_find_portable(bm, i, end, state);
+}
+
+__attribute__((target("avx512f,popcnt"))) INTERNAL_HIDDEN uint64_t bitmap_count_avx512(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state) {
+    const uint64_t *m = bitmap_state_masks[state];
+    const __m512i flip = _mm512_set1_epi64(m[0]);
+    const __m512i any_used = _mm512_set1_epi64(m[1]);
+    const __m512i any_in_use = _mm512_set1_epi64(m[2]);
+    const __m512i in_use_bits = _mm512_set1_epi64(ALLOCATED_BITSLOTS);
+    uint64_t count = 0;
+    uint64_t lanes[8];
+    int64_t i = start;
+
+    for(; i + 8 <= end; i += 8) {
+        const __m512i b = _mm512_loadu_si512((const void *) &bm[i]);
+        const __m512i v = _mm512_and_si512(_mm512_and_si512(_mm512_or_si512(_mm512_xor_si512(b, flip), any_used),
+                                                            _mm512_or_si512(_mm512_srli_epi64(b, 1), any_in_use)),
+                                           in_use_bits);
+
+        /* Skip the popcounts for runs of qwords that
+         * don't hold any chunk in this state */
+        if(_mm512_test_epi64_mask(v, v) == 0) {
+            continue;
+        }
+
+        _mm512_storeu_si512((void *) lanes, v);
+
+        for(int32_t j = 0; j < 8; j++) {
+            count += __builtin_popcountll(lanes[j]);
+        }
+    }
+
+    return count + bitmap_count_portable(bm, i, end, state);
+}
+#elif __aarch64__
+/* 4 qwords, 128 chunks, per iteration. NEON is
+ * always present on aarch64 */
+INTERNAL_HIDDEN int64_t bitmap_find_neon(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state) {
+    const uint64_t *m = bitmap_state_masks[state];
+    const uint64x2_t flip = vdupq_n_u64(m[0]);
+    const uint64x2_t any_used = vdupq_n_u64(m[1]);
+    const uint64x2_t any_in_use = vdupq_n_u64(m[2]);
+    const uint64x2_t in_use_bits = vdupq_n_u64(ALLOCATED_BITSLOTS);
+    int64_t i = start;
+
+    for(; i + 4 <= end; i += 4) {
+        const uint64x2_t b0 = vld1q_u64((const uint64_t *) &bm[i]);
+        const uint64x2_t b1 = vld1q_u64((const uint64_t *) &bm[i + 2]);
+        const uint64x2_t v0 = vandq_u64(vorrq_u64(veorq_u64(b0, flip), any_used), vorrq_u64(vshrq_n_u64(b0, 1), any_in_use));
+        const uint64x2_t v1 = vandq_u64(vorrq_u64(veorq_u64(b1, flip), any_used), vorrq_u64(vshrq_n_u64(b1, 1), any_in_use));
+        const uint64x2_t v = vandq_u64(vorrq_u64(v0, v1), in_use_bits);
+
+        if(vmaxvq_u32(vreinterpretq_u32_u64(v)) != 0) {
+            break;
+        }
+    }
+
+    return bitmap_find_portable(bm, i, end, state);
+}
+
+INTERNAL_HIDDEN uint64_t bitmap_count_neon(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state) {
+    const uint64_t *m = bitmap_state_masks[state];
+    const uint64x2_t flip = vdupq_n_u64(m[0]);
+    const uint64x2_t any_used = vdupq_n_u64(m[1]);
+    const uint64x2_t any_in_use = vdupq_n_u64(m[2]);
+    const uint64x2_t in_use_bits = vdupq_n_u64(ALLOCATED_BITSLOTS);
+    uint64_t count = 0;
+    int64_t i = start;
+
+    for(; i + 2 <= end; i += 2) {
+        const uint64x2_t b = vld1q_u64((const uint64_t *) &bm[i]);
+        const uint64x2_t v = vandq_u64(vandq_u64(vorrq_u64(veorq_u64(b, flip), any_used), vorrq_u64(vshrq_n_u64(b, 1), any_in_use)), in_use_bits);
+
+        /* Per byte popcount summed across the vector */
+        count += vaddvq_u8(vcntq_u8(vreinterpretq_u8_u64(v)));
+    }
+
+    return count + bitmap_count_portable(bm, i, end, state);
+}
+#endif
+
+/* Picks the widest kernel this CPU supports. The
+ * result is stored in the root */
+INTERNAL_HIDDEN uint8_t bitmap_kernel_select(void) {
+#if __x86_64__
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("popcnt")) {
+        return BITMAP_KERNEL_AVX512;
+    }
+
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        return BITMAP_KERNEL_AVX2;
+    }
+#elif __aarch64__
+    return BITMAP_KERNEL_NEON;
+#endif
+    return BITMAP_KERNEL_PORTABLE;
+}
+
+INTERNAL_HIDDEN bool bitmap_kernel_supported(int32_t kernel) {
+    switch(kernel) {
+    case BITMAP_KERNEL_PORTABLE:
+        return true;
+#if __x86_64__
+    case BITMAP_KERNEL_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    case BITMAP_KERNEL_AVX512:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("popcnt");
+#elif __aarch64__
+    case BITMAP_KERNEL_NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+INTERNAL_HIDDEN int64_t bitmap_find_with(int32_t kernel, const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state) {
+    switch(kernel) {
+#if __x86_64__
+    case BITMAP_KERNEL_AVX512:
+        return bitmap_find_avx512(bm, start, end, state);
+    case BITMAP_KERNEL_AVX2:
+        return bitmap_find_avx2(bm, start, end, state);
+#elif __aarch64__
+    case BITMAP_KERNEL_NEON:
+        return bitmap_find_neon(bm, start, end, state);
+#endif
+    default:
+        return bitmap_find_portable(bm, start, end, state);
+    }
+}
+
+INTERNAL_HIDDEN uint64_t bitmap_count_with(int32_t kernel, const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state) {
+    switch(kernel) {
+#if __x86_64__
+    case BITMAP_KERNEL_AVX512:
+        return bitmap_count_avx512(bm, start, end, state);
+    case BITMAP_KERNEL_AVX2:
+        return bitmap_count_avx2(bm, start, end, state);
+#elif __aarch64__
+    case BITMAP_KERNEL_NEON:
+        return bitmap_count_neon(bm, start, end, state);
+#endif
+    default:
+        return bitmap_count_portable(bm, start, end, state);
+    }
+}
+
+/* Returns the index of the first qword in bm[start, end)
+ * holding a chunk in this state, or end if there is none */
+INTERNAL_HIDDEN int64_t bitmap_find(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state) {
+    return bitmap_find_with(_root->bitmap_kernel, bm, start, end, state);
+}
+
+/* Returns the number of chunks in bm[start, end) in this state */
+INTERNAL_HIDDEN uint64_t bitmap_count(const bitmap_index_t *bm, int64_t start, int64_t end, int32_t state) {
+    return bitmap_count_with(_root->bitmap_kernel, bm, start, end, state);
+}
+
+#if UNIT_TESTING
+EXTERNAL_API bool _bitmap_kernel_supported(int32_t kernel) {
+    return bitmap_kernel_supported(kernel);
+}
+
+EXTERNAL_API int64_t _bitmap_find_with(int32_t kernel, const uint64_t *bm, int64_t start, int64_t end, int32_t state) {
+    return bitmap_find_with(kernel, (const bitmap_index_t *) bm, start, end, state);
+}
+
+EXTERNAL_API uint64_t _bitmap_count_with(int32_t kernel, const uint64_t *bm, int64_t start, int64_t end, int32_t state) {
+    return bitmap_count_with(kernel, (const bitmap_index_t *) bm, start, end, state);
+}
+#endif
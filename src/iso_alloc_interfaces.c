@@ -12,10 +12,22 @@ EXTERNAL_API NO_DISCARD MALLOC_ATTR CALLOC_SIZE ASSUME_ALIGNED void *iso_calloc(
     return _iso_calloc(nmemb, size);
 }
 
+EXTERNAL_API NO_DISCARD MALLOC_ATTR ALIGNED_ALLOC_SIZE void *iso_alloc_aligned(size_t alignment, size_t size) {
+    return _iso_aligned_alloc(alignment, size);
+}
+
+EXTERNAL_API NO_DISCARD size_t iso_alloc_batch(size_t size, size_t n, void **out) {
+    return _iso_alloc_batch(size, n, out);
+}
+
 EXTERNAL_API void iso_free(void *p) {
     _iso_free(p, false);
 }
 
+EXTERNAL_API void iso_free_batch(void **ptrs, size_t n) {
+    _iso_free_batch(ptrs, n);
+}
+
 EXTERNAL_API void iso_free_size(void *p, size_t size) {
     _iso_free_size(p, size);
 }
@@ -44,7 +56,23 @@ EXTERNAL_API NO_DISCARD REALLOC_SIZE ASSUME_ALIGNED void *iso_realloc(void *p, s
         return NULL;
     }
 
+    /* The chunk already has room for size bytes */
+    if(_iso_realloc_in_place(p, size) == true) {
+        return p;
+    }
+
+#if __linux__
+    /* Big zones are moved by the kernel without a copy */
+    void *r = _iso_big_realloc(p, size);
+
+    if(r != NULL) {
+        return r;
+    }
+
+    r = iso_alloc(size);
+#else
     void *r = iso_alloc(size);
+#endif
 
     if(r == NULL) {
         return r;
@@ -259,6 +287,10 @@ EXTERNAL_API void iso_flush_caches() {
     flush_caches();
 }
 
+EXTERNAL_API size_t iso_alloc_trim(size_t target_bytes) {
+    return _iso_alloc_trim(target_bytes);
+}
+
 #if HEAP_PROFILER
 EXTERNAL_API size_t iso_get_alloc_traces(iso_alloc_traces_t *traces_out) {
     return _iso_get_alloc_traces(traces_out);
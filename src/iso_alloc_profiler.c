@@ -21,6 +21,14 @@ INTERNAL_HIDDEN size_t _iso_alloc_print_stats() {
 #endif
     LOG("Soft Page Faults: %d", _rusage.ru_minflt);
     LOG("Hard Page Faults: %d", _rusage.ru_majflt);
+
+    const uint64_t hits = __atomic_load_n(&_root->zone_map_hits, __ATOMIC_RELAXED);
+    const uint64_t misses = __atomic_load_n(&_root->zone_map_misses, __ATOMIC_RELAXED);
+
+    if((hits + misses) != 0) {
+        LOG("Zone Map Lookups: %lu hits, %lu misses, %lu percent hit rate", hits, misses, (hits * 100) / (hits + misses));
+    }
+
     return OK;
 }
 #endif
@@ -33,7 +41,9 @@ INTERNAL_HIDDEN uint64_t _iso_alloc_detect_leaks() {
 
     for(uint32_t i = 0; i < _root->zones_used; i++) {
         iso_alloc_zone_t *zone = &_root->zones[i];
+        LOCK_ZONE(zone);
         total_leaks += _iso_alloc_zone_leak_detector(zone, false);
+        UNLOCK_ZONE(zone);
     }
 
     UNLOCK_ROOT();
@@ -77,44 +87,44 @@ INTERNAL_HIDDEN uint64_t _iso_alloc_zone_leak_detector(iso_alloc_zone_t *zone, b
         return 0;
     }
 
+#if THREAD_ZONES
+    /* Chunks queued by other threads have been freed
+     * and must not be reported as leaks */
+    _iso_drain_remote_frees(zone);
+#endif
+
     UNMASK_ZONE_PTRS(zone);
 
     bitmap_index_t *bm = (bitmap_index_t *) zone->bitmap_start;
-    int64_t was_used = 0;
+    const int64_t max_bm_idx = zone->bitmap_size / sizeof(bitmap_index_t);
 
-    for(int64_t i = 0; i < zone->bitmap_size / sizeof(bitmap_index_t); i++) {
-        for(size_t j = 0; j < BITS_PER_QWORD; j += BITS_PER_CHUNK) {
+    /* Chunks that were used but are now free */
+    int64_t was_used = bitmap_count(bm, 0, max_bm_idx, BITMAP_STATE_FREED);
 
-            if(bm[i] == 0) {
-                continue;
-            }
+    for(int64_t i = bitmap_find(bm, 0, max_bm_idx, BITMAP_STATE_IN_USE); i < max_bm_idx;
+        i = bitmap_find(bm, i + 1, max_bm_idx, BITMAP_STATE_IN_USE)) {
+        uint64_t m = bitmap_state_mask(bm[i], BITMAP_STATE_IN_USE);
 
-            int64_t bit = GET_BIT(bm[i], j);
-            int64_t bit_two = GET_BIT(bm[i], (j + 1));
+        for(; m != 0; m &= m - 1) {
+            const int64_t j = __builtin_ctzll(m);
+            const int64_t bit_two = GET_BIT(bm[i], (j + 1));
 
-            /* Chunk was used but is now free */
-            if(bit == 0 && bit_two == 1) {
-                was_used++;
+            /* Theres no difference between a leaked and previously
+             * used chunk (11) and a canary chunk (11). So in order
+             * to accurately report on leaks we need to verify the
+             * canary value. If it doesn't validate then we assume
+             * its a true leak and increment the in_use counter */
+            bit_slot_t bit_slot = (i * BITS_PER_QWORD) + j;
+            const void *leak = (zone->user_pages_start + ((bit_slot / BITS_PER_CHUNK) * zone->chunk_size));
+
+            if(bit_two == 1 && check_canary_no_abort(zone, leak) != ERR) {
+                continue;
             }
 
-            if(bit == 1) {
-                /* Theres no difference between a leaked and previously
-                 * used chunk (11) and a canary chunk (11). So in order
-                 * to accurately report on leaks we need to verify the
-                 * canary value. If it doesn't validate then we assume
-                 * its a true leak and increment the in_use counter */
-                bit_slot_t bit_slot = (i * BITS_PER_QWORD) + j;
-                const void *leak = (zone->user_pages_start + ((bit_slot / BITS_PER_CHUNK) * zone->chunk_size));
-
-                if(bit_two == 1 && (check_canary_no_abort(zone, leak) != ERR)) {
-                    continue;
-                } else {
-                    in_use++;
-
-                    if(profile == false) {
-                        LOG("Leaked chunk (%d) in zone[%d] of %d bytes detected at 0x%p (bit position = %lu)", in_use, zone->index, zone->chunk_size, leak, bit_slot);
-                    }
-                }
+            in_use++;
+
+            if(profile == false) {
+                LOG("Leaked chunk (%d) in zone[%d] of %d bytes detected at 0x%p (bit position = %lu)", in_use, zone->index, zone->chunk_size, leak, bit_slot);
             }
         }
     }
@@ -142,7 +152,7 @@ INTERNAL_HIDDEN uint64_t _iso_alloc_zone_leak_detector(iso_alloc_zone_t *zone, b
 INTERNAL_HIDDEN uint64_t __iso_alloc_zone_mem_usage(iso_alloc_zone_t *zone) {
     uint64_t mem_usage = 0;
     mem_usage += zone->bitmap_size;
-    mem_usage += ZONE_USER_SIZE;
+    mem_usage += ZONE_USER_SZ(zone);
     LOG("Zone[%d] holds %d byte chunks. Total bytes (%lu), megabytes (%lu)", zone->index, zone->chunk_size,
         mem_usage, (mem_usage / MEGABYTE_SIZE));
     return (mem_usage / MEGABYTE_SIZE);
@@ -154,9 +164,9 @@ INTERNAL_HIDDEN uint64_t __iso_alloc_mem_usage() {
     for(uint32_t i = 0; i < _root->zones_used; i++) {
         iso_alloc_zone_t *zone = &_root->zones[i];
         mem_usage += zone->bitmap_size;
-        mem_usage += ZONE_USER_SIZE;
+        mem_usage += ZONE_USER_SZ(zone);
         LOG("Zone[%d] holds %d byte chunks, megabytes (%d) next zone = %d, total allocations = %d", zone->index, zone->chunk_size,
-            (ZONE_USER_SIZE / MEGABYTE_SIZE), zone->next_sz_index, zone->alloc_count);
+            (ZONE_USER_SZ(zone) / MEGABYTE_SIZE), zone->next_sz_index, zone->alloc_count);
     }
 
     return (mem_usage / MEGABYTE_SIZE);
@@ -275,7 +285,11 @@ INTERNAL_HIDDEN void _iso_output_profile() {
 
     for(uint32_t i = 0; i < _root->zones_used; i++) {
         iso_alloc_zone_t *zone = &_root->zones[i];
-        _zone_profiler_map[zone->chunk_size].total++;
+
+        /* Medium zones aren't profiled */
+        if(zone->chunk_size <= SMALL_SZ_MAX) {
+            _zone_profiler_map[zone->chunk_size].total++;
+        }
     }
 
     for(uint32_t i = 0; i < _alloc_bts_count; i++) {
@@ -320,7 +334,7 @@ INTERNAL_HIDDEN void _iso_output_profile() {
         }
     }
 
-    for(uint32_t i = 0; i < SMALL_SZ_MAX; i++) {
+    for(uint32_t i = 0; i <= SMALL_SZ_MAX; i++) {
         if(_zone_profiler_map[i].count != 0) {
             _iso_alloc_printf(profiler_fd, "%d,%d,%d\n", i, _zone_profiler_map[i].total, _zone_profiler_map[i].count);
         }
@@ -349,15 +363,19 @@ INTERNAL_HIDDEN void _iso_alloc_profile(size_t size) {
         /* For the purposes of the profiler we don't care about
          * the differences between canary and leaked chunks.
          * So lets just use the full count */
+        LOCK_ZONE(zone);
+
         if(zone->is_full) {
             used = GET_CHUNK_COUNT(zone);
         } else {
             used = _iso_alloc_zone_leak_detector(zone, true);
         }
 
+        UNLOCK_ZONE(zone);
+
         used = (int32_t) ((float) used / (GET_CHUNK_COUNT(zone)) * 100.0);
 
-        if(used > CHUNK_USAGE_THRESHOLD) {
+        if(used > CHUNK_USAGE_THRESHOLD && zone->chunk_size <= SMALL_SZ_MAX) {
             _zone_profiler_map[zone->chunk_size].count++;
         }
     }
@@ -14,8 +14,34 @@
 #endif
 #include "iso_alloc_internal.h"
 
-INTERNAL_HIDDEN uint64_t rand_uint64(void) {
-    uint64_t val = 0;
+#if BUFFERED_RANDOM
+#include <pthread.h>
+#endif
+
+#if BUFFERED_RANDOM
+static __thread rand_state_t rand_state;
+static pthread_once_t rand_atfork_once = PTHREAD_ONCE_INIT;
+
+#define CHACHA_ROTL(v, n) \
+    (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define CHACHA_QUARTER_ROUND(a, b, c, d) \
+    a += b;                              \
+    d ^= a;                              \
+    d = CHACHA_ROTL(d, 16);              \
+    c += d;                              \
+    b ^= c;                              \
+    b = CHACHA_ROTL(b, 12);              \
+    a += b;                              \
+    d ^= a;                              \
+    d = CHACHA_ROTL(d, 8);               \
+    c += d;                              \
+    b ^= c;                              \
+    b = CHACHA_ROTL(b, 7);
+#endif
+
+/* Fills buf with entropy from the kernel */
+INTERNAL_HIDDEN void rand_entropy(void *buf, size_t size) {
     int ret = 0;
 
 /* In modern versions of glibc (>=2.25) we can call getrandom(),
@@ -24,9 +50,9 @@ INTERNAL_HIDDEN uint64_t rand_uint64(void) {
  * We give up on checking the return value. The alternative would be
  * to crash. We prefer here to keep going with degraded randomness. */
 #if __linux__
-    ret = syscall(SYS_getrandom, &val, sizeof(val), GRND_NONBLOCK) != sizeof(val);
+    ret = syscall(SYS_getrandom, buf, size, GRND_NONBLOCK) != (long) size;
 #elif __APPLE__
-    ret = SecRandomCopyBytes(kSecRandomDefault, sizeof(val), &val);
+    ret = SecRandomCopyBytes(kSecRandomDefault, size, buf);
 #endif
 
 #if ABORT_NO_ENTROPY
@@ -34,6 +60,100 @@ INTERNAL_HIDDEN uint64_t rand_uint64(void) {
         LOG_AND_ABORT("Unable to gather enough entropy");
     }
 #endif
+}
+
+#if BUFFERED_RANDOM
+/* A forked child inherits the keystream of the thread
+ * that called fork(). Force it to reseed so the parent
+ * and child never hand out the same values */
+INTERNAL_HIDDEN void rand_atfork_child(void) {
+    __builtin_memset(&rand_state, 0, sizeof(rand_state));
+}
+
+INTERNAL_HIDDEN void rand_register_atfork(void) {
+    pthread_atfork(NULL, NULL, rand_atfork_child);
+}
+
+INTERNAL_HIDDEN void chacha20_block(const uint32_t key[8], uint32_t counter, uint32_t out[16]) {
+    /* "expand 32-byte k", a 32 bit block counter and a
+     * zero nonce. The key changes on every refill so
+     * the counter never needs more than a few values */
+    const uint32_t in[16] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+                             key[0], key[1], key[2], key[3],
+                             key[4], key[5], key[6], key[7],
+                             counter, 0, 0, 0};
+    uint32_t x[16];
+
+    __builtin_memcpy(x, in, sizeof(x));
+
+    for(int32_t i = 0; i < 10; i++) {
+        CHACHA_QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        CHACHA_QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        CHACHA_QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        CHACHA_QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        CHACHA_QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        CHACHA_QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        CHACHA_QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        CHACHA_QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+
+    for(int32_t i = 0; i < 16; i++) {
+        out[i] = x[i] + in[i];
+    }
+}
+
+INTERNAL_HIDDEN void rand_refill(rand_state_t *rs) {
+    if(rs->refills_until_reseed == 0) {
+        uint32_t seed[8];
 
+        pthread_once(&rand_atfork_once, rand_register_atfork);
+        rand_entropy(seed, sizeof(seed));
+
+        for(int32_t i = 0; i < 8; i++) {
+            rs->key[i] ^= seed[i];
+        }
+
+        __builtin_memset(seed, 0, sizeof(seed));
+        rs->refills_until_reseed = RAND_RESEED_INTERVAL;
+    }
+
+    uint32_t blocks[RAND_CHACHA_BLOCKS][16];
+
+    for(int32_t i = 0; i < RAND_CHACHA_BLOCKS; i++) {
+        chacha20_block(rs->key, i, blocks[i]);
+    }
+
+    __builtin_memcpy(rs->key, blocks, sizeof(rs->key));
+    __builtin_memcpy(rs->buffer, ((uint8_t *) blocks) + sizeof(rs->key), sizeof(rs->buffer));
+    __builtin_memset(blocks, 0, sizeof(blocks));
+
+    /* Keep the compiler from eliding the wipe above */
+    __asm__ __volatile__(""
+                         :
+                         : "r"(blocks)
+                         : "memory");
+
+    rs->available = RAND_BUFFER_WORDS;
+    rs->refills_until_reseed--;
+}
+#endif
+
+INTERNAL_HIDDEN uint64_t rand_uint64(void) {
+#if BUFFERED_RANDOM
+    rand_state_t *rs = &rand_state;
+
+    if(UNLIKELY(rs->available == 0)) {
+        rand_refill(rs);
+    }
+
+    /* Values are wiped from the buffer as they are used */
+    rs->available--;
+    const uint64_t val = rs->buffer[rs->available];
+    rs->buffer[rs->available] = 0;
     return val;
+#else
+    uint64_t val = 0;
+    rand_entropy(&val, sizeof(val));
+    return val;
+#endif
 }
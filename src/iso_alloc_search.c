@@ -12,20 +12,23 @@ INTERNAL_HIDDEN void *_iso_alloc_ptr_search(void *n, bool poison) {
     for(int32_t i = 0; i < _root->zones_used; i++) {
         iso_alloc_zone_t *zone = &_root->zones[i];
 
+        LOCK_ZONE(zone);
         UNMASK_ZONE_PTRS(zone);
         h = zone->user_pages_start;
 
-        while(h <= (uint8_t *) (zone->user_pages_start + ZONE_USER_SIZE - sizeof(uint64_t))) {
+        while(h <= (uint8_t *) (zone->user_pages_start + ZONE_USER_SZ(zone) - sizeof(uint64_t))) {
             if(LIKELY((uint64_t) * (uint64_t *) h != (uint64_t) n)) {
                 h++;
             } else {
                 if(poison == false) {
                     MASK_ZONE_PTRS(zone);
+                    UNLOCK_ZONE(zone);
                     return h;
                 } else {
 #if UAF_PTR_PAGE
                     *(uint64_t *) h = UAF_PTR_PAGE_ADDR;
                     MASK_ZONE_PTRS(zone);
+                    UNLOCK_ZONE(zone);
                     return h;
 #endif
                 }
@@ -33,6 +36,7 @@ INTERNAL_HIDDEN void *_iso_alloc_ptr_search(void *n, bool poison) {
         }
 
         MASK_ZONE_PTRS(zone);
+        UNLOCK_ZONE(zone);
     }
 
     return NULL;
@@ -77,6 +81,7 @@ INTERNAL_HIDDEN void _iso_alloc_search_stack(uint8_t *stack_start) {
         current--;
 
         if(zone != NULL) {
+            LOCK_ZONE(zone);
             UNMASK_ZONE_PTRS(zone);
 
             /* Ensure the pointer is properly aligned */
@@ -91,6 +96,7 @@ INTERNAL_HIDDEN void _iso_alloc_search_stack(uint8_t *stack_start) {
             if(UNLIKELY((chunk_offset % zone->chunk_size) != 0)) {
                 LOG("Chunk at %p is not a multiple of zone[%d] chunk size %d. Off by %" PRIu64 " bits", p, zone->index, zone->chunk_size, (chunk_offset % zone->chunk_size));
                 MASK_ZONE_PTRS(zone);
+                UNLOCK_ZONE(zone);
                 continue;
             }
 
@@ -101,6 +107,7 @@ INTERNAL_HIDDEN void _iso_alloc_search_stack(uint8_t *stack_start) {
             if(UNLIKELY((zone->bitmap_start + dwords_to_bit_slot) >= (zone->bitmap_start + zone->bitmap_size))) {
                 LOG("Cannot calculate this chunks location in the bitmap %p", p);
                 MASK_ZONE_PTRS(zone);
+                UNLOCK_ZONE(zone);
                 continue;
             }
 
@@ -115,6 +122,7 @@ INTERNAL_HIDDEN void _iso_alloc_search_stack(uint8_t *stack_start) {
             }
 
             MASK_ZONE_PTRS(zone);
+            UNLOCK_ZONE(zone);
         }
 
         zone = iso_find_zone_bitmap_range(p);
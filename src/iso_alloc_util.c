@@ -83,7 +83,7 @@ INTERNAL_HIDDEN void mprotect_pages(void *p, size_t size, int32_t protection) {
 
 INTERNAL_HIDDEN int32_t name_zone(iso_alloc_zone_t *zone, char *name) {
 #if NAMED_MAPPINGS && __ANDROID__
-    return name_mapping(zone->user_pages_start, ZONE_USER_SIZE, (const char *) name);
+    return name_mapping(zone->user_pages_start, ZONE_USER_SZ(zone), (const char *) name);
 #else
     return 0;
 #endif
@@ -110,3 +110,46 @@ INTERNAL_HIDDEN INLINE CONST size_t next_pow2(size_t sz) {
     sz |= sz >> 32;
     return sz + 1;
 }
+
+/* Returns the chunk size of the zones that serve sz. With
+ * SIZE_CLASSES each power of 2 is split into four classes
+ * so a 72 byte chunk uses an 80 byte class, not 128 */
+INTERNAL_HIDDEN INLINE CONST size_t size_class(size_t sz) {
+    if(sz <= SMALLEST_CHUNK_SZ) {
+        return SMALLEST_CHUNK_SZ;
+    }
+
+#if SIZE_CLASSES
+    const uint64_t log2 = 63 - __builtin_clzll(sz - 1);
+    size_t step = 1ULL << (log2 - 2);
+
+    if(step < SIZE_CLASS_MIN_STEP) {
+        step = SIZE_CLASS_MIN_STEP;
+    }
+
+    return (sz + step - 1) & ~(step - 1);
+#else
+    if(is_pow2(sz) == true) {
+        return sz;
+    }
+
+    return next_pow2(sz);
+#endif
+}
+
+/* Maps a size class returned by size_class() to a small
+ * dense index. Classes up to ZONE_64 are indexed by their
+ * multiple of SIZE_CLASS_MIN_STEP and every power of 2
+ * above that adds four more */
+INTERNAL_HIDDEN INLINE CONST int32_t size_class_index(size_t sz) {
+#if SIZE_CLASSES
+    if(sz <= ZONE_64) {
+        return sz / SIZE_CLASS_MIN_STEP;
+    }
+
+    const uint64_t log2 = 63 - __builtin_clzll(sz - 1);
+    return ((log2 - 6) << 2) + (sz >> (log2 - 2));
+#else
+    return __builtin_ctzll(sz);
+#endif
+}
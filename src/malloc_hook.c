@@ -46,8 +46,11 @@ EXTERNAL_API void *realloc(void *p, size_t s) {
 }
 
 EXTERNAL_API int __posix_memalign(void **r, size_t a, size_t s) {
-    /* All iso_alloc allocations are 8 byte aligned */
-    *r = iso_alloc(s);
+    if(a == 0 || a % sizeof(void *) != 0 || (a & (a - 1)) != 0) {
+        return EINVAL;
+    }
+
+    *r = iso_alloc_aligned(a, s);
 
     if(*r != NULL) {
         return 0;
@@ -61,18 +64,15 @@ EXTERNAL_API int posix_memalign(void **r, size_t alignment, size_t s) {
 }
 
 EXTERNAL_API void *__libc_memalign(size_t alignment, size_t s) {
-    /* All iso_alloc allocations are 8 byte aligned */
-    return iso_alloc(s);
+    return iso_alloc_aligned(alignment, s);
 }
 
 EXTERNAL_API void *aligned_alloc(size_t alignment, size_t s) {
-    /* All iso_alloc allocations are 8 byte aligned */
-    return iso_alloc(s);
+    return iso_alloc_aligned(alignment, s);
 }
 
 EXTERNAL_API void *memalign(size_t alignment, size_t s) {
-    /* All iso_alloc allocations are 8 byte aligned */
-    return iso_alloc(s);
+    return iso_alloc_aligned(alignment, s);
 }
 
 #if __ANDROID__
@@ -85,6 +85,12 @@ EXTERNAL_API size_t malloc_usable_size(void *ptr) {
 }
 #endif
 
+/* The pad argument only makes sense for a heap that
+ * grows with sbrk so everything we can is released */
+EXTERNAL_API int malloc_trim(size_t pad) {
+    return iso_alloc_trim(0) != 0;
+}
+
 static void *libc_malloc(size_t s, const void *caller) {
     return iso_alloc(s);
 }
@@ -95,7 +101,7 @@ static void libc_free(void *ptr, const void *caller) {
     iso_free(ptr);
 }
 static void *libc_memalign(size_t alignment, size_t s, const void *caller) {
-    return iso_alloc(s);
+    return iso_alloc_aligned(alignment, s);
 }
 
 void *(*__malloc_hook)(size_t, const void *) = &libc_malloc;
@@ -0,0 +1,88 @@
+/* iso_alloc aligned_test.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+#include "iso_alloc.h"
+
+/* Allocates chunks of several sizes for every power of 2
+ * alignment from 8 bytes to 2 MB with each of the aligned
+ * allocation interfaces. Every chunk must be aligned and
+ * writable for its full size, and can be realloc'd or
+ * free'd with its size */
+
+#define MAX_ALIGNMENT 2097152
+#define COUNT 16
+#define SIZES 6
+
+const size_t sizes[SIZES] = {1, 24, 100, 4000, 65536, 3000000};
+
+void check_aligned(void *p, size_t alignment, size_t size) {
+    if(p == NULL) {
+        LOG_AND_ABORT("Failed to allocate %zu bytes aligned to %zu", size, alignment);
+    }
+
+    if(((uintptr_t) p & (alignment - 1)) != 0) {
+        LOG_AND_ABORT("Allocation 0x%p of %zu bytes is not aligned to %zu", p, size, alignment);
+    }
+
+    memset(p, 0x41, size);
+}
+
+int main(int argc, char *argv[]) {
+    void *p[COUNT];
+
+    for(size_t a = sizeof(void *); a <= MAX_ALIGNMENT; a <<= 1) {
+        for(int32_t s = 0; s < SIZES; s++) {
+            for(int32_t i = 0; i < COUNT; i++) {
+                p[i] = iso_alloc_aligned(a, sizes[s]);
+                check_aligned(p[i], a, sizes[s]);
+            }
+
+            for(int32_t i = 0; i < COUNT; i++) {
+                iso_free(p[i]);
+            }
+
+            void *r = NULL;
+
+            if(posix_memalign(&r, a, sizes[s]) != 0) {
+                LOG_AND_ABORT("posix_memalign(%zu, %zu) failed", a, sizes[s]);
+            }
+
+            check_aligned(r, a, sizes[s]);
+            free(r);
+
+            r = aligned_alloc(a, sizes[s]);
+            check_aligned(r, a, sizes[s]);
+            free(r);
+
+            /* Chunks aligned to more than a page are held by
+             * big zones even when they are small. They must
+             * survive a realloc and a sized free */
+            r = iso_alloc_aligned(a, sizes[s]);
+            check_aligned(r, a, sizes[s]);
+            r = iso_realloc(r, sizes[s] + 20000);
+
+            if(r == NULL || *(uint8_t *) r != 0x41) {
+                LOG_AND_ABORT("iso_realloc of a chunk aligned to %zu failed", a);
+            }
+
+            iso_free(r);
+
+            r = iso_alloc_aligned(a, sizes[s]);
+            check_aligned(r, a, sizes[s]);
+            iso_free_size(r, sizes[s]);
+        }
+    }
+
+    void *r = NULL;
+
+    if(posix_memalign(&r, 24, 64) != EINVAL || posix_memalign(&r, 4, 64) != EINVAL || posix_memalign(&r, 0, 64) != EINVAL) {
+        LOG_AND_ABORT("posix_memalign accepted an invalid alignment");
+    }
+
+    if(iso_alloc_aligned(48, 64) != NULL) {
+        LOG_AND_ABORT("iso_alloc_aligned accepted an alignment that isn't a power of 2");
+    }
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+/* iso_alloc alloc_batch.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <time.h>
+
+/* This benchmark allocates and frees groups of same size
+ * chunks the way a message queue does with its nodes. It
+ * compares looped iso_alloc and iso_free calls against
+ * iso_alloc_batch and iso_free_batch for a few group and
+ * chunk sizes and reports the time per chunk */
+
+#define ROUNDS 10000
+#define GROUPS 3
+#define SIZES 3
+
+const size_t groups[GROUPS] = {32, 128, 256};
+const size_t sizes[SIZES] = {64, 256, 1024};
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+    void *p[256];
+
+    for(int32_t g = 0; g < GROUPS; g++) {
+        for(int32_t s = 0; s < SIZES; s++) {
+            const size_t n = groups[g];
+            uint64_t start = now_ns();
+
+            for(int32_t r = 0; r < ROUNDS; r++) {
+                for(size_t i = 0; i < n; i++) {
+                    p[i] = iso_alloc(sizes[s]);
+                }
+
+                for(size_t i = 0; i < n; i++) {
+                    iso_free(p[i]);
+                }
+            }
+
+            const uint64_t looped = now_ns() - start;
+            start = now_ns();
+
+            for(int32_t r = 0; r < ROUNDS; r++) {
+                if(iso_alloc_batch(sizes[s], n, p) != n) {
+                    LOG_AND_ABORT("iso_alloc_batch failed to allocate %zu chunks of %zu bytes", n, sizes[s]);
+                }
+
+                iso_free_batch(p, n);
+            }
+
+            const uint64_t batched = now_ns() - start;
+
+            fprintf(stdout, "%3zu x %4zu byte chunks: looped %6.1f ns batched %6.1f ns per chunk\n", n, sizes[s],
+                    (double) looped / (ROUNDS * n), (double) batched / (ROUNDS * n));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+/* iso_alloc alloc_latency.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <time.h>
+
+/* This benchmark reports the latency distribution of
+ * allocations and frees for a program that handles short
+ * requests with a little idle time between them. Each
+ * request allocates a few small chunks, frees some older
+ * ones and every so often allocates and frees a big one.
+ * The live set slowly grows so new zones are needed as
+ * it runs. The tail latencies come from the syscalls on
+ * the request path that BACKGROUND_THREAD moves off it */
+
+#define REQUESTS 32768
+#define OPS_PER_REQUEST 32
+#define LIVE_CHUNKS 262144
+#define BIG_EVERY 16
+#define BIG_SZ 8388608
+#define IDLE_NS 20000
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+int compare(const void *a, const void *b) {
+    const uint32_t x = *(const uint32_t *) a;
+    const uint32_t y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+void report(const char *name, uint32_t *lat, size_t count) {
+    qsort(lat, count, sizeof(uint32_t), compare);
+    fprintf(stdout, "%-6s %8zu ops p50 %6u ns p99 %8u ns p99.9 %8u ns max %8u ns\n", name, count,
+            lat[count / 2], lat[(count * 99) / 100], lat[(count * 999) / 1000], lat[count - 1]);
+}
+
+int main(int argc, char *argv[]) {
+    const size_t ops = REQUESTS * OPS_PER_REQUEST;
+    uint32_t *alloc_lat = calloc(ops + REQUESTS, sizeof(uint32_t));
+    uint32_t *free_lat = calloc((ops * 2) + REQUESTS, sizeof(uint32_t));
+    void **chunks = calloc(LIVE_CHUNKS, sizeof(void *));
+    uint32_t seed = (uint32_t) (uintptr_t) &chunks;
+    const struct timespec idle = {0, IDLE_NS};
+    size_t allocs = 0, frees = 0;
+    uint64_t start;
+
+    for(int32_t r = 0; r < REQUESTS; r++) {
+        for(int32_t i = 0; i < OPS_PER_REQUEST; i++) {
+            /* Slots are reused in order so the live set
+             * only stops growing once every slot is used */
+            const int32_t slot = ((r * OPS_PER_REQUEST) + i) % LIVE_CHUNKS;
+            const int32_t victim = rand_r(&seed) % LIVE_CHUNKS;
+
+            if(chunks[victim] != NULL && (rand_r(&seed) % 4) == 0) {
+                start = now_ns();
+                iso_free(chunks[victim]);
+                free_lat[frees++] = now_ns() - start;
+                chunks[victim] = NULL;
+            }
+
+            if(chunks[slot] != NULL) {
+                start = now_ns();
+                iso_free(chunks[slot]);
+                free_lat[frees++] = now_ns() - start;
+            }
+
+            start = now_ns();
+            chunks[slot] = iso_alloc(16 + (rand_r(&seed) % 4080));
+            alloc_lat[allocs++] = now_ns() - start;
+            memset(chunks[slot], 0x41, 16);
+        }
+
+        if((r % BIG_EVERY) == 0) {
+            start = now_ns();
+            void *big = iso_alloc(BIG_SZ);
+            alloc_lat[allocs++] = now_ns() - start;
+            memset(big, 0x41, BIG_SZ);
+            start = now_ns();
+            iso_free(big);
+            free_lat[frees++] = now_ns() - start;
+        }
+
+        nanosleep(&idle, NULL);
+    }
+
+    report("alloc", alloc_lat, allocs);
+    report("free", free_lat, frees);
+
+    for(int32_t i = 0; i < LIVE_CHUNKS; i++) {
+        if(chunks[i] != NULL) {
+            iso_free(chunks[i]);
+        }
+    }
+
+    free(chunks);
+    free(alloc_lat);
+    free(free_lat);
+
+    return 0;
+}
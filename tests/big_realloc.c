@@ -0,0 +1,71 @@
+/* iso_alloc big_realloc.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <time.h>
+
+/* This benchmark grows a buffer from 1 MB to 1 GB by
+ * doubling it with iso_realloc, the way a growable array
+ * does, and fills the new half after every step. It
+ * reports the time spent in iso_realloc for each step
+ * and the peak RSS of the process. With mremap the pages
+ * of a big zone are moved and never copied */
+
+#define START_SZ 1048576
+#define END_SZ 1073741824
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+size_t peak_rss_kb() {
+    FILE *fp = fopen("/proc/self/status", "r");
+    char line[128];
+    size_t peak = 0;
+
+    if(fp == NULL) {
+        return 0;
+    }
+
+    while(fgets(line, sizeof(line), fp) != NULL) {
+        if(sscanf(line, "VmHWM: %zu kB", &peak) == 1) {
+            break;
+        }
+    }
+
+    fclose(fp);
+    return peak;
+}
+
+int main(int argc, char *argv[]) {
+    size_t size = START_SZ;
+    uint8_t *p = iso_alloc(size);
+    uint64_t total = 0;
+
+    memset(p, 0x41, size);
+
+    while(size < END_SZ) {
+        const size_t new_size = size * 2;
+        const uint64_t start = now_ns();
+        p = iso_realloc(p, new_size);
+        const uint64_t elapsed = now_ns() - start;
+
+        if(p == NULL || p[0] != 0x41 || p[size - 1] != 0x41) {
+            LOG_AND_ABORT("Reallocation to %zu bytes lost the contents of the buffer", new_size);
+        }
+
+        memset(p + size, 0x41, new_size - size);
+        total += elapsed;
+        size = new_size;
+
+        fprintf(stdout, "%10zu KB %10lu ns\n", size / 1024, elapsed);
+    }
+
+    fprintf(stdout, "iso_realloc total %lu ms, peak RSS %zu MB\n", total / 1000000, peak_rss_kb() / 1024);
+    iso_free(p);
+
+    return 0;
+}
@@ -55,5 +55,56 @@ int main(int argc, char *argv[]) {
         iso_free(ptrs[i]);
     }
 
+    /* Free a large big zone and then split it
+     * into many smaller big allocations */
+    p = iso_alloc(ZONE_USER_SIZE * 16);
+
+    if(p == NULL) {
+        LOG_AND_ABORT("Failed to allocate a big zone of %d bytes", ZONE_USER_SIZE * 16);
+    }
+
+    iso_free(p);
+    iso_flush_caches();
+
+    for(int32_t i = 0; i < 16; i++) {
+        ptrs[i] = iso_alloc(ZONE_SZ_MAX + 1 + (rand() % 1024));
+
+        if(ptrs[i] == NULL) {
+            LOG_AND_ABORT("Failed to allocate a big zone of %d bytes", ZONE_SZ_MAX + 1);
+        }
+
+        memset(ptrs[i], 0x41, ZONE_SZ_MAX + 1);
+    }
+
+    for(int32_t i = 0; i < 16; i++) {
+        iso_free(ptrs[i]);
+    }
+
+    /* Grow a big zone with iso_realloc and shrink it
+     * again, its contents must survive every step */
+    size_t size = ZONE_USER_SIZE;
+    uint8_t *b = iso_alloc(size);
+    memset(b, 0x41, size);
+
+    for(; size < (ZONE_USER_SIZE * 16); size *= 2) {
+        b = iso_realloc(b, size * 2);
+
+        if(b == NULL || b[0] != 0x41 || b[size - 1] != 0x41) {
+            LOG_AND_ABORT("Failed to grow a big zone to %d bytes", size * 2);
+        }
+
+        memset(b + size, 0x41, size);
+    }
+
+    b = iso_realloc(b, ZONE_USER_SIZE);
+
+    if(b == NULL || b[0] != 0x41 || b[ZONE_USER_SIZE - 1] != 0x41) {
+        LOG_AND_ABORT("Failed to shrink a big zone to %d bytes", ZONE_USER_SIZE);
+    }
+
+    iso_free(b);
+
+    iso_verify_zones();
+
     return 0;
 }
@@ -0,0 +1,101 @@
+/* iso_alloc big_zone_index.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <time.h>
+
+/* This benchmark measures the cost of big allocations
+ * and frees when thousands of big zones are live. It
+ * keeps a set of big allocations just above ZONE_SZ_MAX
+ * and repeatedly frees half of them in a random order
+ * and allocates replacements from the free big zones */
+
+#define DEFAULT_BIG_COUNT_TEST 4096
+#define ROUNDS 16
+#define MIN_BIG_SZ (ZONE_SZ_MAX + 1)
+#define MAX_BIG_SZ (ZONE_SZ_MAX + 1048576)
+
+double elapsed(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + ((end->tv_nsec - start->tv_nsec) / 1000000000.0);
+}
+
+int main(int argc, char *argv[]) {
+    int32_t big_count = DEFAULT_BIG_COUNT_TEST;
+
+    if(argc == 2) {
+        big_count = atol(argv[1]);
+    }
+
+    if(big_count <= 1) {
+        LOG_AND_ABORT("Big allocation count must be greater than 1");
+    }
+
+    void **chunks = calloc(big_count, sizeof(void *));
+    size_t *sizes = calloc(big_count, sizeof(size_t));
+    uint32_t seed = (uint32_t) (uintptr_t) &chunks;
+    struct timespec start, end;
+    double alloc_total = 0;
+    double free_total = 0;
+
+    for(int32_t i = 0; i < big_count; i++) {
+        sizes[i] = MIN_BIG_SZ + (rand_r(&seed) % (MAX_BIG_SZ - MIN_BIG_SZ));
+        chunks[i] = iso_alloc(sizes[i]);
+
+        if(chunks[i] == NULL) {
+            LOG_AND_ABORT("Failed to allocate %lu bytes", sizes[i]);
+        }
+    }
+
+    const int32_t half = big_count / 2;
+
+    for(int32_t r = 0; r < ROUNDS; r++) {
+        /* Shuffle so frees don't follow allocation order */
+        for(int32_t i = big_count - 1; i > 0; i--) {
+            int32_t j = rand_r(&seed) % (i + 1);
+            void *t = chunks[i];
+            size_t s = sizes[i];
+            chunks[i] = chunks[j];
+            sizes[i] = sizes[j];
+            chunks[j] = t;
+            sizes[j] = s;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for(int32_t i = 0; i < half; i++) {
+            iso_free(chunks[i]);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        free_total += elapsed(&start, &end);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for(int32_t i = 0; i < half; i++) {
+            chunks[i] = iso_alloc(sizes[i]);
+
+            if(chunks[i] == NULL) {
+                LOG_AND_ABORT("Failed to allocate %lu bytes", sizes[i]);
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        alloc_total += elapsed(&start, &end);
+    }
+
+    const uint64_t ops = (uint64_t) half * ROUNDS;
+    fprintf(stdout, "iso_free %lu big allocations with %d live in %f seconds (%.1f ns/free)\n",
+            ops, big_count, free_total, (free_total * 1000000000.0) / ops);
+    fprintf(stdout, "iso_alloc %lu big allocations with %d live in %f seconds (%.1f ns/alloc)\n",
+            ops, big_count, alloc_total, (alloc_total * 1000000000.0) / ops);
+
+    for(int32_t i = 0; i < big_count; i++) {
+        iso_free(chunks[i]);
+    }
+
+    free(chunks);
+    free(sizes);
+
+    return 0;
+}
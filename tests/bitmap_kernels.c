@@ -0,0 +1,84 @@
+/* iso_alloc bitmap_kernels.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <time.h>
+
+/* This benchmark measures each bitmap kernel the CPU
+ * supports over a bitmap the size of the largest zone
+ * bitmap. A sparse bitmap is what the leak detector and
+ * zone verification see in a mostly empty zone, and a
+ * near full bitmap is the worst case for finding the
+ * few free chunks that remain */
+
+#define BITMAP_QWORDS 8192
+#define ROUNDS 4096
+
+static const char *kernel_names[BITMAP_KERNEL_COUNT] = {"portable", "avx2", "avx512", "neon"};
+
+double elapsed(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + ((end->tv_nsec - start->tv_nsec) / 1000000000.0);
+}
+
+void run(const char *name, const bitmap_index_t *bm, int32_t state) {
+    struct timespec start, end;
+
+    for(int32_t kernel = 0; kernel < BITMAP_KERNEL_COUNT; kernel++) {
+        if(bitmap_kernel_supported(kernel) == false) {
+            continue;
+        }
+
+        volatile uint64_t sink = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for(int32_t r = 0; r < ROUNDS; r++) {
+            for(int64_t i = bitmap_find_with(kernel, bm, 0, BITMAP_QWORDS, state); i < BITMAP_QWORDS;
+                i = bitmap_find_with(kernel, bm, i + 1, BITMAP_QWORDS, state)) {
+                sink += i;
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        const double find = elapsed(&start, &end);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for(int32_t r = 0; r < ROUNDS; r++) {
+            sink += bitmap_count_with(kernel, bm, 0, BITMAP_QWORDS, state);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        const double count = elapsed(&start, &end);
+
+        fprintf(stdout, "%-10s %-8s find all %8.1f ns/bitmap, count %8.1f ns/bitmap\n", name, kernel_names[kernel],
+                (find * 1000000000.0) / ROUNDS, (count * 1000000000.0) / ROUNDS);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    bitmap_index_t *bm = calloc(BITMAP_QWORDS, sizeof(bitmap_index_t));
+    uint32_t seed = (uint32_t) (uintptr_t) &bm;
+
+    /* One in-use chunk every 256 qwords */
+    for(int64_t i = 0; i < BITMAP_QWORDS; i += 256) {
+        bm[i] = 1ULL << ((rand_r(&seed) % 32) * BITS_PER_CHUNK);
+    }
+
+    run("sparse", bm, BITMAP_STATE_IN_USE);
+
+    /* Every chunk in use except one every 256 qwords */
+    for(int64_t i = 0; i < BITMAP_QWORDS; i++) {
+        bm[i] = ~0ULL;
+
+        if((i % 256) == 0) {
+            bm[i] &= ~(1ULL << ((rand_r(&seed) % 32) * BITS_PER_CHUNK));
+        }
+    }
+
+    run("near full", bm, BITMAP_STATE_FREE);
+
+    free(bm);
+
+    return 0;
+}
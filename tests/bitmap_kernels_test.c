@@ -0,0 +1,114 @@
+/* iso_alloc bitmap_kernels_test.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+/* This test compares every bitmap kernel the CPU supports
+ * against a scalar walk of the bitmap that uses GET_BIT,
+ * for random, sparse and full bitmaps and unaligned
+ * start and end indexes */
+
+#define BITMAP_QWORDS 1027
+#define ROUNDS 256
+
+/* Returns true if a chunk with these bits is in state */
+bool chunk_match(int64_t bit, int64_t bit_two, int32_t state) {
+    switch(state) {
+    case BITMAP_STATE_FREE:
+        return bit == 0;
+    case BITMAP_STATE_IN_USE:
+        return bit == 1;
+    case BITMAP_STATE_USED:
+        return bit_two == 1;
+    default:
+        return bit == 0 && bit_two == 1;
+    }
+}
+
+uint64_t scalar_count(const uint64_t *bm, int64_t start, int64_t end, int32_t state) {
+    uint64_t count = 0;
+
+    for(int64_t i = start; i < end; i++) {
+        for(int64_t j = 0; j < BITS_PER_QWORD; j += BITS_PER_CHUNK) {
+            count += chunk_match(GET_BIT(bm[i], j), GET_BIT(bm[i], (j + 1)), state);
+        }
+    }
+
+    return count;
+}
+
+int64_t scalar_find(const uint64_t *bm, int64_t start, int64_t end, int32_t state) {
+    for(int64_t i = start; i < end; i++) {
+        for(int64_t j = 0; j < BITS_PER_QWORD; j += BITS_PER_CHUNK) {
+            if(chunk_match(GET_BIT(bm[i], j), GET_BIT(bm[i], (j + 1)), state) == true) {
+                return i;
+            }
+        }
+    }
+
+    return end;
+}
+
+uint64_t random_qword(uint32_t *seed, int32_t mode) {
+    uint64_t b = ((uint64_t) rand_r(seed) << 33) ^ ((uint64_t) rand_r(seed) << 11) ^ rand_r(seed);
+
+    switch(mode) {
+    case 0:
+        return b;
+    case 1:
+        /* Mostly empty with a rare chunk set */
+        return (rand_r(seed) % 64) == 0 ? b & (b >> 7) : 0;
+    case 2:
+        /* Mostly full with a rare chunk free or freed */
+        return (rand_r(seed) % 64) == 0 ? ~(b & (b >> 7)) : ~0ULL;
+    default:
+        /* Every chunk has been used, most are in use */
+        return (rand_r(seed) % 64) == 0 ? ~ALLOCATED_BITSLOTS : ~0ULL;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t *bm = calloc(BITMAP_QWORDS, sizeof(uint64_t));
+    uint32_t seed = (uint32_t) (uintptr_t) &bm;
+
+    if(_bitmap_kernel_supported(BITMAP_KERNEL_PORTABLE) == false) {
+        LOG_AND_ABORT("The portable bitmap kernel must always be supported");
+    }
+
+    for(int32_t r = 0; r < ROUNDS; r++) {
+        for(int64_t i = 0; i < BITMAP_QWORDS; i++) {
+            bm[i] = random_qword(&seed, r % 4);
+        }
+
+        const int64_t start = rand_r(&seed) % BITMAP_QWORDS;
+        const int64_t end = start + (rand_r(&seed) % (BITMAP_QWORDS - start + 1));
+
+        for(int32_t state = 0; state < BITMAP_STATE_COUNT; state++) {
+            const int64_t found = scalar_find(bm, start, end, state);
+            const uint64_t count = scalar_count(bm, start, end, state);
+
+            for(int32_t kernel = 0; kernel < BITMAP_KERNEL_COUNT; kernel++) {
+                if(_bitmap_kernel_supported(kernel) == false) {
+                    continue;
+                }
+
+                int64_t f = _bitmap_find_with(kernel, bm, start, end, state);
+
+                if(f != found) {
+                    LOG_AND_ABORT("Kernel %d found qword %ld for state %d in [%ld, %ld), expected %ld", kernel, f, state, start, end, found);
+                }
+
+                uint64_t c = _bitmap_count_with(kernel, bm, start, end, state);
+
+                if(c != count) {
+                    LOG_AND_ABORT("Kernel %d counted %lu chunks for state %d in [%ld, %ld), expected %lu", kernel, c, state, start, end, count);
+                }
+            }
+        }
+    }
+
+    free(bm);
+
+    return 0;
+}
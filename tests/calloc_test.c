@@ -0,0 +1,67 @@
+/* iso_alloc calloc_test.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+/* calloc only clears the parts of a chunk that aren't
+ * already known to be zero. This dirties chunks of sizes
+ * from 16 bytes to big allocations and reuses them while
+ * their pages are still dirty and after they are purged.
+ * Every calloc must return zeros */
+
+#define ROUNDS 4
+#define COUNT 256
+#define SIZES 9
+
+const size_t sizes[SIZES] = {16, 72, 256, 1000, 4096, 65536, 300000, 1048576, 4194304};
+
+void check_zero(const uint8_t *p, size_t size) {
+    for(size_t i = 0; i < size; i++) {
+        if(p[i] != 0) {
+            LOG_AND_ABORT("calloc(%zu) returned 0x%p with byte %zu set to 0x%x", size, p, i, p[i]);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    void *p[COUNT];
+
+    for(int32_t r = 0; r < ROUNDS; r++) {
+        for(int32_t s = 0; s < SIZES; s++) {
+            const size_t count = (sizes[s] >= 1048576) ? 8 : COUNT;
+
+            for(size_t i = 0; i < count; i++) {
+                p[i] = calloc(1, sizes[s]);
+                check_zero(p[i], sizes[s]);
+                memset(p[i], 0x41, sizes[s]);
+            }
+
+            /* Every other chunk is free'd and reused while
+             * its neighbors keep their pages dirty */
+            for(size_t i = 0; i < count; i += 2) {
+                free(p[i]);
+            }
+
+            if(r & 1) {
+                iso_flush_caches();
+            }
+
+            for(size_t i = 0; i < count; i += 2) {
+                p[i] = calloc(1, sizes[s]);
+                check_zero(p[i], sizes[s]);
+                memset(p[i], 0x41, sizes[s]);
+            }
+
+            /* Then all of them are free'd so their pages
+             * can be purged before the next round */
+            for(size_t i = 0; i < count; i++) {
+                free(p[i]);
+            }
+
+            iso_flush_caches();
+        }
+    }
+
+    return 0;
+}
@@ -46,6 +46,33 @@ int main(int argc, char *argv[]) {
 
     iso_free_permanently(p);
 
+    /* Test iso_alloc_batch() and iso_free_batch() */
+    const size_t batch_sizes[] = {16, 100, 256, 4096, 65536, 4194304};
+
+    for(size_t s = 0; s < sizeof(batch_sizes) / sizeof(size_t); s++) {
+        void *batch[256];
+        const size_t count = (batch_sizes[s] > 65536) ? 4 : 256;
+
+        if(iso_alloc_batch(batch_sizes[s], count, batch) != count) {
+            LOG_AND_ABORT("iso_alloc_batch failed to allocate %zu chunks of %zu bytes", count, batch_sizes[s]);
+        }
+
+        for(size_t i = 0; i < count; i++) {
+            assert((iso_chunksz(batch[i])) >= batch_sizes[s]);
+            memset(batch[i], 0x41, batch_sizes[s]);
+            *(size_t *) batch[i] = i;
+        }
+
+        /* Chunks handed out twice would overwrite each other */
+        for(size_t i = 0; i < count; i++) {
+            if(*(size_t *) batch[i] != i) {
+                LOG_AND_ABORT("iso_alloc_batch returned chunk 0x%p more than once", batch[i]);
+            }
+        }
+
+        iso_free_batch(batch, count);
+    }
+
     iso_alloc_zone_handle *zone = iso_alloc_new_zone(256);
 
     if(zone == NULL) {
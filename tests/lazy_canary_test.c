@@ -0,0 +1,105 @@
+/* iso_alloc lazy_canary_test.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+#include "iso_alloc.h"
+
+/* A new zone picks its canary chunks up front but only
+ * writes the canaries on a page when one of its chunks is
+ * allocated. This checks a zone with one chunk in use has
+ * barely any resident user pages, and that once it's full
+ * every canary chunk is still there and verifies */
+
+#define CHUNK_SZ 64
+
+iso_alloc_zone_t *find_zone(iso_alloc_root *root, void *p) {
+    for(uint32_t i = 0; i < root->zones_used; i++) {
+        iso_alloc_zone_t *zone = &root->zones[i];
+        void *user_pages_start = (void *) ((uintptr_t) zone->user_pages_start ^ zone->pointer_mask);
+
+        if(p >= user_pages_start && p < (user_pages_start + ZONE_USER_SIZE)) {
+            return zone;
+        }
+    }
+
+    return NULL;
+}
+
+uint64_t count_canaries(iso_alloc_zone_t *zone) {
+    const bitmap_index_t *bm = (bitmap_index_t *) ((uintptr_t) zone->bitmap_start ^ zone->pointer_mask);
+    uint64_t count = 0;
+
+    for(uint64_t i = 0; i < (zone->bitmap_size / sizeof(bitmap_index_t)); i++) {
+        const uint64_t b = (uint64_t) bm[i];
+        count += __builtin_popcountll(b & (b >> 1) & 0x5555555555555555ULL);
+    }
+
+    return count;
+}
+
+size_t resident_pages(void *p, size_t size) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    unsigned char vec[ZONE_USER_SIZE / 4096];
+    size_t resident = 0;
+
+    if(mincore(p, size, vec) != 0) {
+        LOG_AND_ABORT("mincore failed");
+    }
+
+    for(size_t i = 0; i < size / page_size; i++) {
+        resident += (vec[i] & 1);
+    }
+
+    return resident;
+}
+
+int main(int argc, char *argv[]) {
+#if DISABLE_CANARY
+    /* Zones have no canary chunks to check */
+    return 0;
+#endif
+
+    iso_alloc_zone_handle *handle = iso_alloc_new_zone(CHUNK_SZ);
+    iso_alloc_root *root = _get_root();
+    void *p = iso_alloc_from_zone(handle);
+    iso_alloc_zone_t *zone = find_zone(root, p);
+
+    if(zone == NULL) {
+        LOG_AND_ABORT("Could not find the zone for 0x%p", p);
+    }
+
+    void *user_pages_start = (void *) ((uintptr_t) zone->user_pages_start ^ zone->pointer_mask);
+    const size_t pages = ZONE_USER_SIZE / sysconf(_SC_PAGESIZE);
+    const size_t resident = resident_pages(user_pages_start, ZONE_USER_SIZE);
+
+    if(resident > (pages / 8)) {
+        LOG_AND_ABORT("%lu of %lu user pages are resident after 1 allocation", resident, pages);
+    }
+
+    const uint64_t canaries = count_canaries(zone);
+
+    if(canaries == 0) {
+        LOG_AND_ABORT("Zone[%d] has no canary chunks", zone->index);
+    }
+
+    /* Canary chunks are never handed out so they are
+     * all still there once the zone is full */
+    uint64_t allocated = 1;
+
+    while(iso_alloc_from_zone(handle) != NULL) {
+        allocated++;
+    }
+
+    if(count_canaries(zone) != canaries || (allocated + canaries) != (ZONE_USER_SIZE / CHUNK_SZ)) {
+        LOG_AND_ABORT("Zone[%d] allocated %lu chunks and has %lu canaries, it started with %lu", zone->index, allocated, count_canaries(zone), canaries);
+    }
+
+    if(zone->purged_pages != 0) {
+        LOG_AND_ABORT("Zone[%d] is full but %d pages have no canaries", zone->index, zone->purged_pages);
+    }
+
+    iso_verify_zone(handle);
+    iso_alloc_destroy_zone(handle);
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+/* iso_alloc medium_zones.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <time.h>
+
+/* This benchmark sweeps allocation sizes from 64kb to
+ * 4mb. For each size it keeps a small working set of
+ * live allocations, replacing the oldest one with a
+ * new allocation that is written to. Build it with
+ * MEDIUM_ZONES enabled and disabled to compare medium
+ * zones with the big zone path */
+
+#define MIN_SWEEP_SZ 65536
+#define MAX_SWEEP_SZ 4194304
+#define WORKING_SET 16
+#define ALLOCATIONS 8192
+
+double elapsed(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + ((end->tv_nsec - start->tv_nsec) / 1000000000.0);
+}
+
+int main(int argc, char *argv[]) {
+    struct timespec start, end;
+    void *live[WORKING_SET];
+
+    for(size_t size = MIN_SWEEP_SZ; size <= MAX_SWEEP_SZ; size += (size >> 1)) {
+        memset(live, 0x0, sizeof(live));
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for(int32_t i = 0; i < ALLOCATIONS; i++) {
+            /* Vary the size a little so not every request
+             * is the same multiple of the page size */
+            const size_t s = size - ((i & 7) << 10);
+            void *p = iso_alloc(s);
+
+            if(p == NULL) {
+                LOG_AND_ABORT("Failed to allocate %lu bytes", s);
+            }
+
+            memset(p, 0x41, 128);
+            iso_free(live[i % WORKING_SET]);
+            live[i % WORKING_SET] = p;
+        }
+
+        for(int32_t i = 0; i < WORKING_SET; i++) {
+            iso_free(live[i]);
+        }
+
+        iso_flush_caches();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double t = elapsed(&start, &end);
+        fprintf(stdout, "%8lu byte allocations %d alloc/free pairs in %f seconds (%.1f ns/pair)\n",
+                size, ALLOCATIONS, t, (t * 1000000000.0) / ALLOCATIONS);
+    }
+
+    return 0;
+}
@@ -0,0 +1,115 @@
+/* iso_alloc rand_perf.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <time.h>
+
+#if __linux__
+#include <dlfcn.h>
+#include <stdarg.h>
+#include <sys/syscall.h>
+#endif
+
+/* This benchmark measures the cost of rand_uint64()
+ * and of creating and destroying a zone, which calls
+ * it for every canary and mmap hint. On Linux it also
+ * counts the getrandom syscalls made along the way.
+ * Build with BUFFERED_RANDOM enabled and disabled to
+ * compare the two */
+
+#define RAND_COUNT 1000000
+#define ZONE_COUNT 1000
+
+#if __linux__
+static uint64_t getrandom_calls;
+
+/* Interpose syscall() to count the getrandom
+ * calls made by rand_entropy() */
+long syscall(long number, ...) {
+    static long (*real_syscall)(long, ...);
+    long a[6];
+    va_list ap;
+
+    if(real_syscall == NULL) {
+        real_syscall = dlsym(RTLD_NEXT, "syscall");
+    }
+
+    if(number == SYS_getrandom) {
+        getrandom_calls++;
+    }
+
+    va_start(ap, number);
+
+    for(int32_t i = 0; i < 6; i++) {
+        a[i] = va_arg(ap, long);
+    }
+
+    va_end(ap);
+
+    return real_syscall(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+#endif
+
+double elapsed(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + ((end->tv_nsec - start->tv_nsec) / 1000000000.0);
+}
+
+int main(int argc, char *argv[]) {
+    struct timespec start, end;
+    uint64_t calls = 0;
+    volatile uint64_t sink = 0;
+
+    /* Initialize the allocator outside of the timed loops */
+    iso_free(iso_alloc(ZONE_64));
+
+#if __linux__
+    calls = getrandom_calls;
+#endif
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for(int32_t i = 0; i < RAND_COUNT; i++) {
+        sink = rand_uint64();
+    }
+
+    (void) sink;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+#if __linux__
+    calls = getrandom_calls - calls;
+#endif
+
+    double t = elapsed(&start, &end);
+    fprintf(stdout, "rand_uint64() %d calls in %f seconds (%.1f ns/call, %lu getrandom syscalls)\n",
+            RAND_COUNT, t, (t * 1000000000.0) / RAND_COUNT, calls);
+
+#if __linux__
+    calls = getrandom_calls;
+#endif
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for(int32_t i = 0; i < ZONE_COUNT; i++) {
+        iso_alloc_zone_handle *zone = iso_alloc_new_zone(ZONE_256);
+
+        if(zone == NULL) {
+            LOG_AND_ABORT("Failed to create a zone");
+        }
+
+        iso_alloc_destroy_zone(zone);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+#if __linux__
+    calls = getrandom_calls - calls;
+#endif
+
+    t = elapsed(&start, &end);
+    fprintf(stdout, "iso_alloc_new_zone() %d zones in %f seconds (%.1f us/zone, %.1f getrandom syscalls/zone)\n",
+            ZONE_COUNT, t, (t * 1000000.0) / ZONE_COUNT, (double) calls / ZONE_COUNT);
+
+    return 0;
+}
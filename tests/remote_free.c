@@ -0,0 +1,127 @@
+/* iso_alloc remote_free.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <time.h>
+
+/* This benchmark measures cross thread frees. Each
+ * producer thread allocates small chunks and passes
+ * them through a ring to a consumer thread which
+ * frees them. We report frees per second for 1 to
+ * N producer/consumer pairs */
+
+uint32_t allocation_sizes[] = {ZONE_16, ZONE_32, ZONE_64, ZONE_128,
+                               ZONE_256, ZONE_512, ZONE_1024};
+
+#define RING_SIZE 1024
+#define CHUNK_COUNT 1048576
+
+#if MALLOC_PERF_TEST
+#define alloc_mem malloc
+#define free_mem free
+#else
+#define alloc_mem iso_alloc
+#define free_mem iso_free
+#endif
+
+typedef struct {
+    void *ring[RING_SIZE];
+    uint64_t head;
+    uint64_t tail;
+} ring_t;
+
+void *producer(void *arg) {
+    ring_t *r = (ring_t *) arg;
+    uint32_t seed = (uint32_t) (uintptr_t) &r;
+
+    for(uint64_t i = 0; i < CHUNK_COUNT; i++) {
+        size_t size = allocation_sizes[rand_r(&seed) % (sizeof(allocation_sizes) / sizeof(uint32_t))];
+        void *p = alloc_mem(size);
+
+        if(p == NULL) {
+            LOG_AND_ABORT("Failed to allocate %ld bytes", size);
+        }
+
+        *(uint64_t *) p = i;
+
+        while(i - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= RING_SIZE) {
+            sched_yield();
+        }
+
+        r->ring[i & (RING_SIZE - 1)] = p;
+        __atomic_store_n(&r->head, i + 1, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+void *consumer(void *arg) {
+    ring_t *r = (ring_t *) arg;
+
+    for(uint64_t i = 0; i < CHUNK_COUNT; i++) {
+        while(__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == i) {
+            sched_yield();
+        }
+
+        free_mem(r->ring[i & (RING_SIZE - 1)]);
+        __atomic_store_n(&r->tail, i + 1, __ATOMIC_RELEASE);
+    }
+
+#if !MALLOC_PERF_TEST
+    iso_flush_caches();
+#endif
+
+    return NULL;
+}
+
+double run_pairs(int32_t pair_count) {
+    pthread_t producers[pair_count];
+    pthread_t consumers[pair_count];
+    ring_t *rings = calloc(pair_count, sizeof(ring_t));
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for(int32_t i = 0; i < pair_count; i++) {
+        pthread_create(&consumers[i], NULL, consumer, &rings[i]);
+        pthread_create(&producers[i], NULL, producer, &rings[i]);
+    }
+
+    for(int32_t i = 0; i < pair_count; i++) {
+        pthread_join(producers[i], NULL);
+        pthread_join(consumers[i], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(rings);
+
+    return (end.tv_sec - start.tv_sec) + ((end.tv_nsec - start.tv_nsec) / 1000000000.0);
+}
+
+int main(int argc, char *argv[]) {
+    int32_t max_pairs;
+
+    if(argc != 2) {
+        max_pairs = sysconf(_SC_NPROCESSORS_ONLN) / 2;
+    } else {
+        max_pairs = atol(argv[1]);
+    }
+
+    if(max_pairs <= 0) {
+        max_pairs = 1;
+    }
+
+    for(int32_t t = 1; t <= max_pairs; t++) {
+        double total = run_pairs(t);
+        double frees = ((uint64_t) CHUNK_COUNT * t) / total;
+
+#if MALLOC_PERF_TEST
+        fprintf(stdout, "malloc/free %d producer/consumer pairs %lu remote frees in %f seconds (%.0f frees/sec)\n", t, (uint64_t) CHUNK_COUNT * t, total, frees);
+#else
+        fprintf(stdout, "iso_alloc/iso_free %d producer/consumer pairs %lu remote frees in %f seconds (%.0f frees/sec)\n", t, (uint64_t) CHUNK_COUNT * t, total, frees);
+#endif
+    }
+
+    return 0;
+}
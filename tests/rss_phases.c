@@ -0,0 +1,85 @@
+/* iso_alloc rss_phases.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+/* This benchmark reports RSS over time for a program that
+ * allocates a large number of small chunks in one spike
+ * and then frees most of them in several steps, leaving
+ * a sparse set of chunks live in every zone. Without page
+ * purging none of these zones are ever empty so their
+ * pages stay resident until the program exits */
+
+#define SPIKE_CHUNKS 1048576
+#define DRAIN_STEPS 4
+#define KEEP_EVERY 64
+
+size_t rss_kb() {
+    FILE *fp = fopen("/proc/self/statm", "r");
+    size_t size = 0, resident = 0;
+
+    if(fp == NULL) {
+        return 0;
+    }
+
+    if(fscanf(fp, "%zu %zu", &size, &resident) != 2) {
+        resident = 0;
+    }
+
+    fclose(fp);
+
+    return (resident * g_page_size) / 1024;
+}
+
+int main(int argc, char *argv[]) {
+    void **chunks = calloc(SPIKE_CHUNKS, sizeof(void *));
+    uint32_t seed = (uint32_t) (uintptr_t) &chunks;
+
+    fprintf(stdout, "start        %8zu KB\n", rss_kb());
+
+    for(int32_t i = 0; i < SPIKE_CHUNKS; i++) {
+        chunks[i] = iso_alloc(16 << (rand_r(&seed) % 6));
+        memset(chunks[i], 0x41, 16);
+    }
+
+    fprintf(stdout, "spike        %8zu KB\n", rss_kb());
+
+    for(int32_t step = 0; step < DRAIN_STEPS; step++) {
+        for(int32_t i = step; i < SPIKE_CHUNKS; i += DRAIN_STEPS) {
+            if((i % KEEP_EVERY) != 0) {
+                iso_free(chunks[i]);
+                chunks[i] = NULL;
+            }
+        }
+
+        fprintf(stdout, "drain %d/%d    %8zu KB\n", step + 1, DRAIN_STEPS, rss_kb());
+    }
+
+    iso_flush_caches();
+
+    fprintf(stdout, "flush        %8zu KB\n", rss_kb());
+
+    /* Allocate into the purged pages again so their
+     * canaries have to be rewritten before reuse */
+    for(int32_t i = 0; i < SPIKE_CHUNKS; i++) {
+        if(chunks[i] == NULL) {
+            chunks[i] = iso_alloc(16 << (rand_r(&seed) % 6));
+            memset(chunks[i], 0x41, 16);
+        }
+    }
+
+    fprintf(stdout, "refill       %8zu KB\n", rss_kb());
+
+    iso_verify_zones();
+
+    for(int32_t i = 0; i < SPIKE_CHUNKS; i++) {
+        if(chunks[i] != NULL) {
+            iso_free(chunks[i]);
+        }
+    }
+
+    free(chunks);
+
+    return 0;
+}
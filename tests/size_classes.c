@@ -0,0 +1,89 @@
+/* iso_alloc size_classes.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <sys/resource.h>
+#include <time.h>
+
+/* This benchmark measures throughput and peak RSS for a
+ * mix of allocation sizes that are rarely a power of 2.
+ * It keeps a working set of live chunks and replaces a
+ * random one on every iteration. Most requests are small
+ * with a long tail of larger ones, which is typical of
+ * real programs */
+
+#define DEFAULT_LIVE_COUNT_TEST 131072
+#define ITERATIONS 1048576
+
+double elapsed(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + ((end->tv_nsec - start->tv_nsec) / 1000000000.0);
+}
+
+size_t random_size(uint32_t *seed) {
+    const uint32_t r = rand_r(seed) % 100;
+
+    if(r < 50) {
+        return 8 + (rand_r(seed) % 120);
+    } else if(r < 80) {
+        return 129 + (rand_r(seed) % 896);
+    } else if(r < 95) {
+        return 1025 + (rand_r(seed) % 7168);
+    } else {
+        return 8193 + (rand_r(seed) % 57344);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int32_t live_count = DEFAULT_LIVE_COUNT_TEST;
+
+    if(argc == 2) {
+        live_count = atol(argv[1]);
+    }
+
+    if(live_count <= 0) {
+        LOG_AND_ABORT("Live chunk count must be greater than 0");
+    }
+
+    void **chunks = calloc(live_count, sizeof(void *));
+    uint32_t seed = (uint32_t) (uintptr_t) &chunks;
+    uint64_t requested = 0;
+    struct timespec start, end;
+    struct rusage usage;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for(int32_t i = 0; i < live_count; i++) {
+        const size_t size = random_size(&seed);
+        chunks[i] = iso_alloc(size);
+        memset(chunks[i], 0x41, size);
+        requested += size;
+    }
+
+    for(int32_t i = 0; i < ITERATIONS; i++) {
+        const int32_t j = rand_r(&seed) % live_count;
+        const size_t size = random_size(&seed);
+        iso_free(chunks[j]);
+        chunks[j] = iso_alloc(size);
+        memset(chunks[j], 0x41, size);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &usage);
+
+    const double total = elapsed(&start, &end);
+    const uint64_t ops = (uint64_t) live_count + ITERATIONS;
+
+    fprintf(stdout, "%lu allocations with %d live in %f seconds (%.1f ns/alloc+free)\n",
+            ops, live_count, total, (total * 1000000000.0) / ops);
+    fprintf(stdout, "Initial working set requested %lu KB, peak RSS %ld KB, %d zones\n",
+            requested / 1024, usage.ru_maxrss, _root->zones_used);
+
+    for(int32_t i = 0; i < live_count; i++) {
+        iso_free(chunks[i]);
+    }
+
+    free(chunks);
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+/* iso_alloc startup_latency.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <sys/wait.h>
+#include <time.h>
+
+/* This benchmark reports the time from exec to the first
+ * allocation returning, which is what a short lived CLI
+ * tool or a fork-exec worker pays on every start. It runs
+ * itself RUNS times, passing the time it called execv and
+ * a pipe. The child makes one allocation in main() and
+ * writes back how long it took to get there */
+
+#define RUNS 256
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+int compare(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+    if(argc == 3) {
+        void *p = iso_alloc(32);
+        uint64_t elapsed = now_ns() - strtoull(argv[1], NULL, 10);
+
+        if(write(atoi(argv[2]), &elapsed, sizeof(elapsed)) != sizeof(elapsed)) {
+            return -1;
+        }
+
+        iso_free(p);
+        return 0;
+    }
+
+    uint64_t lat[RUNS];
+    char start[32];
+    char fd[16];
+
+    for(int32_t i = 0; i < RUNS; i++) {
+        int pipefd[2];
+
+        if(pipe(pipefd) != 0) {
+            LOG_AND_ABORT("Failed to create a pipe");
+        }
+
+        snprintf(fd, sizeof(fd), "%d", pipefd[1]);
+        snprintf(start, sizeof(start), "%lu", now_ns());
+
+        pid_t pid = fork();
+
+        if(pid == 0) {
+            char *args[] = {"/proc/self/exe", start, fd, NULL};
+            execv(args[0], args);
+            _exit(-1);
+        }
+
+        close(pipefd[1]);
+
+        if(read(pipefd[0], &lat[i], sizeof(lat[i])) != sizeof(lat[i])) {
+            LOG_AND_ABORT("Failed to read the latency of run %d", i);
+        }
+
+        close(pipefd[0]);
+        waitpid(pid, NULL, 0);
+    }
+
+    qsort(lat, RUNS, sizeof(uint64_t), compare);
+    fprintf(stdout, "exec to first malloc %d runs p50 %8lu ns p99 %8lu ns\n", RUNS, lat[RUNS / 2], lat[(RUNS * 99) / 100]);
+
+    return 0;
+}
@@ -0,0 +1,52 @@
+/* iso_alloc startup_rss.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+/* This benchmark reports RSS as soon as main() runs, when
+ * the constructor has already created the default zones,
+ * and again after a program that makes a handful of small
+ * allocations. Zone creation should not fault in the user
+ * pages of zones that are never used */
+
+#define SMALL_ALLOCS 64
+
+size_t rss_kb() {
+    FILE *fp = fopen("/proc/self/statm", "r");
+    size_t size = 0, resident = 0;
+
+    if(fp == NULL) {
+        return 0;
+    }
+
+    if(fscanf(fp, "%zu %zu", &size, &resident) != 2) {
+        resident = 0;
+    }
+
+    fclose(fp);
+
+    return (resident * g_page_size) / 1024;
+}
+
+int main(int argc, char *argv[]) {
+    /* Read before stdio allocates anything */
+    const size_t start = rss_kb();
+    void *p[SMALL_ALLOCS];
+
+    for(int32_t i = 0; i < SMALL_ALLOCS; i++) {
+        p[i] = iso_alloc(16 << (i % 10));
+        memset(p[i], 0x41, 16);
+    }
+
+    const size_t used = rss_kb();
+
+    fprintf(stdout, "main()       %8zu KB\n", start);
+    fprintf(stdout, "%d allocs    %8zu KB\n", SMALL_ALLOCS, used);
+
+    for(int32_t i = 0; i < SMALL_ALLOCS; i++) {
+        iso_free(p[i]);
+    }
+
+    return 0;
+}
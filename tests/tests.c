@@ -63,6 +63,46 @@ int reallocate(size_t array_size, size_t allocation_size) {
     return OK;
 }
 
+/* Grows a buffer the way a string or vector does, a few
+ * bytes at a time and then by doubling, and shrinks it
+ * back. The contents must survive every step */
+int regrow(size_t max_size, size_t step) {
+    size_t size = step;
+    uint8_t *p = alloc_mem(size);
+    memset(p, 0x41, size);
+
+    while(size < max_size) {
+        size_t new_size = (size < 4096) ? size + step : size * 2;
+        p = realloc_mem(p, new_size);
+
+        if(p == NULL) {
+            LOG_AND_ABORT("Failed to reallocate %ld bytes after %d total allocations", new_size, alloc_count);
+        }
+
+        if(p[0] != 0x41 || p[size - 1] != 0x41) {
+            LOG_AND_ABORT("Reallocation to %ld bytes lost the contents of the chunk", new_size);
+        }
+
+        memset(p + size, 0x41, new_size - size);
+        size = new_size;
+        alloc_count++;
+    }
+
+    while(size > step) {
+        size = size / 2;
+        p = realloc_mem(p, size);
+
+        if(p == NULL || p[0] != 0x41 || p[size - 1] != 0x41) {
+            LOG_AND_ABORT("Reallocation to %ld bytes lost the contents of the chunk", size);
+        }
+
+        alloc_count++;
+    }
+
+    free_mem(p);
+    return OK;
+}
+
 int callocate(size_t array_size, size_t allocation_size) {
     void *p[array_size];
     memset(p, 0x0, array_size);
@@ -199,5 +239,22 @@ int main(int argc, char *argv[]) {
     fprintf(stdout, "iso_realloc/iso_free %d tests completed in %f seconds\n", alloc_count, total);
 #endif
 
+    alloc_count = 0;
+    start = clock();
+
+    for(int i = 0; i < 64; i++) {
+        regrow(4194304, 8);
+        regrow(65536, 24);
+    }
+
+    end = clock();
+    total = ((double) (end - start)) / CLOCKS_PER_SEC;
+
+#if MALLOC_PERF_TEST
+    fprintf(stdout, "realloc growth %d tests completed in %f seconds\n", alloc_count, total);
+#else
+    fprintf(stdout, "iso_realloc growth %d tests completed in %f seconds\n", alloc_count, total);
+#endif
+
     return 0;
 }
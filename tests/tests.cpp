@@ -40,6 +40,12 @@ class Derived : Base {
     uint32_t count;
 };
 
+/* Uses the C++17 aligned new and delete overloads */
+class alignas(4096) PageAligned {
+  public:
+    uint8_t data[64];
+};
+
 int allocate(size_t array_size, size_t allocation_size) {
     void *p[array_size];
     memset(p, 0x0, array_size);
@@ -92,6 +98,18 @@ int main(int argc, char *argv[]) {
         auto d = std::make_unique<Derived>(i);
     }
 
+    for(size_t i = 0; i < 64; i++) {
+        PageAligned *p = new PageAligned();
+        PageAligned *a = new PageAligned[i + 1];
+
+        if(((uintptr_t) p & 4095) != 0 || ((uintptr_t) a & 4095) != 0) {
+            LOG_AND_ABORT("Aligned new returned 0x%p and 0x%p", p, a);
+        }
+
+        delete p;
+        delete[] a;
+    }
+
     iso_verify_zones();
 
     return 0;
@@ -0,0 +1,106 @@
+/* iso_alloc thread_scaling.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <time.h>
+
+/* This benchmark measures how alloc/free throughput
+ * scales as threads are added. Each thread allocates
+ * and frees small chunks in batches and we report the
+ * combined operations per second for 1 to N threads */
+
+uint32_t allocation_sizes[] = {ZONE_16, ZONE_32, ZONE_64, ZONE_128,
+                               ZONE_256, ZONE_512, ZONE_1024};
+
+#define BATCH_SIZE 64
+#define BATCH_COUNT 4096
+
+#if MALLOC_PERF_TEST
+#define alloc_mem malloc
+#define free_mem free
+#else
+#define alloc_mem iso_alloc
+#define free_mem iso_free
+#endif
+
+void *allocate(void *unused) {
+    void *p[BATCH_SIZE];
+    uint32_t seed = (uint32_t) (uintptr_t) &p;
+
+    for(int32_t i = 0; i < BATCH_COUNT; i++) {
+        for(int32_t y = 0; y < BATCH_SIZE; y++) {
+            size_t size = allocation_sizes[rand_r(&seed) % (sizeof(allocation_sizes) / sizeof(uint32_t))];
+            p[y] = alloc_mem(size);
+
+            if(p[y] == NULL) {
+                LOG_AND_ABORT("Failed to allocate %ld bytes", size);
+            }
+
+            *(uint64_t *) p[y] = y;
+        }
+
+        for(int32_t y = 0; y < BATCH_SIZE; y++) {
+            free_mem(p[y]);
+        }
+    }
+
+#if !MALLOC_PERF_TEST
+    iso_flush_caches();
+#endif
+
+    return NULL;
+}
+
+double run_threads(int32_t thread_count) {
+    pthread_t threads[thread_count];
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for(int32_t i = 0; i < thread_count; i++) {
+        pthread_create(&threads[i], NULL, allocate, NULL);
+    }
+
+    for(int32_t i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start.tv_sec) + ((end.tv_nsec - start.tv_nsec) / 1000000000.0);
+}
+
+int main(int argc, char *argv[]) {
+    int32_t max_threads;
+
+    if(argc != 2) {
+        max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    } else {
+        max_threads = atol(argv[1]);
+    }
+
+    if(max_threads <= 0) {
+        max_threads = 1;
+    }
+
+    const uint64_t ops_per_thread = (uint64_t) BATCH_SIZE * BATCH_COUNT * 2;
+    double base = 0;
+
+    for(int32_t t = 1; t <= max_threads; t++) {
+        double total = run_threads(t);
+        double ops = (ops_per_thread * t) / total;
+
+        if(t == 1) {
+            base = ops;
+        }
+
+#if MALLOC_PERF_TEST
+        fprintf(stdout, "malloc/free %d threads %lu ops in %f seconds (%.0f ops/sec, %.2fx)\n", t, ops_per_thread * t, total, ops, ops / base);
+#else
+        fprintf(stdout, "iso_alloc/iso_free %d threads %lu ops in %f seconds (%.0f ops/sec, %.2fx)\n", t, ops_per_thread * t, total, ops, ops / base);
+#endif
+    }
+
+    return 0;
+}
@@ -90,6 +90,145 @@ void *allocate(void *_type) {
     return OK;
 }
 
+#if THREAD_ZONES
+/* Chunks freed by a thread that doesn't own their zone
+ * are queued in the zone for the owner to free. These
+ * tests fill the queue so the rest of the chunks take
+ * the zone lock, and free a chunk while its owner exits
+ * and hands the zone back to the shared pool */
+#define REMOTE_CHUNK_SZ 256
+#define REMOTE_CHUNKS (REMOTE_FREE_SZ * 2)
+
+void *remote_chunks[REMOTE_CHUNKS];
+int32_t remote_state;
+pthread_t remote_owner_thread;
+
+void set_remote_state(int32_t state) {
+    __atomic_store_n(&remote_state, state, __ATOMIC_RELEASE);
+}
+
+void wait_remote_state(int32_t state) {
+    while(__atomic_load_n(&remote_state, __ATOMIC_ACQUIRE) != state) {
+        sched_yield();
+    }
+}
+
+iso_alloc_zone_t *find_remote_zone(void *p) {
+    iso_alloc_root *root = _get_root();
+
+    for(uint32_t i = 0; i < root->zones_used; i++) {
+        iso_alloc_zone_t *zone = &root->zones[i];
+        void *user_pages_start = (void *) ((uintptr_t) zone->user_pages_start ^ zone->pointer_mask);
+
+        if(p >= user_pages_start && p < (user_pages_start + ZONE_USER_SZ(zone))) {
+            return zone;
+        }
+    }
+
+    LOG_AND_ABORT("Could not find the zone for 0x%p", p);
+    return NULL;
+}
+
+/* Allocates chunks from a zone this thread owns and
+ * allocates again once another thread has freed them */
+void *remote_owner(void *unused) {
+    for(int32_t i = 0; i < REMOTE_CHUNKS; i++) {
+        remote_chunks[i] = iso_alloc(REMOTE_CHUNK_SZ);
+    }
+
+    set_remote_state(1);
+    wait_remote_state(2);
+
+    /* The next allocation drains the queue */
+    iso_free(iso_alloc(REMOTE_CHUNK_SZ));
+
+    set_remote_state(3);
+    wait_remote_state(4);
+    return NULL;
+}
+
+/* Allocates chunks from a zone this thread owns and
+ * exits, which hands the zone back to the shared pool */
+void *remote_release_owner(void *unused) {
+    for(int32_t i = 0; i < REMOTE_CHUNKS; i++) {
+        remote_chunks[i] = iso_alloc(REMOTE_CHUNK_SZ);
+    }
+
+    set_remote_state(1);
+    wait_remote_state(2);
+    return NULL;
+}
+
+/* Runs after the freeing thread saw the zone is owned
+ * and before its chunk is in the queue */
+void release_remote_zone(iso_alloc_zone_t *zone) {
+    _set_remote_free_hook(NULL);
+    set_remote_state(2);
+    pthread_join(remote_owner_thread, NULL);
+
+    if(__atomic_load_n(&zone->owner, __ATOMIC_ACQUIRE) != 0) {
+        LOG_AND_ABORT("Zone[%d] is still owned after its owner exited", zone->index);
+    }
+}
+
+void run_remote_free_tests() {
+    set_remote_state(0);
+    pthread_create(&remote_owner_thread, NULL, remote_owner, NULL);
+    wait_remote_state(1);
+
+    iso_alloc_zone_t *zone = find_remote_zone(remote_chunks[0]);
+
+    if(__atomic_load_n(&zone->owner, __ATOMIC_ACQUIRE) == 0) {
+        LOG_AND_ABORT("Zone[%d] is not owned by a thread", zone->index);
+    }
+
+    /* The queue holds REMOTE_FREE_SZ chunks, the rest
+     * are freed by this thread under the zone lock */
+    for(int32_t i = 0; i < REMOTE_CHUNKS; i++) {
+        if(find_remote_zone(remote_chunks[i]) != zone) {
+            LOG_AND_ABORT("Chunk 0x%p is not in zone[%d]", remote_chunks[i], zone->index);
+        }
+
+        iso_free_size(remote_chunks[i], REMOTE_CHUNK_SZ);
+    }
+
+    if(__atomic_load_n(&zone->remote_free_count, __ATOMIC_ACQUIRE) != REMOTE_FREE_SZ) {
+        LOG_AND_ABORT("Zone[%d] queued %d chunks, expected %d", zone->index, zone->remote_free_count, REMOTE_FREE_SZ);
+    }
+
+    set_remote_state(2);
+    wait_remote_state(3);
+
+    if(__atomic_load_n(&zone->remote_free_count, __ATOMIC_ACQUIRE) != 0) {
+        LOG_AND_ABORT("Zone[%d] still has %d queued chunks", zone->index, zone->remote_free_count);
+    }
+
+    set_remote_state(4);
+    pthread_join(remote_owner_thread, NULL);
+
+    /* The owner releases the zone and drains its queue
+     * before the chunk lands in it. The freeing thread
+     * sees the zone has no owner and drains it itself */
+    set_remote_state(0);
+    pthread_create(&remote_owner_thread, NULL, remote_release_owner, NULL);
+    wait_remote_state(1);
+
+    zone = find_remote_zone(remote_chunks[0]);
+    _set_remote_free_hook(release_remote_zone);
+    iso_free_size(remote_chunks[0], REMOTE_CHUNK_SZ);
+
+    if(__atomic_load_n(&zone->remote_free_count, __ATOMIC_ACQUIRE) != 0) {
+        LOG_AND_ABORT("Released zone[%d] has %d queued chunks", zone->index, zone->remote_free_count);
+    }
+
+    for(int32_t i = 1; i < REMOTE_CHUNKS; i++) {
+        iso_free_size(remote_chunks[i], REMOTE_CHUNK_SZ);
+    }
+
+    iso_verify_zones();
+}
+#endif
+
 void run_test_threads() {
 #if THREAD_SUPPORT
     pthread_t t;
@@ -113,6 +252,10 @@ int main(int argc, char *argv[]) {
         times = atol(argv[1]);
     }
 
+#if THREAD_ZONES
+    run_remote_free_tests();
+#endif
+
     run_test_threads();
     iso_alloc_detect_leaks();
     iso_verify_zones();
@@ -0,0 +1,94 @@
+/* iso_alloc trim_test.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+/* Fills several zones of a few size classes and keeps
+ * some free big zones around, frees all of it and checks
+ * iso_alloc_trim() gives enough of it back that RSS drops.
+ * The zones it released are then used again */
+
+#define CHUNK_COUNT 131072
+#define BIG_COUNT 8
+#define BIG_SZ 8388608
+
+size_t rss_bytes() {
+    FILE *fp = fopen("/proc/self/statm", "r");
+    size_t size = 0, resident = 0;
+
+    if(fp == NULL) {
+        return 0;
+    }
+
+    if(fscanf(fp, "%zu %zu", &size, &resident) != 2) {
+        resident = 0;
+    }
+
+    fclose(fp);
+
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+void fill(void **chunks) {
+    for(int32_t i = 0; i < CHUNK_COUNT; i++) {
+        chunks[i] = iso_alloc(128 << (i % 4));
+        memset(chunks[i], 0x41, 128);
+    }
+}
+
+void drain(void **chunks) {
+    for(int32_t i = 0; i < CHUNK_COUNT; i++) {
+        iso_free(chunks[i]);
+        chunks[i] = NULL;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    void **chunks = calloc(CHUNK_COUNT, sizeof(void *));
+    void *big[BIG_COUNT];
+
+    fill(chunks);
+
+    for(int32_t i = 0; i < BIG_COUNT; i++) {
+        big[i] = iso_alloc(BIG_SZ);
+        memset(big[i], 0x41, BIG_SZ);
+    }
+
+    for(int32_t i = 0; i < BIG_COUNT; i++) {
+        iso_free(big[i]);
+    }
+
+    drain(chunks);
+
+    const size_t before = rss_bytes();
+    const size_t released = iso_alloc_trim(0);
+
+    /* Nothing is left to give back. This runs before
+     * rss_bytes() so stdio has not allocated anything */
+    const size_t again = iso_alloc_trim(0);
+    const size_t after = rss_bytes();
+
+    /* The free big zones are all unmapped */
+    if(released < (BIG_COUNT * BIG_SZ)) {
+        LOG_AND_ABORT("iso_alloc_trim() released %lu bytes, expected at least %lu", released, (BIG_COUNT * BIG_SZ));
+    }
+
+    /* The big zones were madvised when they were free'd
+     * so most of what was released was not resident */
+    if(after > before || (before - after) < (before / 4)) {
+        LOG_AND_ABORT("RSS went from %lu to %lu bytes after iso_alloc_trim() released %lu bytes", before, after, released);
+    }
+
+    if(again != 0) {
+        LOG_AND_ABORT("A second iso_alloc_trim() released %lu bytes", again);
+    }
+
+    fill(chunks);
+    iso_verify_zones();
+    drain(chunks);
+
+    free(chunks);
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+/* iso_alloc zone_map.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <time.h>
+
+/* This benchmark measures the cost of finding the zone
+ * that owns a chunk when thousands of zones are live.
+ * It creates private zones, allocates a chunk from each
+ * and frees them with iso_free() in a random order so
+ * every free has to resolve the pointer to its zone */
+
+#define DEFAULT_ZONE_COUNT_TEST 2048
+#define ROUNDS 16
+
+double elapsed(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + ((end->tv_nsec - start->tv_nsec) / 1000000000.0);
+}
+
+int main(int argc, char *argv[]) {
+    int32_t zone_count = DEFAULT_ZONE_COUNT_TEST;
+
+    if(argc == 2) {
+        zone_count = atol(argv[1]);
+    }
+
+    if(zone_count <= 0 || zone_count > (MAX_ZONES - 64)) {
+        LOG_AND_ABORT("Zone count must be between 1 and %d", MAX_ZONES - 64);
+    }
+
+    iso_alloc_zone_handle **zones = calloc(zone_count, sizeof(iso_alloc_zone_handle *));
+    void **chunks = calloc(zone_count, sizeof(void *));
+    uint32_t seed = (uint32_t) (uintptr_t) &zones;
+    struct timespec start, end;
+    double total = 0;
+
+    for(int32_t i = 0; i < zone_count; i++) {
+        zones[i] = iso_alloc_new_zone(ZONE_4096);
+
+        if(zones[i] == NULL) {
+            LOG_AND_ABORT("Failed to create zone %d", i);
+        }
+    }
+
+    for(int32_t r = 0; r < ROUNDS; r++) {
+        for(int32_t i = 0; i < zone_count; i++) {
+            chunks[i] = iso_alloc_from_zone(zones[i]);
+        }
+
+        /* Shuffle so frees don't follow creation order */
+        for(int32_t i = zone_count - 1; i > 0; i--) {
+            int32_t j = rand_r(&seed) % (i + 1);
+            void *t = chunks[i];
+            chunks[i] = chunks[j];
+            chunks[j] = t;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for(int32_t i = 0; i < zone_count; i++) {
+            iso_free(chunks[i]);
+        }
+
+        iso_flush_caches();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        total += elapsed(&start, &end);
+    }
+
+    const uint64_t frees = (uint64_t) zone_count * ROUNDS;
+    fprintf(stdout, "iso_free %lu chunks across %d zones in %f seconds (%.1f ns/free)\n",
+            frees, zone_count, total, (total * 1000000000.0) / frees);
+
+#if MEM_USAGE
+    const uint64_t hits = __atomic_load_n(&_root->zone_map_hits, __ATOMIC_RELAXED);
+    const uint64_t misses = __atomic_load_n(&_root->zone_map_misses, __ATOMIC_RELAXED);
+    fprintf(stdout, "Zone map lookups %lu hits %lu misses (%.2f%% hit rate)\n",
+            hits, misses, (hits * 100.0) / ((hits + misses) ? (hits + misses) : 1));
+#endif
+
+    free(chunks);
+    free(zones);
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+/* iso_alloc zone_metadata.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <time.h>
+
+/* This benchmark stresses the zone metadata read by the
+ * alloc and free hot paths. It keeps a few chunks live
+ * in every small size class and replaces them round robin
+ * so each operation touches a different zone. The build
+ * target runs it under perf stat, when it is available,
+ * to report the cache misses this causes */
+
+#define ITERATIONS 4194304
+#define LIVE_PER_SIZE 64
+#define SIZE_STEP 16
+#define MAX_SIZE 4096
+
+double elapsed(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + ((end->tv_nsec - start->tv_nsec) / 1000000000.0);
+}
+
+int main(int argc, char *argv[]) {
+    const int32_t size_count = MAX_SIZE / SIZE_STEP;
+    void **chunks = calloc(size_count * LIVE_PER_SIZE, sizeof(void *));
+    uint32_t seed = (uint32_t) (uintptr_t) &chunks;
+    struct timespec start, end;
+
+    for(int32_t i = 0; i < size_count * LIVE_PER_SIZE; i++) {
+        chunks[i] = iso_alloc(((i % size_count) + 1) * SIZE_STEP);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for(int32_t i = 0; i < ITERATIONS; i++) {
+        const int32_t s = i % size_count;
+        const int32_t j = (rand_r(&seed) % LIVE_PER_SIZE) * size_count + s;
+        iso_free(chunks[j]);
+        chunks[j] = iso_alloc((s + 1) * SIZE_STEP);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    const double total = elapsed(&start, &end);
+
+    fprintf(stdout, "%d alloc+free pairs over %d sizes in %f seconds (%.1f ns/alloc+free)\n",
+            ITERATIONS, size_count, total, (total * 1000000000.0) / ITERATIONS);
+    fprintf(stdout, "%d zones, %lu bytes of metadata per zone, %lu KB for MAX_ZONES\n",
+            _root->zones_used, sizeof(iso_alloc_zone_t), (sizeof(iso_alloc_zone_t) * MAX_ZONES) / 1024);
+
+    for(int32_t i = 0; i < size_count * LIVE_PER_SIZE; i++) {
+        iso_free(chunks[i]);
+    }
+
+    free(chunks);
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+/* iso_alloc zone_occupancy.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <time.h>
+
+/* This benchmark measures allocation latency as a zone
+ * approaches 100% occupancy. It fills a private zone of
+ * the smallest chunk size, which has the largest bitmap,
+ * and reports the average latency for each occupancy
+ * bucket. It then frees and reallocates a random chunk
+ * of the full zone so every allocation has to find the
+ * single free chunk */
+
+#define ROUNDS 65536
+
+static const double buckets[] = {0.5, 0.9, 0.95, 0.98, 1.0};
+#define BUCKET_COUNT (sizeof(buckets) / sizeof(double))
+
+double elapsed(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + ((end->tv_nsec - start->tv_nsec) / 1000000000.0);
+}
+
+int main(int argc, char *argv[]) {
+    iso_alloc_zone_handle *zone = iso_alloc_new_zone(SMALLEST_CHUNK_SZ);
+
+    if(zone == NULL) {
+        LOG_AND_ABORT("Failed to create a zone for %d byte chunks", SMALLEST_CHUNK_SZ);
+    }
+
+    const size_t chunk_count = ZONE_USER_SIZE / SMALLEST_CHUNK_SZ;
+    void **chunks = calloc(chunk_count, sizeof(void *));
+    uint32_t seed = (uint32_t) (uintptr_t) &chunks;
+    struct timespec start, end;
+    double bucket_total[BUCKET_COUNT] = {0};
+    uint64_t bucket_count[BUCKET_COUNT] = {0};
+    size_t allocated = 0;
+    size_t b = 0;
+
+    /* Canary chunks are never handed out so the zone is
+     * full a little before chunk_count allocations */
+    while(allocated < chunk_count) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        void *p = iso_alloc_from_zone(zone);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if(p == NULL) {
+            break;
+        }
+
+        while(b < BUCKET_COUNT - 1 && allocated >= (size_t) (buckets[b] * chunk_count)) {
+            b++;
+        }
+
+        bucket_total[b] += elapsed(&start, &end);
+        bucket_count[b]++;
+        chunks[allocated++] = p;
+    }
+
+    double lower = 0;
+
+    for(size_t i = 0; i < BUCKET_COUNT; i++) {
+        fprintf(stdout, "Occupancy %5.1f%% - %5.1f%%: %8lu allocations %.1f ns/alloc\n", lower * 100, buckets[i] * 100,
+                bucket_count[i], bucket_count[i] ? (bucket_total[i] * 1000000000.0) / bucket_count[i] : 0);
+        lower = buckets[i];
+    }
+
+    double total = 0;
+
+    for(int32_t r = 0; r < ROUNDS; r++) {
+        const size_t i = rand_r(&seed) % allocated;
+        iso_free_from_zone(chunks[i], zone);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        chunks[i] = iso_alloc_from_zone(zone);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        total += elapsed(&start, &end);
+
+        if(chunks[i] == NULL) {
+            LOG_AND_ABORT("Failed to reallocate a chunk in a full zone");
+        }
+    }
+
+    fprintf(stdout, "Full zone with %lu chunks: %d free/alloc rounds %.1f ns/alloc\n",
+            allocated, ROUNDS, (total * 1000000000.0) / ROUNDS);
+
+    for(size_t i = 0; i < allocated; i++) {
+        iso_free_from_zone(chunks[i], zone);
+    }
+
+    iso_alloc_destroy_zone(zone);
+    free(chunks);
+
+    return 0;
+}
@@ -0,0 +1,89 @@
+/* iso_alloc zone_recycle_test.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+/* Allocates and frees chunks of one size until the zone
+ * serving them crosses ZONE_ALLOC_RETIRE and is retired.
+ * A retired zone is recycled, so it must keep its index
+ * and user pages but get a new canary secret, and still
+ * pass verification when it's used again */
+
+#define CHUNK_SZ 2048
+#define BATCH 256
+
+iso_alloc_zone_t *find_zone(iso_alloc_root *root, void *p) {
+    for(uint32_t i = 0; i < root->zones_used; i++) {
+        iso_alloc_zone_t *zone = &root->zones[i];
+        void *user_pages_start = (void *) ((uintptr_t) zone->user_pages_start ^ zone->pointer_mask);
+
+        if(p >= user_pages_start && p < (user_pages_start + ZONE_USER_SIZE)) {
+            return zone;
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+#if THREAD_ZONES
+    /* Zones owned by a thread are not retired */
+    return 0;
+#endif
+    iso_alloc_root *root = _get_root();
+    void *chunks[BATCH];
+
+    void *p = iso_alloc(CHUNK_SZ);
+    iso_alloc_zone_t *zone = find_zone(root, p);
+
+    if(zone == NULL) {
+        LOG_AND_ABORT("Could not find the zone for 0x%p", p);
+    }
+
+    iso_free(p);
+
+    const uint32_t index = zone->index;
+    const uint64_t canary_secret = zone->canary_secret;
+    const void *user_pages_start = (void *) ((uintptr_t) zone->user_pages_start ^ zone->pointer_mask);
+    /* With BACKGROUND_THREAD the free path waits until
+     * a zone is well past its limit to retire it */
+    const uint32_t rounds = ((ZONE_USER_SIZE / CHUNK_SZ) * ZONE_ALLOC_RETIRE * 4) / BATCH;
+    uint32_t r = 0;
+
+    for(; r < rounds && zone->canary_secret == canary_secret; r++) {
+        for(int32_t i = 0; i < BATCH; i++) {
+            chunks[i] = iso_alloc(CHUNK_SZ);
+            memset(chunks[i], 0x41, CHUNK_SZ);
+        }
+
+        for(int32_t i = 0; i < BATCH; i++) {
+            iso_free(chunks[i]);
+        }
+
+        /* The chunk quarantine keeps the zone from
+         * being empty unless it's flushed */
+        iso_flush_caches();
+    }
+
+    if(r == rounds) {
+        LOG_AND_ABORT("Zone[%d] was not retired after %d rounds", index, r);
+    }
+
+    const void *recycled_pages_start = (void *) ((uintptr_t) zone->user_pages_start ^ zone->pointer_mask);
+
+    if(zone->index != index || recycled_pages_start != user_pages_start) {
+        LOG_AND_ABORT("Zone[%d] moved from 0x%p to 0x%p when it was retired", index, user_pages_start, recycled_pages_start);
+    }
+
+    p = iso_alloc(CHUNK_SZ);
+
+    if(find_zone(root, p) != zone) {
+        LOG_AND_ABORT("Recycled zone[%d] was not used again", index);
+    }
+
+    iso_free_permanently(p);
+    iso_verify_zones();
+
+    return 0;
+}
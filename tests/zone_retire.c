@@ -0,0 +1,77 @@
+/* iso_alloc zone_retire.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <time.h>
+
+/* This benchmark reports the cost of retiring zones. It
+ * allocates and frees batches of chunks of one size and
+ * then frees CHUNK_QUARANTINE_SZ chunks of another size
+ * to push the batch out of the chunk quarantine. So the
+ * zone that serves the batch is empty after every round
+ * and crosses ZONE_ALLOC_RETIRE over and over. The
+ * slowest frees are the ones that retired a zone, so the
+ * median of the slowest frees, one per expected retirement,
+ * is reported as the cost of a retirement. This is built
+ * without PAGE_PURGING so purges don't show up as slow
+ * frees */
+
+#define ROUNDS 16384
+#define BATCH 256
+#define FILLER_SZ 16
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+int compare(const void *a, const void *b) {
+    const uint32_t x = *(const uint32_t *) a;
+    const uint32_t y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+void churn(size_t size, uint32_t *lat, void **chunks) {
+    const size_t ops = ROUNDS * (BATCH + CHUNK_QUARANTINE_SZ);
+    const size_t retirements = (ROUNDS * BATCH) / ((ZONE_USER_SIZE / size) * ZONE_ALLOC_RETIRE);
+    size_t frees = 0;
+    uint64_t total = 0;
+    uint64_t start;
+
+    for(int32_t r = 0; r < ROUNDS; r++) {
+        for(int32_t i = 0; i < BATCH + CHUNK_QUARANTINE_SZ; i++) {
+            start = now_ns();
+            chunks[i] = iso_alloc((i < BATCH) ? size : FILLER_SZ);
+            total += now_ns() - start;
+            memset(chunks[i], 0x41, 16);
+        }
+
+        for(int32_t i = 0; i < BATCH + CHUNK_QUARANTINE_SZ; i++) {
+            start = now_ns();
+            iso_free(chunks[i]);
+            lat[frees] = now_ns() - start;
+            total += lat[frees++];
+        }
+    }
+
+    qsort(lat, frees, sizeof(uint32_t), compare);
+
+    fprintf(stdout, "%5zu byte chunks %4zu retirements %6lu ns per op, free p50 %5u ns max %8u ns, retirement %8u ns\n",
+            size, retirements, total / (ops * 2), lat[frees / 2], lat[frees - 1], lat[frees - 1 - (retirements / 2)]);
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t *lat = calloc(ROUNDS * (BATCH + CHUNK_QUARANTINE_SZ), sizeof(uint32_t));
+    void **chunks = calloc(BATCH + CHUNK_QUARANTINE_SZ, sizeof(void *));
+
+    for(size_t size = 1024; size <= 8192; size <<= 1) {
+        churn(size, lat, chunks);
+    }
+
+    free(chunks);
+    free(lat);
+
+    return 0;
+}
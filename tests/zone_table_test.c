@@ -0,0 +1,57 @@
+/* iso_alloc zone_table_test.c
+ * Copyright 2022 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+/* The zone table is committed ZONE_TABLE_COMMIT_SZ bytes
+ * at a time. This creates enough private zones that the
+ * table has to grow several times, and checks every zone
+ * still works and is found again when its chunks are freed.
+ * Each zone uses about 10 mappings so going much further
+ * needs a larger vm.max_map_count than the default */
+
+#define ZONE_COUNT 2048
+
+int main(int argc, char *argv[]) {
+    iso_alloc_zone_handle **zones = calloc(ZONE_COUNT, sizeof(iso_alloc_zone_handle *));
+    void **chunks = calloc(ZONE_COUNT, sizeof(void *));
+
+    for(int32_t i = 0; i < ZONE_COUNT; i++) {
+        zones[i] = iso_alloc_new_zone(SMALL_SZ_MAX);
+
+        if(zones[i] == NULL) {
+            LOG_AND_ABORT("Failed to create zone %d", i);
+        }
+
+        chunks[i] = iso_alloc_from_zone(zones[i]);
+
+        if(chunks[i] == NULL) {
+            LOG_AND_ABORT("Failed to allocate from zone %d", i);
+        }
+
+        memset(chunks[i], 0x41, 64);
+    }
+
+    iso_alloc_root *root = _get_root();
+
+    if(root->zones_used < ZONE_COUNT) {
+        LOG_AND_ABORT("Expected at least %d zones but there are %d", ZONE_COUNT, root->zones_used);
+    }
+
+    if(root->zones_committed < (root->zones_used * sizeof(iso_alloc_zone_t)) ||
+       root->zones_committed > (root->zones_used * sizeof(iso_alloc_zone_t)) + ZONE_TABLE_COMMIT_SZ) {
+        LOG_AND_ABORT("Zone table has %lu bytes committed for %d zones", root->zones_committed, root->zones_used);
+    }
+
+    for(int32_t i = 0; i < ZONE_COUNT; i++) {
+        iso_free_from_zone(chunks[i], zones[i]);
+    }
+
+    iso_verify_zones();
+
+    free(zones);
+    free(chunks);
+
+    return 0;
+}
@@ -3,7 +3,7 @@
 # examples of code that should crash
 $(echo '' > test_output.txt)
 
-tests=("tests" "big_tests" "interfaces_test" "thread_tests" "tagged_ptr_test")
+tests=("tests" "big_tests" "interfaces_test" "thread_tests" "tagged_ptr_test" "bitmap_kernels_test" "zone_table_test" "trim_test" "zone_recycle_test" "lazy_canary_test" "calloc_test" "aligned_test")
 failure=0
 succeeded=0
 